@@ -0,0 +1,91 @@
+#pragma once
+
+// Controller boards and the units wired to them
+//
+// A board is a pair of MCP23017 expanders, one driving the stepper enables and one reading the
+// hall sensors, whose INT line goes to its own ESP32 pin. The main board is on the ESP32's I2C
+// bus, and another can be chained on the second bus (Wire1). Every step pin comes from the
+// ESP32, where FastAccelStepper can drive up to 14 steppers, so the registry below lists 14
+// units: 12 on the main board and 2 on a chained board. UNITCOUNT (system.h) says how many
+// are fitted, left to right. Signs wider than that need another controller.
+
+#include <stdint.h>
+#include "system.h"
+
+#define BOARD_BUS_MAIN 0 // Wire: SDA=21, SCL=22
+#define BOARD_BUS_CHAIN 1 // Wire1: SDA=32, SCL=33
+#define SENSOR_A(bit) (bit) // hall sensor bits: port A in the low byte, port B in the high byte
+#define SENSOR_B(bit) ((bit) + 8)
+#define ENABLE_PIN(board, bit) ((board) * 16 + (bit)) // as passed to halSetEnablePin()
+
+typedef struct {
+  uint8_t bus;
+  uint8_t enableAddress;
+  uint8_t sensorAddress;
+  uint8_t interruptPin;
+} BoardDescriptor;
+
+typedef struct {
+  uint8_t board;
+  uint8_t stepPin;
+  uint8_t enableBit; // on the board's enable expander: port A is 0 - 7, port B 8 - 15
+  uint8_t sensorBit; // on the board's sensor expander, SENSOR_A() or SENSOR_B()
+} UnitDescriptor;
+
+constexpr BoardDescriptor boardRegistry[] = {
+  {BOARD_BUS_MAIN, 0x20, 0x21, 27},
+  {BOARD_BUS_CHAIN, 0x20, 0x21, 34}, // INT is push-pull, so an input-only pin will do
+};
+
+// These are hardware related and won't change unless the PCB is changed
+constexpr UnitDescriptor unitRegistry[] = {
+  {0, 14, 3, SENSOR_A(3)},
+  {0, 13, 2, SENSOR_A(2)},
+  {0, 5, 1, SENSOR_A(1)},
+  {0, 4, 0, SENSOR_A(0)},
+  {0, 18, 7, SENSOR_B(1)},
+  {0, 17, 6, SENSOR_B(0)},
+  {0, 16, 5, SENSOR_A(5)},
+  {0, 15, 4, SENSOR_A(4)},
+  {0, 26, 11, SENSOR_B(5)},
+  {0, 25, 10, SENSOR_B(4)},
+  {0, 23, 9, SENSOR_B(3)},
+  {0, 19, 8, SENSOR_B(2)},
+  {1, 2, 3, SENSOR_A(3)}, // strapping pins: the step lines must stay low through reset
+  {1, 12, 2, SENSOR_A(2)},
+};
+
+////////////////////////////////////////
+// For JTAG debugging, cannot use pins 13,14,15, so take units 0, 1 and 7 out of unitRegistry
+// and set UNITCOUNT to 9
+////////////////////////////////////////
+
+constexpr uint8_t boardsInUse() {
+  uint8_t count = 0;
+  for (uint8_t unit = 0; unit < UNITCOUNT; unit++) {
+    if (unitRegistry[unit].board >= count) {
+      count = unitRegistry[unit].board + 1;
+    }
+  }
+  return count;
+}
+
+// GPA7 and GPB7 can't be used as inputs on the MCP23017
+constexpr bool sensorBitsUsable() {
+  for (uint8_t unit = 0; unit < UNITCOUNT; unit++) {
+    if (unitRegistry[unit].sensorBit == 7 || unitRegistry[unit].sensorBit >= 15) {
+      return false;
+    }
+  }
+  return true;
+}
+
+constexpr uint8_t BOARDCOUNT = boardsInUse();
+
+static_assert(UNITCOUNT <= sizeof(unitRegistry) / sizeof(unitRegistry[0]), "UNITCOUNT is more units than are in unitRegistry");
+static_assert(BOARDCOUNT <= sizeof(boardRegistry) / sizeof(boardRegistry[0]), "a unit is on a board missing from boardRegistry");
+static_assert(sensorBitsUsable(), "a hall sensor is on GPA7 or GPB7");
+
+constexpr uint8_t unitEnablePin(uint8_t unit) {
+  return ENABLE_PIN(unitRegistry[unit].board, unitRegistry[unit].enableBit);
+}
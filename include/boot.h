@@ -0,0 +1,16 @@
+#pragma once
+
+// Boot phase timing
+//
+// Homing starts as soon as the steppers and port expanders are initialised, while WiFi,
+// the web server, mDNS and NTP come up in parallel on the network task. Each phase is
+// timestamped (millis since reset) the first time it is reached, to show time-to-first-display.
+
+#include <Arduino.h>
+
+enum BootPhase : uint8_t { BOOT_HARDWARE, BOOT_HOMED, BOOT_WIFI, BOOT_SERVER, BOOT_NTP, BOOT_FIRST_DISPLAY, BOOT_PHASES };
+
+void bootMark(BootPhase phase);
+boolean bootReached(BootPhase phase);
+uint32_t bootPhaseMillis(BootPhase phase);
+const char* bootPhaseName(BootPhase phase);
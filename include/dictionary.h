@@ -0,0 +1,11 @@
+#pragma once
+
+// Word dictionary packed into flash by tools/pack_words.py (from tools/words.txt).
+// Words are already filtered to the flap charset and MINWORDLEN..UNITCOUNT letters,
+// and any word can be read in constant time without loading the list into RAM.
+
+#include <Arduino.h>
+
+uint16_t dictionaryWordCount();
+boolean dictionaryWord(uint16_t index, char* word, uint8_t size);
+boolean dictionaryRandomWord(char* word, uint8_t size);
@@ -0,0 +1,78 @@
+#pragma once
+
+// Flap sets
+//
+// The drum type is chosen at build time with -D DRUM_FLAPS=<n> (see platformio.ini). Each type
+// lists its flaps in drum order, starting with the blank flap the units home to. The
+// char -> flap table is generated from that list by the compiler, so a lookup is one array
+// index, and a list that doesn't match its flap count (or repeats a flap) won't build.
+
+#include <stdint.h>
+
+#ifndef DRUM_FLAPS
+#define DRUM_FLAPS 45
+#endif
+
+#if DRUM_FLAPS == 40
+#define DRUM_CHARSET " ABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789.-?"
+#elif DRUM_FLAPS == 45
+#define DRUM_CHARSET " ABCDEFGHIJKLMNOPQRSTUVWXYZ$&#0123456789:.-?!"
+#elif DRUM_FLAPS == 60
+#define DRUM_CHARSET " ABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789.,:;-+=/?!'\"@#$%&*()<>_"
+#else
+#error "No flap set for this DRUM_FLAPS"
+#endif
+
+#define FLAPCOUNT DRUM_FLAPS // flaps on each drum
+#define FLAP_UNKNOWN 0xFF // characters that aren't on the drum
+
+constexpr char letters[] = DRUM_CHARSET;
+
+constexpr bool flapsAreUnique() {
+  for (uint8_t i = 0; i < FLAPCOUNT; i++) {
+    for (uint8_t j = i + 1; j < FLAPCOUNT; j++) {
+      if (letters[i] == letters[j]) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+static_assert(sizeof(letters) - 1 == FLAPCOUNT, "DRUM_CHARSET doesn't have DRUM_FLAPS flaps");
+static_assert(letters[0] == ' ', "the first flap must be the blank the units home to");
+static_assert(flapsAreUnique(), "DRUM_CHARSET has the same flap twice");
+
+// Flap showing each character. Lower case shows as upper case on drums without it.
+struct FlapTable {
+  uint8_t flap[256];
+
+  constexpr FlapTable() : flap() {
+    for (int c = 0; c < 256; c++) {
+      flap[c] = FLAP_UNKNOWN;
+    }
+    for (uint8_t i = 0; i < FLAPCOUNT; i++) {
+      flap[(uint8_t)letters[i]] = i;
+    }
+    for (int c = 'a'; c <= 'z'; c++) {
+      if (flap[c] == FLAP_UNKNOWN) {
+        flap[c] = flap[c - 'a' + 'A'];
+      }
+    }
+  }
+};
+
+constexpr FlapTable flapTable;
+
+constexpr uint8_t flapForChar(char c) {
+  return flapTable.flap[(uint8_t)c];
+}
+
+// Drum geometry, in stepper steps. The blank flap shows calOffset steps after the magnet edge
+// (the origin), and each flap is a whole number of steps on from the blank flap, worked out
+// afresh from the revolution so that rounding never builds up from one flap to the next.
+#define FLAP_STEP_SCALE 256 // fixed point fraction of a step the revolution is held to
+
+void drumFlapSteps(float flapStep, int32_t flapSteps[FLAPCOUNT + 1]);
+int32_t drumFlapTarget(const int32_t flapSteps[FLAPCOUNT + 1], int32_t originPosition, uint8_t calOffset, uint8_t flap,
+                       int32_t earliest);
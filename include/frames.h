@@ -0,0 +1,27 @@
+#pragma once
+
+// Display frame queue
+//
+// Frames are queued whole, but each unit pulls its next letter as soon as it has landed
+// its current one and held it for that frame's hold time, so a sequence plays at the speed
+// of each drum rather than the slowest. A barrier frame lands together: once every unit has
+// finished the frame before it, it is planned like a new display (see scheduler.h), and no
+// unit moves on from it until every unit has landed it and held it.
+// Only used from the motion task.
+
+#include <Arduino.h>
+#include "system.h"
+#include "unit.h"
+
+#define FRAME_QUEUE_SIZE 8
+
+typedef struct {
+  char text[UNITCOUNT + 1];
+  uint16_t holdMs;
+  boolean barrier;
+} Frame;
+
+boolean frameQueuePush(const char* text, uint16_t holdMs, boolean barrier);
+void frameQueueClear();
+boolean frameQueueEmpty();
+boolean frameQueueUpdate(Unit* units[]);
@@ -0,0 +1,123 @@
+#pragma once
+
+// Hardware abstraction layer
+//
+// Everything the firmware needs from the board goes through here, so the same Unit and
+// event loop code can run either on the ESP32 (src/hal_esp32.cpp) or against the drum
+// and hall-sensor simulator on a dev box (src/sim/, built by [env:native]).
+// Time is taken from the usual Arduino millis()/micros()/delay(), which the native
+// build backs with the simulator's virtual clock.
+
+#include <stdint.h>
+#include <stddef.h>
+
+// A single stepper motor driving one drum (subset of FastAccelStepper used by Unit)
+class HalStepper {
+  public:
+    virtual ~HalStepper() {}
+    virtual void move(int32_t steps) = 0;
+    virtual void moveTo(int32_t position) = 0;
+    virtual void runForward() = 0;
+    virtual void forceStop() = 0;
+    virtual void forceStopAndNewPosition(int32_t position) = 0;
+    virtual bool isRunning() = 0;
+    virtual void setSpeedInUs(uint32_t speed_us) = 0;
+    virtual void setAcceleration(int32_t acceleration) = 0;
+    virtual int32_t getCurrentPosition() = 0;
+    // Where it would come to rest if it started slowing down now, or its target if that's sooner
+    virtual int32_t getStoppingPosition() = 0;
+};
+
+// Steppers
+void halSteppersInit();
+HalStepper* halStepperConnect(uint8_t stepPin, uint8_t enablePin);
+
+// MCP23017 port expanders (stepper enables and hall sensors), a pair on each board in boards.h
+//
+// The enable outputs are kept in a shadow register per board and only written when they
+// change, both ports in one sequential write. Enable pins are numbered ENABLE_PIN(board, bit).
+// Between halEnableBatchBegin() and halEnableBatchEnd() changes made by the calling task are
+// held back and written together at the end, one write per board that changed.
+// The sensor ports are read in a single burst (INTCAP and GPIO for both ports). Each board's
+// sensor interrupt calls the ISR with the board number.
+typedef struct {
+  uint8_t capturedA; // INTCAP: port values when the interrupt occurred
+  uint8_t capturedB;
+  uint8_t portA; // GPIO: current port values
+  uint8_t portB;
+} HalSensorPorts;
+
+typedef struct {
+  uint32_t transactions;
+  uint32_t bytes;
+} HalI2cStats;
+
+void halExpandersInit();
+void halSetEnablePin(uint8_t pin, bool enabled);
+bool halEnablePinSet(uint8_t pin);
+void halEnableBatchBegin();
+void halEnableBatchEnd();
+void halReadSensorPorts(uint8_t board, HalSensorPorts &ports);
+void halAttachSensorInterrupt(void (*isr)(uint8_t board));
+void halGetI2cStats(HalI2cStats &stats);
+
+// Networking
+void halNetworkBegin(const char* ssid, const char* password);
+bool halNetworkConnected();
+void halNetworkLocalIP(char* buffer, uint8_t size);
+
+// Display group messages (see sync.h): UDP multicast on the ESP32, loopback in the simulator.
+// Receiving doesn't wait, and returns 0 when nothing is waiting.
+bool halGroupBegin(const char* address, uint16_t port);
+bool halGroupSend(const void* data, size_t size);
+size_t halGroupReceive(void* data, size_t size);
+
+// Command datagrams (see udp_api.h), received into the caller's buffer without allocating.
+// Receiving doesn't wait, and drops (returning 0) anything that doesn't fit with a byte to
+// spare, so that a datagram that was too long can't pass for one that wasn't. A reply goes to
+// the sender of the last datagram received.
+bool halCommandBegin(uint16_t port);
+size_t halCommandReceive(void* data, size_t size);
+bool halCommandReply(const void* data, size_t size);
+
+// Wall clock in ms since 1970, or 0 until it has been set (by NTP)
+uint64_t halEpochMillis();
+
+// Persistent storage (NVS on the ESP32): small blobs by key that survive power loss.
+// Reads fail if the key is missing or was stored with a different size.
+bool halStorageRead(const char* key, void* data, size_t size);
+bool halStorageWrite(const char* key, const void* data, size_t size);
+
+// Tasks: step() does one pass of work and returns the longest it may sleep (ms) before
+// being run again. A task is also woken early by halNotifyTask().
+typedef uint32_t (*HalTaskStep)();
+uint8_t halStartTask(const char* name, HalTaskStep step, uint8_t core, uint8_t priority);
+void halNotifyTask(uint8_t task);
+void halNotifyTaskFromISR(uint8_t task);
+
+// Time each task has spent in its step function (host time in the simulator). Fails for a
+// task number that hasn't been started.
+typedef struct {
+  const char* name;
+  uint32_t runs;
+  uint32_t busyMs;
+  uint32_t longestUs;
+} HalTaskStats;
+
+bool halGetTaskStats(uint8_t task, HalTaskStats &stats);
+
+// Heap: what's free, the largest block that could be allocated, the least that has been
+// free since boot, and (simulator only, 0 on the ESP32) how many allocations have been made.
+// Sampling before and after an update shows whether it allocated.
+typedef struct {
+  uint32_t freeBytes;
+  uint32_t largestFreeBlock;
+  uint32_t minimumFreeBytes;
+  uint32_t allocations;
+} HalHeapStats;
+
+void halGetHeapStats(HalHeapStats &stats);
+
+// System
+void halRestart();
+void halSleep();
@@ -0,0 +1,82 @@
+#pragma once
+
+// Static memory for ArduinoJson documents
+//
+// A JsonDocument given a JsonPool takes its memory from a fixed static buffer instead of the
+// heap. Blocks are handed out in order and only given back all at once, by reset() before
+// the next document is parsed, so there is nothing to fragment. A document that needs more
+// than the pool holds fails to parse with DeserializationError::NoMemory.
+// Each pool must only be used by one task.
+
+#include <ArduinoJson.h>
+#include <string.h>
+
+template <size_t SIZE>
+class JsonPool : public ArduinoJson::Allocator {
+  public:
+    // Forget every block: only when no document is using the pool
+    void reset() {
+      used = 0;
+      lastBlock = nullptr;
+    }
+
+    size_t peak() const { return peakUsed; }
+
+    void* allocate(size_t size) override {
+      size_t needed = HEADER + align(size);
+
+      if (used + needed > SIZE) {
+        return nullptr;
+      }
+      uint8_t* block = memory + used + HEADER;
+      setBlockSize(block, size);
+      used += needed;
+      peakUsed = used > peakUsed ? used : peakUsed;
+      lastBlock = block;
+      return block;
+    }
+
+    void deallocate(void* ptr) override {
+      // the last block can be taken back straight away, the rest wait for reset()
+      if (ptr != nullptr && ptr == lastBlock) {
+        used = (uint8_t*)ptr - memory - HEADER;
+        lastBlock = nullptr;
+      }
+    }
+
+    void* reallocate(void* ptr, size_t newSize) override {
+      if (ptr == nullptr) {
+        return allocate(newSize);
+      }
+      // the last block grows or shrinks in place
+      if (ptr == lastBlock) {
+        size_t start = (uint8_t*)ptr - memory;
+        if (start + align(newSize) > SIZE) {
+          return nullptr;
+        }
+        setBlockSize(ptr, newSize);
+        used = start + align(newSize);
+        peakUsed = used > peakUsed ? used : peakUsed;
+        return ptr;
+      }
+      void* moved = allocate(newSize);
+      if (moved != nullptr) {
+        size_t oldSize = blockSize(ptr);
+        memcpy(moved, ptr, oldSize < newSize ? oldSize : newSize);
+      }
+      return moved;
+    }
+
+  private:
+    static constexpr size_t ALIGNMENT = 8;
+    static constexpr size_t HEADER = ALIGNMENT; // block size, kept in front of each block
+
+    alignas(ALIGNMENT) uint8_t memory[SIZE];
+    size_t used = 0;
+    size_t peakUsed = 0;
+    void* lastBlock = nullptr;
+
+    static size_t align(size_t size) { return (size + ALIGNMENT - 1) & ~(ALIGNMENT - 1); }
+    static size_t blockSize(void* block) { return *(size_t*)((uint8_t*)block - HEADER); }
+    static void setBlockSize(void* block, size_t size) { *(size_t*)((uint8_t*)block - HEADER) = size; }
+};
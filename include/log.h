@@ -0,0 +1,81 @@
+#pragma once
+
+// Deferred-format event log
+//
+// Logging from the motion and sensor paths only records an event number, up to LOG_MAX_ARGS
+// integer arguments and a micros() timestamp in a lock-free ring; the text is formatted and
+// written out later by whoever drains it. With LOG_SINK_SERIAL a low priority task drains it
+// to Serial, with LOG_SINK_HTTP a GET to /log does (and nothing is printed until then).
+// logEvent() can be called from any task or ISR. When the ring is full new events are dropped
+// and counted, and the count is reported with the next event drained.
+
+#include <Arduino.h>
+#include "debug.h"
+
+#define LOG_SINK_SERIAL 0
+#define LOG_SINK_HTTP 1
+#ifndef LOG_SINK
+#define LOG_SINK LOG_SINK_SERIAL
+#endif
+
+#define LOG_RING_SIZE 256 // events, a power of two
+#define LOG_MAX_ARGS 4
+#define LOG_LINE_SIZE 128 // longest formatted event
+#define LOG_DRAIN_MS 20 // how often the log task looks for new events
+#define LOG_DRAIN_BATCH 16 // events written before the log task yields
+#define LOG_TASK_CORE 0
+#define LOG_TASK_PRIORITY 0
+
+enum LogLevel : uint8_t { LOG_INFO, LOG_WARNING, LOG_ERROR };
+
+// Format and level of each event are in logEventFormats[] (log.cpp), in the same order
+enum LogEvent : uint16_t {
+  LOG_UNIT_RESTORED, // unit, letter
+  LOG_UNIT_RESTORE_OUT, // unit, steps
+  LOG_UNIT_RESTORE_VERIFIED, // unit, steps
+  LOG_UNIT_REVOLUTION_IGNORED, // unit, steps
+  LOG_UNIT_AUTOTUNE_STARTED, // unit
+  LOG_UNIT_SPEED_LEVEL, // unit, level, speed us, acceleration
+  LOG_UNIT_SPEED_TUNE_BUSY, // unit
+  LOG_UNIT_SPEED_TUNE_STARTED, // unit
+  LOG_UNIT_SPEED_TUNE_ABANDONED, // unit
+  LOG_UNIT_SPEED_MISSED, // unit, steps, level
+  LOG_UNIT_SPEED_TUNED, // unit, speed us, acceleration
+  LOG_UNIT_OFFSET_SET, // unit, steps
+  LOG_UNIT_NO_FLAP, // unit, letter
+  LOG_UNIT_FLAPS_TO_MOVE, // unit, flaps
+  LOG_UNIT_WRAP, // unit, letter
+  LOG_UNIT_MOVE, // unit, letter
+  LOG_UNIT_PREINITIALISE_STARTED, // unit
+  LOG_UNIT_PREINITIALISE_COMPLETED, // unit
+  LOG_UNIT_CALIBRATION_STARTED, // unit
+  LOG_UNIT_CALIBRATION_FAILED, // unit
+  LOG_UNIT_CALIBRATION_ORIGIN, // unit
+  LOG_UNIT_CALIBRATED, // unit
+  LOG_UNIT_MISSED_ORIGIN, // unit
+  LOG_UNIT_ORIGIN, // unit, position
+  LOG_UNIT_HALL_LOST, // unit
+  LOG_UNIT_HALL_AFTER_ORIGIN, // unit, steps
+  LOG_UNIT_HALL_KEEP_MISSING, // unit
+  LOG_UNIT_HALL_FROM_ORIGIN, // unit, steps
+  LOG_UNIT_CORRECTED, // unit, steps
+  LOG_UNIT_GLITCH, // unit, hall value, us, destination letter
+  LOG_FRAME_QUEUE_FULL,
+  LOG_DISPLAY_LANDS, // ms
+  LOG_UNIT_STUCK, // unit
+  LOG_UNIT_RETRY, // unit, failures, ms
+  LOG_UNIT_OUT_OF_SERVICE, // unit, failures
+  LOG_UNIT_DEGRADED, // unit, failures
+  LOG_UNIT_RECOVERED, // unit
+  LOG_EVENTS
+};
+
+void logStart();
+void logEvent(LogEvent event, int32_t a = 0, int32_t b = 0, int32_t c = 0, int32_t d = 0);
+
+// Drain: format the oldest event into line, returning its length, or 0 if there are none.
+// Any task may drain, but only one at a time: another that tries meanwhile gets 0.
+size_t logFormatNext(char* line, size_t size, boolean colour);
+
+// Write everything logged so far to Serial before the caller restarts or halts
+void logFlush();
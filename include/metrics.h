@@ -0,0 +1,48 @@
+#pragma once
+
+// Telemetry for GET /metrics (Prometheus text format)
+//
+// Per-unit counters and settle time histograms are kept in atomics that only the motion task
+// writes, so recording one is a plain load and store, and the network task reads them without
+// locking. Why the controller last restarted, and how often for each reason, is kept in RTC
+// memory across restarts. A restart the firmware didn't ask for (a crash, brownout or the
+// hardware watchdog) leaves no reason behind and is counted as "other".
+
+#include <Arduino.h>
+#include "system.h"
+
+#define METRICS_SETTLE_BUCKETS 8
+#define METRICS_SETTLE_BUCKET_MS {500, 1000, 2000, 3000, 4000, 6000, 10000, 20000} // upper bounds, then +Inf
+#define RESTART_HISTORY_MAGIC 0x5254
+
+enum RestartReason : uint8_t {
+  RESTART_POWER_ON,
+  RESTART_OTHER, // not asked for by the firmware
+  RESTART_REQUESTED, // from the serial console
+  RESTART_REASONS
+};
+
+// Kept in RTC memory, like UnitState
+typedef struct {
+  uint16_t magic;
+  uint8_t pendingReason; // why the next start happened, set just before restarting
+  uint8_t lastReason;
+  uint32_t counts[RESTART_REASONS];
+} RestartHistory;
+
+void metricsRestoreRestarts(RestartHistory* history);
+void metricsRecordRestart(RestartReason reason);
+
+// Motion task only
+void metricsMoveStarted(uint8_t unit);
+void metricsMoveSettled(uint8_t unit, uint32_t settleMs, uint32_t steps);
+void metricsCalibrationStarted(uint8_t unit);
+void metricsCalibrationCompleted(uint8_t unit, uint32_t durationMs);
+void metricsCalibrationFailed(uint8_t unit);
+void metricsGlitch(uint8_t unit);
+void metricsNoiseEdge(uint8_t unit);
+void metricsUnitFault(uint8_t unit);
+void metricsUnitHealth(uint8_t unit, uint8_t health); // UnitHealth
+
+// Write every metric as text, a buffer at a time
+void metricsWrite(void (*write)(const char* text, size_t length));
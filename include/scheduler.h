@@ -0,0 +1,20 @@
+#pragma once
+
+// Motion scheduler
+//
+// Limits how many steppers run at once (the motor budget) and orders moves to finish as
+// soon as possible within it. A new display is planned so every unit lands together when
+// the budget allows all of them to run; otherwise the longest moves start first and the
+// rest follow as motors free up. A display can also be planned to land at a given time
+// (see sync.h). Only used from the motion task.
+
+#include <Arduino.h>
+#include "system.h"
+#include "unit.h"
+
+void schedulerSetMotorBudget(uint8_t budget);
+uint8_t schedulerMotorBudget();
+uint8_t schedulerMotorsEnabled(Unit* units[]);
+uint32_t schedulerPlanDisplay(Unit* units[], const char* text, uint8_t length);
+uint32_t schedulerPlanDisplayAt(Unit* units[], const char* text, uint8_t length, uint32_t landMillis);
+boolean schedulerStartMoves(Unit* units[]);
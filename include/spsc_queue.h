@@ -0,0 +1,50 @@
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+
+// Lock-free single producer / single consumer ring buffer for passing fixed size items
+// between two tasks (or an ISR and a task). Holds up to SIZE - 1 items.
+template <typename T, uint8_t SIZE>
+class SpscQueue {
+  public:
+    SpscQueue() : head(0), tail(0) {}
+
+    // Producer side only
+    bool push(const T& item) {
+      uint8_t current = head.load(std::memory_order_relaxed);
+      uint8_t next = (current + 1) % SIZE;
+      if (next == tail.load(std::memory_order_acquire)) {
+        return false; // full
+      }
+      items[current] = item;
+      head.store(next, std::memory_order_release);
+      return true;
+    }
+
+    // Producer side only: a push would fail
+    bool full() const {
+      uint8_t next = (head.load(std::memory_order_relaxed) + 1) % SIZE;
+      return next == tail.load(std::memory_order_acquire);
+    }
+
+    // Consumer side only
+    bool pop(T& item) {
+      uint8_t current = tail.load(std::memory_order_relaxed);
+      if (current == head.load(std::memory_order_acquire)) {
+        return false; // empty
+      }
+      item = items[current];
+      tail.store((current + 1) % SIZE, std::memory_order_release);
+      return true;
+    }
+
+    bool empty() const {
+      return tail.load(std::memory_order_acquire) == head.load(std::memory_order_acquire);
+    }
+
+  private:
+    T items[SIZE];
+    std::atomic<uint8_t> head;
+    std::atomic<uint8_t> tail;
+};
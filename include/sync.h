@@ -0,0 +1,58 @@
+#pragma once
+
+// Display groups
+//
+// Several cabinets side by side can run as one sign. The leader sends each new text for the
+// whole sign to the group over UDP multicast, with the moment it should land: far enough ahead
+// for the slowest possible move. Every controller (the leader too) shows its own columns of
+// the text and staggers its moves to land then, using its NTP-set clock. A follower whose
+// clock isn't set yet uses the delay in the frame instead, counted from when it arrives.
+// Each frame is sent SYNC_REPEATS times, and followers drop the copies by sequence number.
+// Only used from the network task.
+
+#include <Arduino.h>
+#include "system.h"
+#include "unit.h"
+
+#define SYNC_ROLE_NONE 0
+#define SYNC_ROLE_LEADER 1
+#define SYNC_ROLE_FOLLOWER 2
+
+// Group settings, the same on every controller except SYNC_ROLE and SYNC_COLUMN (set them in config-private.h)
+#ifndef SYNC_ROLE
+#define SYNC_ROLE SYNC_ROLE_NONE
+#endif
+#ifndef SYNC_COLUMN
+#define SYNC_COLUMN 0 // first column of the sign shown by this controller
+#endif
+#ifndef SYNC_SIGN_WIDTH
+#define SYNC_SIGN_WIDTH UNITCOUNT // columns across the whole sign
+#endif
+#define SYNC_GROUP_ADDRESS "239.255.70.70"
+#define SYNC_GROUP_PORT 4210
+#define SYNC_MAX_TEXT SIGN_MAX_COLUMNS
+#define SYNC_LEAD_MS 500 // allowance for the frame to reach every follower
+#define SYNC_REPEATS 2 // copies of each frame sent (multicast over WiFi isn't acknowledged)
+#define SYNC_MAX_LAND_MS 20000 // frames landing further ahead than this are clock errors
+#define SYNC_MAGIC 0x47465353 // "SSFG"
+
+static_assert(SYNC_SIGN_WIDTH <= SYNC_MAX_TEXT, "SYNC_SIGN_WIDTH is wider than a group frame");
+static_assert(SYNC_COLUMN + UNITCOUNT <= SYNC_SIGN_WIDTH, "this controller's columns are off the edge of the sign");
+
+// On the wire (little-endian), sent with the text's terminator and nothing after it
+typedef struct __attribute__((packed)) {
+  uint32_t magic;
+  uint32_t sequence;
+  uint64_t landEpochMs; // wall clock time to land at, 0 if the leader's clock isn't set
+  uint32_t landInMs; // the same, counted from when the frame was sent
+  char text[SYNC_MAX_TEXT + 1]; // the whole sign
+} SyncFrame;
+
+void syncConfigure(uint8_t role, uint8_t column, uint8_t signWidth);
+void syncStart(Unit* units[]);
+void syncUpdate();
+boolean syncIsLeader();
+boolean syncIsFollower();
+boolean syncLeadDisplay(const char* text);
+const char* syncColumns(const char* text);
+uint8_t syncSignWidth();
@@ -1,39 +1,95 @@
 #pragma once
 
 #include <Arduino.h>
-#include <ArduinoJson.h>
-#include <WebServer.h>
 #include "debug.h"
+#include "spsc_queue.h"
 #if __has_include(<config-private.h>)
     #include "config-private.h"
 #else
     #include "config.h"
 #endif
-#include <WiFiClientSecure.h>
-#include <ESPmDNS.h>
 
-// Specify number of Units (characters) in the display (4 - 12)
+// Specify number of Units (characters) in the display (4 - 14, over 12 needs a chained board, see boards.h)
+#ifndef UNITCOUNT
 #define UNITCOUNT 12
+#endif
+
+// Widest sign, across all the controllers of a display group (see sync.h). Text for the whole
+// sign is held in fixed buffers of this many columns plus the terminator.
+#define SIGN_MAX_COLUMNS 64
+
+// Static memory for parsing API requests (a /frames request with a full queue fits) and words (see json_pool.h)
+#define API_JSON_POOL_SIZE 4096
+#define WORD_JSON_POOL_SIZE 1024
+
+// Most steppers allowed to run at once. Lower this (e.g. in config-private.h) if the power
+// supply browns out when every drum starts together.
+#ifndef MOTOR_BUDGET
+#define MOTOR_BUDGET UNITCOUNT
+#endif
 
 // Specify the network name of the display (useful if you have more than one display)
 #define NETWORKNAME "splitflap"
 
 #define STR_HELPER(x) #x
 #define STR(x) STR_HELPER(x)
-#define WORDNIKURL "https://api.wordnik.com/v4/words.json/randomWord?hasDictionaryDef=true&excludePartOfSpeech=family-name%2Cgiven-name%2Cproper-noun%2Cproper-noun-plural&minCorpusCount=100&maxCorpusCount=-1&minDictionaryCount=1&maxDictionaryCount=-1&minLength=" STR(MINWORDLEN) "&maxLength=" STR(UNITCOUNT) "&api_key=" WORDNIKAPIKEY
+// Word server, can be pointed at a local plain HTTP stand-in for testing from config-private.h
+#ifndef WORDNIK_HOST
+#define WORDNIK_HOST "api.wordnik.com"
+#define WORDNIK_PORT 443
+#define WORDNIK_TLS 1
+#endif
+#define WORDNIKPATH "/v4/words.json/randomWord?hasDictionaryDef=true&excludePartOfSpeech=family-name%2Cgiven-name%2Cproper-noun%2Cproper-noun-plural&minCorpusCount=100&maxCorpusCount=-1&minDictionaryCount=1&maxDictionaryCount=-1&minLength=" STR(MINWORDLEN) "&maxLength=" STR(UNITCOUNT) "&api_key=" WORDNIKAPIKEY
 #define NTP_MIN_VALID_EPOCH 1577836800  //2020-1-1
-#define RTC_MAGIC 0x76b78ec4
+#define RTC_MAGIC 0x76b78ec5
+
+// Commands passed from the network task to the motion task
+enum DisplayCommandType : uint8_t { CMD_DISPLAY, CMD_MOVE_FLAPS, CMD_MOVE_ALL_FLAPS, CMD_MOVE_STEPS, CMD_AUTOTUNE, CMD_SET_OFFSET, CMD_QUEUE_FRAME, CMD_SPEED_TUNE, CMD_CLEAR_FRAMES };
+#define CMD_FLAG_BARRIER 0x01 // CMD_QUEUE_FRAME: frame lands on all units together
+#define DISPLAY_KEEP_LETTER '\x1F' // in CMD_DISPLAY text: leave this unit as it is
+
+typedef struct {
+  DisplayCommandType type;
+  uint8_t unit;
+  int16_t count; // CMD_QUEUE_FRAME: hold time in ms
+  uint8_t flags;
+  char text[UNITCOUNT + 1];
+  uint32_t landMillis; // CMD_DISPLAY: land at this millis(), or as soon as possible if that's too soon
+} DisplayCommand;
+
+#define COMMAND_QUEUE_SIZE 8
+extern SpscQueue<DisplayCommand, COMMAND_QUEUE_SIZE> commandQueue;
 
 void disableCertificates();
 boolean synchroniseWith_NTP_Time(time_t &now, tm &timeinfo);
 boolean getNTP(time_t &now, tm &timeinfo);
-String wordOfTheDay();
+void startNTP(time_t &now);
+boolean ntpSynchronised();
+boolean fetchWord(char* word, uint8_t size);
 void setup_routing();
+void handle_client();
 void sendwebpage();
 void receiveAPI();
+void receiveFrames();
+void sendStatus();
+void sendLog();
+void sendMetrics();
+void sendTrace();
 void receiveInput();
 void randomWord ();
 void handle_NotFound();
-String padToFullWidth (const char* word);
+char* padToFullWidth (const char* word, char* padded, size_t size);
+void upperCaseText(char* text);
 
-extern void displayString(String display);
+extern void displayString(const char* text);
+extern void displayStringAt(const char* text, uint32_t landMillis);
+extern DisplayCommand makeCommand(DisplayCommandType type, uint8_t unit = 0, int16_t count = 0, uint8_t flags = 0);
+extern boolean queueCommand(const DisplayCommand& command);
+extern boolean queueDisplayString(const char* text);
+extern boolean queueDisplayAt(const char* text, uint32_t landMillis);
+extern boolean queueFrame(const char* text, uint16_t holdMs, boolean barrier);
+extern boolean queueFrameText(const char* text, uint16_t holdMs, boolean barrier);
+extern volatile boolean displayIdle;
+extern uint32_t displayLandsInMs();
+extern void displayCurrentText(char* buffer, uint8_t size);
+extern const char* displayUnitHealth(uint8_t unit);
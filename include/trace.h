@@ -0,0 +1,91 @@
+#pragma once
+
+// Event trace
+//
+// An always-on circular record of what each unit was told to do and what it did: move
+// requests, hall edges and stops coming in, stepper commands and calibration outcomes going
+// out, plus the commands taken from the command queue. Each record is 12 bytes with a
+// micros() timestamp. The ring is kept in RTC memory, so the run up to a soft restart (a
+// crash, the hardware watchdog or a restart from the console) can still be downloaded
+// afterwards, from GET /trace.
+//
+// The simulator replays a downloaded trace against the Unit code (program --replay, see
+// tools/trace.py): from each unit's first homing run in the trace, it feeds the recorded
+// inputs to a fresh Unit and checks it issues the same outputs.
+// Only written by the motion task.
+
+#include <Arduino.h>
+#include "hal.h"
+#include "system.h"
+
+#ifndef TRACE_RECORDS
+#define TRACE_RECORDS 320 // 3840 bytes of the ESP32's 8 KB of RTC slow memory
+#endif
+#define TRACE_MAGIC 0x52544653 // "SFTR"
+#define TRACE_VERSION 3
+
+enum TraceType : uint8_t {
+  TRACE_BOOT, // value: records kept from before the restart
+  // inputs to a unit
+  TRACE_COMMAND, // arg: DisplayCommandType, value: count, or the first 4 letters of a display
+  TRACE_TUNING, // just before TRACE_CALIBRATE, arg: calOffset | revolutions averaged << 8, value: flapStep (float bits)
+  TRACE_CALIBRATE, // calibrateStart(), arg: hall value, value: us since the hall sensor last changed
+  TRACE_RECALIBRATE, // recalibrate()
+  TRACE_MOVE_TO_LETTER, // arg: letter, value: position
+  TRACE_HALL_EDGE, // at the edge's captured time, arg: hall value (| TRACE_EDGE_SAME_PASS), value: position
+  TRACE_HALL_LOST, // edges were dropped
+  TRACE_STOPPED, // value: position
+  TRACE_STUCK, // stopStuck(): the display's moving watchdog ran out
+  TRACE_STOPPING_AT, // just before TRACE_MOVE_TO_LETTER while running, value: where it would stop
+  // outputs of a unit
+  TRACE_STEPPER_MOVE, // value: steps
+  TRACE_STEPPER_MOVE_TO, // value: target
+  TRACE_STEPPER_RUN_FORWARD,
+  TRACE_STEPPER_STOP, // forceStop(), or forceStopAndNewPosition() with arg 1, value: position
+  TRACE_CALIBRATED,
+  TRACE_CALIBRATION_FAILED,
+  TRACE_GLITCH, // value: us since the last edge
+  TRACE_MISSED_ORIGIN,
+  TRACE_TYPES
+};
+
+#define TRACE_FIRST_OUTPUT TRACE_STEPPER_MOVE
+#define TRACE_EDGE_SAME_PASS 0x100 // popped after another edge, in the same processHallEdges()
+
+typedef struct __attribute__((packed)) {
+  uint32_t timeUs;
+  uint8_t type; // TraceType
+  uint8_t unit;
+  uint16_t arg;
+  int32_t value;
+} TraceRecord;
+
+// At the start of a downloaded trace, followed by count records, oldest first
+typedef struct __attribute__((packed)) {
+  uint32_t magic;
+  uint8_t version;
+  uint8_t recordSize;
+  uint8_t unitCount;
+  uint8_t flapCount;
+  uint32_t count;
+} TraceHeader;
+
+void traceStart();
+void trace(TraceType type, uint8_t unit, uint16_t arg = 0, int32_t value = 0);
+void traceAt(uint32_t timeUs, TraceType type, uint8_t unit, uint16_t arg = 0, int32_t value = 0);
+void traceClear();
+
+// A command taken from the command queue
+void traceCommand(const DisplayCommand& command);
+
+// Copy out the records currently held, oldest first, returning how many
+size_t traceSnapshot(TraceRecord* records, size_t size);
+
+// Header and records, a buffer at a time (from any task)
+void traceWrite(void (*write)(const char* data, size_t length));
+
+// Records each command given to a unit's stepper
+HalStepper* traceStepper(uint8_t unit, HalStepper* stepper);
+
+// Also hand each record to listener as it is written (the simulator's replay)
+void traceSetListener(void (*listener)(const TraceRecord& record));
@@ -0,0 +1,76 @@
+#pragma once
+
+// Binary command datagrams
+//
+// A compact alternative to the HTTP JSON API for clients that update the display often: one
+// fixed-layout UDP datagram per command, read straight off the socket into a static buffer
+// and queued for the motion task without any heap allocation. Every datagram is answered with
+// a UdpReply echoing its sequence number. A client that gets no reply sends the same datagram
+// again; one whose sequence number was seen recently isn't acted on twice, just answered with
+// the same result. tools/udp_client.py is a client for it.
+// Only used from the network task.
+
+#include <Arduino.h>
+#include "system.h"
+#include "sync.h"
+
+#define UDP_API_PORT 4211
+#define UDP_API_MAGIC 0x4653 // "SF"
+#define UDP_API_VERSION 1
+#define UDP_API_HISTORY 8 // recent sequence numbers of commands, remembered for repeats
+
+enum UdpOp : uint8_t {
+  UDP_OP_STATUS, // nothing else: just the reply
+  UDP_OP_DISPLAY, // UdpText: whole sign, padded with blanks (replaces any frames)
+  UDP_OP_UNITS, // UdpUnits: letters for some units, the rest left as they are (replaces any frames)
+  UDP_OP_QUEUE_FRAME, // UdpText: queued behind any frames playing, padded with blanks
+  UDP_OP_CLEAR_FRAMES, // nothing else
+};
+
+enum UdpResult : uint8_t { UDP_OK, UDP_REPEAT, UDP_QUEUE_FULL, UDP_MALFORMED };
+
+#define UDP_FLAG_BARRIER 0x01 // UDP_OP_QUEUE_FRAME: frame lands on all units together
+
+// On the wire, little-endian
+typedef struct __attribute__((packed)) {
+  uint16_t magic;
+  uint8_t version;
+  uint8_t op;
+  uint32_t sequence;
+} UdpHeader;
+
+typedef struct __attribute__((packed)) {
+  uint16_t holdMs; // UDP_OP_QUEUE_FRAME
+  uint8_t flags; // UDP_OP_QUEUE_FRAME
+  uint8_t length;
+  char text[SYNC_MAX_TEXT]; // only length sent, not terminated
+} UdpText;
+
+typedef struct __attribute__((packed)) {
+  uint8_t unit;
+  char letter;
+} UdpUnitLetter;
+
+typedef struct __attribute__((packed)) {
+  uint8_t count;
+  UdpUnitLetter units[UNITCOUNT]; // only count sent
+} UdpUnits;
+
+typedef struct __attribute__((packed)) {
+  UdpHeader header;
+  union {
+    UdpText text;
+    UdpUnits units;
+  };
+} UdpRequest;
+
+typedef struct __attribute__((packed)) {
+  UdpHeader header; // as in the request
+  uint8_t result; // UdpResult
+  uint8_t idle;
+  uint32_t landsInMs;
+  char text[UNITCOUNT]; // letter each of this controller's units is showing or moving to
+} UdpReply;
+
+void udpApiStart();
+void udpApiUpdate();
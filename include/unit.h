@@ -1,33 +1,90 @@
 #pragma once
 
 #include <Arduino.h>
-#include "FastAccelStepper.h"
+#include "hal.h"
 #include "debug.h"
+#include "spsc_queue.h"
+#include "drum.h"
+#include "boards.h"
 
-// Customise below for each unit for your build. (Units are numbered left to right 0 - 11)
-const uint8_t calOffsetUnit[] = {87, 62, 77, 65, 89, 104, 107, 82, 95, 97, 90, 55};
-const float FlapStep[] = {2038.0/45, 2038.0/45, 2038.0/45, 2050.0/45, 2049.0/45, 2049.0/45, 2049.0/45, 2038.0/45, 2051.0/45, 2051.2/45, 2049.0/45, 2038.0/45}; // stepper motor steps per rotation per flap, for each unit motor
+// Customise below for each unit for your build. (Units are numbered left to right 0 - 13)
+// FlapStep is refined automatically while running; calOffset can be adjusted from the serial menu
+const uint8_t calOffsetUnit[] = {87, 62, 77, 65, 89, 104, 107, 82, 95, 97, 90, 55, 90, 90};
+const float FlapStep[] = {2038.0/FLAPCOUNT, 2038.0/FLAPCOUNT, 2038.0/FLAPCOUNT, 2050.0/FLAPCOUNT, 2049.0/FLAPCOUNT, 2049.0/FLAPCOUNT, 2049.0/FLAPCOUNT, 2038.0/FLAPCOUNT, 2051.0/FLAPCOUNT, 2051.2/FLAPCOUNT, 2049.0/FLAPCOUNT, 2038.0/FLAPCOUNT, 2048.0/FLAPCOUNT, 2048.0/FLAPCOUNT}; // stepper motor steps per rotation per flap, for each unit motor
 
-// The following are hardware related and won't change unless PCB is changed. Note: Units are numbered from left to right 0 - 11.
-const uint8_t unitStepPin[] =  {14,13,5,4,18,17,16,15,26,25,23,19};
-const uint8_t UnitEnablePin[] = {3,2,1,0,7,6,5,4,11,10,9,8};
-const char sensorPort[] = {'A','A','A','A','B','B','A','A','B','B','B','B'}; //Maps unit sensors 0 - 11 to the MCP23017 ports A or B
-const uint8_t sensorPortBit[] = {0b00001000,0b00000100,0b00000010,0b00000001,0b00000010,0b00000001,0b00100000,0b00010000,0b00100000,0b00010000,0b00001000,0b00000100}; //Maps unit sensors 0 - 11 to the bit of the MCP23017 port
-const uint8_t interruptPin = 27;
+static_assert(sizeof(calOffsetUnit) / sizeof(calOffsetUnit[0]) >= UNITCOUNT, "calOffsetUnit needs a value for every unit");
+static_assert(sizeof(FlapStep) / sizeof(FlapStep[0]) >= UNITCOUNT, "FlapStep needs a value for every unit");
+
+// Pins for each unit are in boards.h
 const uint8_t button1Pin = 14;
 const uint8_t button2Pin = 6;
-const char letters[] = {' ', 'A', 'B', 'C', 'D', 'E', 'F', 'G', 'H', 'I', 'J', 'K', 'L', 'M', 'N', 'O', 'P', 'Q', 'R', 'S', 'T', 'U', 'V', 'W', 'X', 'Y', 'Z', '$', '&', '#', '0', '1', '2', '3', '4', '5', '6', '7', '8', '9', ':', '.', '-', '?', '!'};
 const uint16_t rotationSpeeduS = 2000;
+const uint16_t rotationAcceleration = 4000; // steps/s/s
+#define NOMINAL_STEPS_PER_REV 2048 // of the geared stepper, before each unit's FlapStep[] is learned
+
+// Self-tuning: steps between consecutive sensor edges measure one revolution of the drum,
+// which refines FlapStep[] for the unit. Learned values are kept in NVS.
+#define TUNING_MAGIC (0x5500 + FLAPCOUNT) // flap steps only apply to the same drum type
+#define TUNING_SMOOTHING 16 // learned step size moves 1/16 of the way to each new measurement
+#define TUNING_TOLERANCE_STEPS 45 // ignore revolutions further than this from the estimate (missed steps)
+#define TUNING_SAVE_STEPS 0.5 // only write NVS once the revolution estimate has moved this far
+#define TUNING_AUTO_REVOLUTIONS 4 // revolutions measured by autoTuneStart()
+
+// Speed tuning: each level is 1/8 faster than the one before, with acceleration rising by the
+// square so the ramps cover the same distance. Revolutions are driven one move at a time, so
+// each one starts and stops, and a revolution that counts too many steps has missed some.
+#define SPEED_TUNE_MAX_LEVEL 8 // twice rotationSpeeduS
+#define SPEED_TUNE_REVOLUTIONS 2 // clean revolutions needed to pass a level
+#define SPEED_TUNE_TOLERANCE_STEPS 4 // sensor timing jitter; more than this is missed steps
+#define SPEED_TUNE_MARGIN_LEVELS 1 // settle this many levels below the fastest clean one
+
+typedef struct {
+  uint16_t magic;
+  uint8_t calOffset;
+  float flapStep;
+  uint16_t speedUs;
+  uint16_t acceleration;
+} UnitTuning;
+
+// Drum state kept in RTC memory while a unit is settled, so a restart can skip homing.
+// The position is checked against the sensor at the next origin crossing.
+#define UNIT_STATE_MAGIC 0x5AFF
+#define RESTORE_TOLERANCE_STEPS (NOMINAL_STEPS_PER_REV / FLAPCOUNT / 2) // half a flap: any further out and the wrong letters were showing
+
+typedef struct {
+  uint16_t magic;
+  uint8_t letterPosition;
+  uint8_t destinationLetter;
+  int32_t stepsFromOrigin;
+  uint16_t checksum;
+} UnitState;
+
+#define HALL_EDGE_QUEUE_SIZE 8 // edges buffered between the sensor and motion tasks
+#define HALL_GLITCH_US 100000 // edges closer together than this are a sensor glitch (before homing)
+
+// Once homed, magnet edges are judged by where the drum should be instead: one close enough to
+// an expected origin crossing corrects the position, anything else is noise and is dropped
+#define ORIGIN_TOLERANCE_STEPS (NOMINAL_STEPS_PER_REV / FLAPCOUNT / 2) // half a flap
+#define ORIGIN_IMPLAUSIBLE_LIMIT 2 // noise edges in a row before position is given up on
+
+// Fault isolation: a unit that fails to home, or is still moving when the display's moving
+// watchdog runs out, is parked (stopped where it is, motor off) and homes again after a
+// backoff that doubles each time. After UNIT_RETRY_LIMIT failures without recovering it is
+// disabled, parked until the controller restarts. Either way the other units carry on.
+// A unit that homes on a retry is degraded until it has settled UNIT_RECOVERED_MOVES moves.
+enum UnitHealth : uint8_t { UNIT_HEALTHY, UNIT_RETRYING, UNIT_DEGRADED, UNIT_DISABLED, UNIT_HEALTH_STATES };
+#define UNIT_RETRY_LIMIT 3 // failures before a unit is disabled
+#define UNIT_RETRY_BACKOFF_MS 2000 // before the first retry
+#define UNIT_RECOVERED_MOVES 20
+
+const char* unitHealthName(UnitHealth health);
 
-////////////////////////////////////////
-// For JTAG debugging, cannot use pins 13,14,15, so free these up when debugging
-// const uint8_t UNITCOUNT = 9;
-// const uint8_t unitStepPin[] =  {5,4,18,17,16,26,25,23,19};
-// const uint8_t UnitEnablePin[] = {1,0,7,6,5,11,10,9,8};
-// const char sensorPort[] = {'A','A','B','B','A','B','B','B','B'}; //Maps unit sensors 0 - 11 to the MCP23017 ports A or B
-// const uint8_t sensorPortBit[] = {0b00000010,0b00000001,0b00000010,0b00000001,0b00100000,0b00100000,0b00010000,0b00001000,0b00000100}; //Maps unit sensors 0 - 11 to the bit of the above MCP23017 port
-// const uint8_t calOffsetUnit[] = {77, 65, 89, 104, 107, 95, 97, 90, 85};
-////////////////////////////////////////
+// A hall sensor transition, captured by the sensor task close to when it happened
+typedef struct {
+  uint32_t timeUs; // micros() when the expander raised its interrupt
+  int32_t position; // stepper position at the edge
+  uint8_t value;
+} HallEdge;
 
 class Unit {
   public:
@@ -37,28 +94,106 @@ class Unit {
     uint8_t destinationLetter;
 
     // Constructor for each Unit object
-    Unit(FastAccelStepperEngine& engine, uint8_t unitNum);
+    Unit(uint8_t unitNum);
 
-    void moveStepperbyStep(int16_t steps);
+    void moveStepperbyStep(int32_t steps);
     void moveSteppertoLetter(char toLetter);
+    uint32_t moveDurationToLetter(char toLetter);
+    uint32_t longestMoveDuration();
+    void scheduleMoveToLetter(char toLetter, uint32_t startMillis);
+    void startScheduledMove();
+    boolean moveScheduled();
+    boolean moveDue();
+    uint32_t scheduledDuration();
     void moveStepperbyFlap(uint16_t flaps);
     void calibrateStart();
+    void recalibrate();
     int8_t calibrate();
     boolean checkIfRunning();
-    boolean updateHallValue(uint8_t updatedHallValue);
+    boolean isSettled();
+    boolean isMotorEnabled();
+    void checkOriginCrossing();
+    void autoTuneStart();
+    void speedTuneStart();
+    boolean speedTuneUpdate();
+    boolean isSpeedTuning();
+    UnitHealth health();
+    boolean inService();
+    void healthUpdate();
+    void stopStuck();
+    void setCalOffset(uint8_t offset);
+    void saveTuning();
+    boolean restoreState(UnitState* state);
+    void persistState();
+    void recordSettle();
+    void initHallValue(uint8_t hallValue, uint32_t sinceEdgeUs = HALL_GLITCH_US + 1);
+    void recordHallEdge(uint8_t hallValue, uint32_t timeUs);
+    boolean processHallEdges();
 
   private:
-    FastAccelStepper* stepper;
-    float missedSteps;
+    HalStepper* stepper;
+    uint32_t speedUs;
+    uint32_t acceleration;
+    char scheduledLetter;
+    uint32_t scheduledStartMillis;
+    uint32_t scheduledDurationMs;
+    boolean moveTimed; // a move has started that hasn't settled yet
+    uint32_t moveStartMillis;
+    int32_t moveStartPosition;
     uint8_t unitNum;
     bool preInitialise;
     uint8_t currentLetterPosition;
     uint32_t calibrationStartTime;
     uint8_t currentHallValue;
-    uint32_t lastHallUpdateTime;
+    uint32_t lastHallEdgeUs;
+    boolean originCrossingPending;
+    int32_t crossingStepsPastOrigin; // where the move ends, from the magnet edge it is waiting for
+    float flapStep;
+    int32_t flapSteps[FLAPCOUNT + 1]; // from the blank flap to each flap, the last a whole revolution
+    uint8_t calOffset;
+    float savedFlapStep;
+    uint8_t savedCalOffset;
+    int32_t lastOriginPosition;
+    boolean lastOriginValid;
+    uint8_t tuningSamples;
+    uint8_t autoTuneRevolutions;
+    uint16_t savedSpeedUs;
+    uint16_t savedAcceleration;
+    boolean speedTuning;
+    uint8_t speedTuneLevel;
+    uint8_t speedTuneRevolutions;
+    uint8_t implausibleEdges;
+    UnitState* savedState;
+    boolean stateSaved;
+    boolean positionRestored;
+    SpscQueue<HallEdge, HALL_EDGE_QUEUE_SIZE> hallEdges; // producer: sensor task, consumer: motion task
+    uint8_t sensedHallValue; // last value seen by the sensor task
+    volatile boolean hallEdgeOverflow;
+    volatile UnitHealth healthState; // read by the network task
+    uint8_t failures; // since the unit was last healthy
+    boolean retryPending; // parked until retryMillis
+    uint32_t retryMillis;
+    uint8_t recoveredMoves;
 
-    int16_t stepsToRotate (float steps);
-    uint16_t stepsToRotateFlaps(uint16_t flaps);
-    uint8_t flapsToRotateToLetter(char letterchar, boolean *recalibrate);
+    int32_t stepsToRotateFlaps(uint16_t flaps);
+    int32_t letterTarget(uint8_t flap, int32_t earliest);
+    int32_t nextOriginPosition(int32_t position);
+    void buildFlapSteps();
+    uint32_t moveDurationMs(uint32_t steps);
     uint8_t translateLettertoInt(char letterchar);
+    void loadTuning();
+    void learnRevolution(int32_t originPosition);
+    void setSpeedProfile(uint32_t newSpeedUs, uint32_t newAcceleration);
+    void setSpeedTuneLevel(uint8_t level);
+    void checkSpeedTuneRevolution(int32_t originPosition);
+    void speedTuneFinish(uint8_t level);
+    static uint16_t stateChecksum(const UnitState* state);
+    boolean verifyRestoredPosition(int32_t edgePosition);
+    void correctAtOrigin(int32_t originPosition);
+    void completeCalibration(int32_t originPosition);
+    boolean updateHallValue(const HallEdge& edge);
+    boolean checkHomedEdge(const HallEdge& edge);
+    void setHealth(UnitHealth health);
+    void failed();
+    void park();
   };
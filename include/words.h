@@ -0,0 +1,24 @@
+#pragma once
+
+// Background word provider
+//
+// A low priority task keeps a small ring of random words fetched from Wordnik ahead of
+// time (already padded to the sign width), so a scheduled update or the Random Word
+// button never waits on the network. Without a Wordnik key, or if the ring runs dry
+// during a network outage, words come from the dictionary in flash instead.
+
+#include <Arduino.h>
+#include "system.h"
+
+#define WORD_PREFETCH_COUNT 4 // words fetched ahead of time
+#define WORD_RETRY_MIN_MS 5000 // first retry after a failed fetch, doubling up to WORD_RETRY_MAX_MS
+#define WORD_RETRY_MAX_MS 600000
+#define WORD_TASK_CORE 0
+#define WORD_TASK_PRIORITY 0
+
+typedef struct {
+  char text[SIGN_MAX_COLUMNS + 1];
+} PaddedWord;
+
+void wordProviderStart();
+boolean nextWord(char* word); // word holds SIGN_MAX_COLUMNS + 1
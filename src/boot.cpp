@@ -0,0 +1,28 @@
+#include "boot.h"
+#include "debug.h"
+
+static const char* bootPhaseNames[BOOT_PHASES] = {"hardware", "homed", "wifi", "server", "ntp", "first display"};
+static uint32_t bootPhaseTimes[BOOT_PHASES];
+static boolean bootPhaseReached[BOOT_PHASES];
+
+// Phases are marked by different tasks, but each only ever by one
+void bootMark(BootPhase phase) {
+  if (bootPhaseReached[phase]) {
+    return;
+  }
+  bootPhaseTimes[phase] = millis();
+  bootPhaseReached[phase] = true;
+  debugf(TXT_BLUE "Boot: %s at %lu ms\n" TXT_RST, bootPhaseNames[phase], (unsigned long)bootPhaseTimes[phase]);
+}
+
+boolean bootReached(BootPhase phase) {
+  return bootPhaseReached[phase];
+}
+
+uint32_t bootPhaseMillis(BootPhase phase) {
+  return bootPhaseTimes[phase];
+}
+
+const char* bootPhaseName(BootPhase phase) {
+  return bootPhaseNames[phase];
+}
@@ -0,0 +1,31 @@
+#include "dictionary.h"
+#include "dictionary_data.h"
+#include "drum.h"
+#include "system.h"
+
+static_assert(DICTIONARY_DRUM_FLAPS == DRUM_FLAPS && DICTIONARY_MIN_LENGTH == MINWORDLEN && DICTIONARY_MAX_LENGTH == UNITCOUNT,
+              "dictionary_data.h was packed for another build: run tools/pack_words.py");
+
+uint16_t dictionaryWordCount() {
+  return DICTIONARY_WORD_COUNT;
+}
+
+// Copy word[index] out of flash (the ESP32 maps PROGMEM data, so it can be read directly)
+boolean dictionaryWord(uint16_t index, char* word, uint8_t size) {
+  if (index >= DICTIONARY_WORD_COUNT) {
+    return false;
+  }
+
+  uint32_t start = dictionaryOffsets[index];
+  uint32_t length = dictionaryOffsets[index + 1] - start;
+  if (length >= size) {
+    length = size - 1;
+  }
+  memcpy(word, &dictionaryWords[start], length);
+  word[length] = '\0';
+  return true;
+}
+
+boolean dictionaryRandomWord(char* word, uint8_t size) {
+  return dictionaryWord(random(DICTIONARY_WORD_COUNT), word, size);
+}
@@ -0,0 +1,70 @@
+// Generated by tools/pack_words.py from tools/words.txt - do not edit
+#pragma once
+
+#define DICTIONARY_DRUM_FLAPS 45
+#define DICTIONARY_MIN_LENGTH 9
+#define DICTIONARY_MAX_LENGTH 12
+#define DICTIONARY_WORD_COUNT 272
+
+static const uint16_t dictionaryOffsets[] PROGMEM = {
+  0, 9, 18, 27, 36, 45, 54, 63, 72, 81, 91, 100,
+  110, 119, 128, 137, 146, 155, 166, 175, 184, 194, 204, 214,
+  223, 233, 242, 251, 260, 269, 278, 288, 297, 308, 317, 326,
+  336, 345, 355, 364, 373, 383, 392, 402, 411, 421, 430, 439,
+  448, 458, 468, 479, 489, 498, 510, 519, 528, 537, 546, 555,
+  565, 574, 583, 592, 601, 610, 621, 631, 642, 654, 663, 674,
+  685, 696, 705, 714, 724, 733, 742, 752, 761, 772, 782, 792,
+  803, 813, 822, 831, 840, 849, 859, 868, 879, 889, 901, 912,
+  921, 931, 941, 951, 961, 970, 979, 990, 1001, 1010, 1020, 1030,
+  1040, 1049, 1059, 1068, 1077, 1087, 1096, 1106, 1115, 1126, 1135, 1144,
+  1154, 1165, 1175, 1186, 1196, 1205, 1214, 1223, 1232, 1241, 1250, 1261,
+  1270, 1279, 1289, 1299, 1308, 1318, 1328, 1337, 1346, 1356, 1365, 1376,
+  1385, 1394, 1403, 1412, 1422, 1432, 1443, 1453, 1465, 1475, 1486, 1496,
+  1508, 1517, 1527, 1536, 1546, 1556, 1568, 1577, 1586, 1595, 1604, 1613,
+  1623, 1632, 1642, 1651, 1661, 1672, 1681, 1692, 1702, 1712, 1721, 1731,
+  1740, 1750, 1761, 1770, 1780, 1791, 1800, 1809, 1818, 1827, 1838, 1847,
+  1857, 1868, 1877, 1887, 1898, 1907, 1917, 1927, 1936, 1946, 1955, 1964,
+  1975, 1985, 1996, 2005, 2014, 2024, 2033, 2042, 2053, 2064, 2073, 2084,
+  2093, 2103, 2114, 2124, 2134, 2143, 2153, 2163, 2172, 2181, 2190, 2200,
+  2209, 2218, 2227, 2237, 2247, 2257, 2266, 2275, 2284, 2295, 2305, 2314,
+  2323, 2332, 2342, 2351, 2360, 2369, 2379, 2388, 2397, 2407, 2418, 2428,
+  2438, 2448, 2457, 2467, 2477, 2486, 2496, 2507, 2517, 2526, 2536, 2545,
+  2555, 2565, 2576, 2585, 2595, 2605, 2615, 2624, 2633,
+};
+
+static const char dictionaryWords[] PROGMEM =
+  "ABANDONEDABUNDANCEACCORDIONACROBATICADVENTUREAERODROMEAFTERNOONALABASTER"
+  "ALGORITHMALLEGIANCEALLIGATORAMBASSADORAMPLIFIERANCHORAGEAPARTMENTAPPARATUS"
+  "ARBITRARYARCHIPELAGOARCHITECTARMADILLOASTRONOMERATMOSPHEREATTENDANCEAVALANCHE"
+  "BACKGAMMONBADMINTONBALCONIESBALLERINABANDWAGONBARRICADEBASKETBALLBATTALION"
+  "BEACHCOMBERBEANSTALKBENCHMARKBINOCULARSBIOGRAPHYBLACKBERRYBLUEPRINTBOOMERANG"
+  "BOOKKEEPERBOULEVARDBRAINSTORMBREAKFASTBRILLIANCEBROADCASTBUCCANEERBUTTERFLY"
+  "CALCULATORCAMOUFLAGECANDLESTICKCANTILEVERCARPENTERCARTOGRAPHERCATHEDRALCELEBRATE"
+  "CENTIPEDECHAMELEONCHAMPAGNECHANDELIERCHARACTERCHEMISTRYCHOCOLATECHRONICLE"
+  "CLOCKWORKCOBBLESTONECOLLECTIONCOMFORTABLECOMMONWEALTHCONDUCTORCONTINENTALCORNERSTONE"
+  "COUNTERPARTCRAFTSMANCROCODILECROSSROADSCURIOSITYDANDELIONDAYDREAMERDECATHLON"
+  "DECLARATIONDELEGATIONDELIGHTFULDESTINATIONDICTIONARYDIMENSIONDISCOVERYDRAGONFLY"
+  "DRIFTWOODEARTHQUAKEECCENTRICELECTRICITYEMBROIDERYENCYCLOPEDIAEQUILIBRIUMESCALATOR"
+  "ESCARPMENTEXPEDITIONEXPERIMENTFAIRGROUNDFANTASTICFARMHOUSEFINGERPRINTFIRECRACKER"
+  "FIREWORKSFLASHLIGHTFOOTBRIDGEFORMIDABLEFORTUNATEFOUNDATIONFRAGRANCEFRAMEWORK"
+  "FRIENDSHIPGALVANIZEGENERATIONGEOGRAPHYGINGERBREADGLASSWAREGONDOLIERGRAMOPHONE"
+  "GRANDFATHERGRAPEFRUITGRASSHOPPERGREENHOUSEGUITARISTGYMNASIUMHAIRBRUSHHALLOWEEN"
+  "HANDSHAKEHARMONICAHARPSICHORDHEADLIGHTHEARTBEATHELICOPTERHEMISPHEREHIBERNATE"
+  "HIEROGLYPHHIGHLANDERHISTORIANHONEYCOMBHORIZONTALHORSESHOEHOSPITALITYHOURGLASS"
+  "HOUSEHOLDHURRICANEHYDRANGEAHYPOTHESISILLUMINATEIMAGINATIONINCREDIBLEINDEPENDENCE"
+  "INGREDIENTINSPIRATIONINSTRUMENTINTERMISSIONINVENTIONJACKHAMMERJELLYFISHJUBILATION"
+  "JUGGERNAUTKALEIDOSCOPEKILOMETREKNOWLEDGELABYRINTHLAMPSHADELANDSCAPELIGHTHOUSE"
+  "LIMESTONELOCOMOTIVELONGITUDELUMBERJACKMAGNIFICENTMARMALADEMASTERPIECEMEADOWLARK"
+  "MELANCHOLYMETRONOMEMICROSCOPEMIDSUMMERMILLENNIUMMISCHIEVOUSMOONLIGHTMOTORCYCLE"
+  "MOUNTAINEERMYTHOLOGYNAVIGATORNECTARINENEIGHBOURNIGHTINGALENOCTURNALNUTCRACKER"
+  "OBSERVATORYORCHESTRAPAINTBRUSHPAPERWEIGHTPARACHUTEPARAGLIDERPARLIAMENTPASSENGER"
+  "PEPPERMINTPERISCOPEPINEAPPLEPLANETARIUMPLAYGROUNDPOMEGRANATEPORCUPINEPORTFOLIO"
+  "POSTMASTERPOTENTATEPROFESSORQUARTERBACKQUICKSILVERRASPBERRYRATTLESNAKERECTANGLE"
+  "REFLECTIONRENAISSANCERESTAURANTRHINOCEROSRIVERBANKSALAMANDERSANDCASTLESAXOPHONE"
+  "SCARECROWSCIENTISTSCOREBOARDSEMAPHORESENSATIONSHIPWRECKSILHOUETTESKATEBOARD"
+  "SKYSCRAPERSNOWFLAKESPACESHIPSPECTACLESPREADSHEETSTALACTITESTARLIGHTSTEAMBOAT"
+  "STONEWORKSTRAWBERRYSUBMARINESUNFLOWERSYCOPHANTTAMBOURINETANGERINETELESCOPE"
+  "TELEVISIONTHUNDERBOLTTIMEKEEPERTOOTHBRUSHTOURNAMENTTRADITIONTRAMPOLINETUMBLEWEED"
+  "TURQUOISETYPEWRITERUNDERGROUNDUNIVERSITYVEGETABLEWANDERLUSTWATERFALLWATERMELON"
+  "WAVELENGTHWHEELBARROWWHIRLWINDWILDERNESSWONDERLANDWOODPECKERXYLOPHONEYACHTSMAN"
+  ;
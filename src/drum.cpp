@@ -0,0 +1,29 @@
+#include <math.h>
+#include "drum.h"
+
+// Whole steps from the blank flap to each flap, exact to 1/256 step of the revolution estimate.
+// The last is a whole revolution.
+void drumFlapSteps(float flapStep, int32_t flapSteps[FLAPCOUNT + 1]) {
+  uint32_t revolution = (uint32_t)lroundf(flapStep * FLAPCOUNT * FLAP_STEP_SCALE);
+
+  for (uint8_t flap = 0; flap <= FLAPCOUNT; flap++) {
+    flapSteps[flap] = (flap * revolution + FLAPCOUNT * FLAP_STEP_SCALE / 2) / (FLAPCOUNT * FLAP_STEP_SCALE);
+  }
+}
+
+// Where the drum next shows this flap, at or after earliest, counted from the last origin
+// crossing. The magnet is calOffset steps before the blank flap, so the last flaps on the drum
+// are shown a revolution on from the last origin crossing, past the next one.
+int32_t drumFlapTarget(const int32_t flapSteps[FLAPCOUNT + 1], int32_t originPosition, uint8_t calOffset, uint8_t flap,
+                       int32_t earliest) {
+  int32_t revolution = flapSteps[FLAPCOUNT];
+  int32_t target = originPosition + calOffset + flapSteps[flap];
+
+  while (target < earliest) {
+    target += revolution;
+  }
+  while (target - revolution >= earliest) {
+    target -= revolution;
+  }
+  return target;
+}
@@ -0,0 +1,138 @@
+#include "frames.h"
+#include "scheduler.h"
+
+// Frames are numbered from 0 as they are queued; frame n lives in frames[n % FRAME_QUEUE_SIZE]
+static Frame frames[FRAME_QUEUE_SIZE];
+static uint32_t frameTail = 0; // number of the next frame to be queued
+static uint32_t frameBase = 0; // frames before this were cleared, so don't hold anything up
+static uint32_t unitNextFrame[UNITCOUNT]; // next frame each unit will start
+static uint32_t unitLandedMillis[UNITCOUNT];
+static boolean unitLanded[UNITCOUNT];
+
+// Each unit still needs the frame it is showing (for its hold time and barrier)
+static uint32_t oldestFrameInUse() {
+  uint32_t oldest = frameTail;
+
+  for (uint8_t unit = 0; unit < UNITCOUNT; unit++) {
+    uint32_t showing = (unitNextFrame[unit] > frameBase) ? unitNextFrame[unit] - 1 : frameBase;
+    if (showing < oldest) {
+      oldest = showing;
+    }
+  }
+  return oldest;
+}
+
+boolean frameQueuePush(const char* text, uint16_t holdMs, boolean barrier) {
+  if (frameTail - oldestFrameInUse() >= FRAME_QUEUE_SIZE) {
+    return false;
+  }
+
+  Frame &frame = frames[frameTail % FRAME_QUEUE_SIZE];
+  strncpy(frame.text, text, UNITCOUNT);
+  frame.text[UNITCOUNT] = '\0';
+  frame.holdMs = holdMs;
+  frame.barrier = barrier;
+  frameTail++;
+  return true;
+}
+
+// Drop any frames not yet started (a new display replaces the sequence)
+void frameQueueClear() {
+  frameBase = frameTail;
+  for (uint8_t unit = 0; unit < UNITCOUNT; unit++) {
+    unitNextFrame[unit] = frameTail;
+  }
+}
+
+// Every unit has started the last frame
+boolean frameQueueEmpty() {
+  for (uint8_t unit = 0; unit < UNITCOUNT; unit++) {
+    if (unitNextFrame[unit] < frameTail) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Every unit is past the barrier frame, or has landed it and held it long enough
+static boolean barrierReached(uint32_t barrierFrame, uint16_t holdMs, uint32_t now) {
+  for (uint8_t unit = 0; unit < UNITCOUNT; unit++) {
+    if (unitNextFrame[unit] > barrierFrame + 1) {
+      continue;
+    }
+    if (unitNextFrame[unit] < barrierFrame + 1 || !unitLanded[unit] || now - unitLandedMillis[unit] < holdMs) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// The unit has landed the frame it is showing and held it, so can start its next one
+static boolean unitReady(uint8_t unit, uint32_t now) {
+  uint32_t next = unitNextFrame[unit];
+
+  if (next >= frameTail || !unitLanded[unit]) {
+    return false;
+  }
+  if (next > frameBase) {
+    const Frame &showing = frames[(next - 1) % FRAME_QUEUE_SIZE];
+    if (now - unitLandedMillis[unit] < showing.holdMs) {
+      return false;
+    }
+    if (showing.barrier && !barrierReached(next - 1, showing.holdMs, now)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Every unit is ready to start the barrier frame
+static boolean barrierReady(uint32_t barrierFrame, uint32_t now) {
+  for (uint8_t unit = 0; unit < UNITCOUNT; unit++) {
+    if (unitNextFrame[unit] != barrierFrame || !unitReady(unit, now)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Start the next frame on any unit that is ready for it (the scheduler starts the moves).
+// Returns true if any unit started one.
+boolean frameQueueUpdate(Unit* units[]) {
+  uint32_t now = millis();
+  boolean started = false;
+
+  for (uint8_t unit = 0; unit < UNITCOUNT; unit++) {
+    if (!unitLanded[unit] && units[unit]->isSettled()) {
+      unitLanded[unit] = true;
+      unitLandedMillis[unit] = now;
+    }
+  }
+
+  for (uint8_t unit = 0; unit < UNITCOUNT; unit++) {
+    uint32_t next = unitNextFrame[unit];
+    // a barrier frame waits for every unit, below
+    if (!unitReady(unit, now) || frames[next % FRAME_QUEUE_SIZE].barrier) {
+      continue;
+    }
+
+    units[unit]->scheduleMoveToLetter(frames[next % FRAME_QUEUE_SIZE].text[unit], now);
+    unitNextFrame[unit]++;
+    unitLanded[unit] = false;
+    started = true;
+  }
+
+  // All units start a barrier frame together, staggered to land at the same moment
+  uint32_t next = unitNextFrame[0];
+  if (next < frameTail && frames[next % FRAME_QUEUE_SIZE].barrier && barrierReady(next, now)) {
+    const Frame &barrier = frames[next % FRAME_QUEUE_SIZE];
+    schedulerPlanDisplayAt(units, barrier.text, strlen(barrier.text), now);
+    for (uint8_t unit = 0; unit < UNITCOUNT; unit++) {
+      unitNextFrame[unit]++;
+      unitLanded[unit] = false;
+    }
+    started = true;
+  }
+
+  return started;
+}
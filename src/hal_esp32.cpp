@@ -0,0 +1,423 @@
+// ESP32 implementation of the hardware abstraction layer (see hal.h)
+
+#include <Arduino.h>
+#include <Wire.h>
+#include <WiFi.h>
+#include <WiFiUdp.h>
+#include <sys/time.h>
+#include <atomic>
+#include <lwip/sockets.h>
+#include <MCP23017.h>
+#include <Preferences.h>
+#include "FastAccelStepper.h"
+#include "hal.h"
+#include "unit.h"
+
+#define STORAGE_NAMESPACE "splitflap"
+#define MCP_IOCON_SEQUENTIAL 0x00 // BANK=0, SEQOP=0: the register pointer runs on through each register
+
+static MCP23017* mcp_en_steppers[BOARDCOUNT];
+static MCP23017* mcp_sensor[BOARDCOUNT];
+FastAccelStepperEngine engine;
+
+// I2C is shared by the motion task and FastAccelStepper's own task
+static SemaphoreHandle_t i2cMutex;
+static HalI2cStats i2cStats;
+static uint16_t enableShadow[BOARDCOUNT]; // OLAT of each enable expander (port A in the low byte)
+static uint16_t enableWritten[BOARDCOUNT];
+static TaskHandle_t enableBatchOwner = nullptr;
+static void (*sensorISR)(uint8_t board) = nullptr;
+static WiFiUDP groupUdp;
+static IPAddress groupAddress;
+static uint16_t groupPort;
+static int commandSocket = -1;
+static struct sockaddr_in commandSender;
+
+#define HAL_MAX_TASKS 5 // sensor, motion, network, words, log
+#define HAL_TASK_STACK 8192 // bytes, enough for TLS in the network task
+static TaskHandle_t halTasks[HAL_MAX_TASKS];
+static uint8_t halTaskCount = 0;
+
+// Written by each task, read by whichever reports them
+typedef struct {
+  HalTaskStep step;
+  const char* name;
+  std::atomic<uint32_t> runs;
+  std::atomic<uint32_t> busyMs;
+  std::atomic<uint32_t> longestUs;
+  uint32_t busyRemainderUs; // not yet a whole ms
+} HalTaskTiming;
+static HalTaskTiming halTaskTimings[HAL_MAX_TASKS];
+
+class Esp32Stepper : public HalStepper {
+  public:
+    Esp32Stepper(FastAccelStepper* fas) : stepper(fas) {}
+    void move(int32_t steps) override { stepper->move(steps); }
+    void moveTo(int32_t position) override { stepper->moveTo(position); }
+    void runForward() override { stepper->runForward(); }
+    void forceStop() override { stepper->forceStop(); }
+    void forceStopAndNewPosition(int32_t position) override { stepper->forceStopAndNewPosition(position); }
+    bool isRunning() override { return stepper->isRunning(); }
+    void setSpeedInUs(uint32_t speed_us) override { stepper->setSpeedInUs(speed_us); }
+    void setAcceleration(int32_t acceleration) override { stepper->setAcceleration(acceleration); }
+    int32_t getCurrentPosition() override { return stepper->getCurrentPosition(); }
+    int32_t getStoppingPosition() override {
+      // v^2 / 2a, with the speed in milliHz (negative running backwards), rounded up
+      int64_t milliHz = stepper->getCurrentSpeedInMilliHz();
+      int64_t divisor = 2000000LL * stepper->getAcceleration();
+      int32_t steps = (int32_t)((milliHz * milliHz + divisor - 1) / divisor);
+      int32_t position = stepper->getCurrentPosition();
+      int32_t toTarget = stepper->targetPos() - position;
+      if (milliHz < 0) {
+        return position - ((toTarget <= 0) ? min(steps, -toTarget) : steps);
+      }
+      return position + ((toTarget >= 0) ? min(steps, toTarget) : steps);
+    }
+
+  private:
+    FastAccelStepper* stepper;
+};
+
+static bool enablePinWritten(uint8_t pin) {
+  return (enableWritten[pin / 16] & (1 << (pin % 16))) != 0;
+}
+
+// Callback routine that actions the enable on or off triggered by setAutoEnable. Returns the
+// level the pin actually has: in an enable batch the write waits for halEnableBatchEnd(), and
+// FastAccelStepper calls again until the pin is as asked, only then starting setDelayToEnable().
+bool setExternalPin(uint8_t pin, uint8_t value) {
+  pin = pin & ~PIN_EXTERNAL_FLAG;
+  halSetEnablePin(pin, value == LOW); // enables are active low
+  return enablePinWritten(pin) ? LOW : HIGH;
+}
+
+void halSteppersInit() {
+  engine = FastAccelStepperEngine();
+  engine.init();
+  engine.setExternalCallForPin(setExternalPin);
+}
+
+HalStepper* halStepperConnect(uint8_t stepPin, uint8_t enablePin) {
+  FastAccelStepper* stepper = engine.stepperConnectToPin(stepPin);
+
+  stepper->setEnablePin(enablePin | PIN_EXTERNAL_FLAG);
+  stepper->setAutoEnable(true);
+  stepper->setDelayToEnable(1000); // microseconds
+  stepper->setDelayToDisable(2); // milliseconds
+
+  return new Esp32Stepper(stepper);
+}
+
+static TwoWire& boardBus(uint8_t board) {
+  return (boardRegistry[board].bus == BOARD_BUS_CHAIN) ? Wire1 : Wire;
+}
+
+void halExpandersInit() {
+  // Configure I2C for MCP23017 port expanders
+  Wire.begin(21, 22, 800000); // SDA=21, SCL=22, 800kHz
+  for (uint8_t board = 0; board < BOARDCOUNT; board++) {
+    if (boardRegistry[board].bus == BOARD_BUS_CHAIN) {
+      Wire1.begin(32, 33, 800000); // chained boards: SDA=32, SCL=33
+      break;
+    }
+  }
+
+  for (uint8_t board = 0; board < BOARDCOUNT; board++) {
+    mcp_en_steppers[board] = new MCP23017(boardRegistry[board].enableAddress, boardBus(board));
+    mcp_en_steppers[board]->init();
+    mcp_en_steppers[board]->portMode(MCP23017Port::A, 0);          //Port A as output
+    mcp_en_steppers[board]->portMode(MCP23017Port::B, 0);          //Port B as output
+    mcp_en_steppers[board]->writeRegister(MCP23017Register::GPIO_A, 0x00);  //Reset port A
+    mcp_en_steppers[board]->writeRegister(MCP23017Register::GPIO_B, 0x00);  //Reset port B
+
+    mcp_sensor[board] = new MCP23017(boardRegistry[board].sensorAddress, boardBus(board));
+    mcp_sensor[board]->init();
+    mcp_sensor[board]->writeRegister(MCP23017Register::IOCON, MCP_IOCON_SEQUENTIAL); // init() turns sequential reads off
+    mcp_sensor[board]->portMode(MCP23017Port::A, 0b01111111); //Port A 7 bits as input
+    mcp_sensor[board]->portMode(MCP23017Port::B, 0b01111111); //Port B 7 bits as input
+    mcp_sensor[board]->writeRegister(MCP23017Register::IPOL_A, 0x00);
+    mcp_sensor[board]->writeRegister(MCP23017Register::IPOL_B, 0x00);
+    mcp_sensor[board]->writeRegister(MCP23017Register::GPIO_A, 0xFF);
+    mcp_sensor[board]->writeRegister(MCP23017Register::GPIO_B, 0xFF);
+
+    enableShadow[board] = 0;
+    enableWritten[board] = 0;
+  }
+
+  i2cMutex = xSemaphoreCreateMutex();
+}
+
+// Write both enable ports in one sequential transaction (must hold i2cMutex)
+static void writeEnableShadow(uint8_t board) {
+  TwoWire& bus = boardBus(board);
+
+  bus.beginTransmission(boardRegistry[board].enableAddress);
+  bus.write((uint8_t)MCP23017Register::OLAT_A);
+  bus.write(enableShadow[board] & 0xFF);
+  bus.write(enableShadow[board] >> 8);
+  bus.endTransmission();
+  i2cStats.transactions++;
+  i2cStats.bytes += 3;
+  enableWritten[board] = enableShadow[board];
+}
+
+void halSetEnablePin(uint8_t pin, bool enabled) {
+  uint8_t board = pin / 16;
+
+  xSemaphoreTake(i2cMutex, portMAX_DELAY);
+
+  // Using SLEEP instead of /ENABLE on the A4988 to save idle power, so high is enabled
+  // debugf("mcp en pin %d set to %d\n", pin, enabled);
+  if (enabled) {
+    enableShadow[board] |= (1 << (pin % 16));
+  }
+  else {
+    enableShadow[board] &= ~(1 << (pin % 16));
+  }
+
+  if (enableShadow[board] != enableWritten[board] && enableBatchOwner != xTaskGetCurrentTaskHandle()) {
+    writeEnableShadow(board);
+  }
+
+  xSemaphoreGive(i2cMutex);
+}
+
+// Last requested state, whether or not it has been written yet
+bool halEnablePinSet(uint8_t pin) {
+  return (enableShadow[pin / 16] & (1 << (pin % 16))) != 0;
+}
+
+void halEnableBatchBegin() {
+  enableBatchOwner = xTaskGetCurrentTaskHandle();
+}
+
+void halEnableBatchEnd() {
+  xSemaphoreTake(i2cMutex, portMAX_DELAY);
+  enableBatchOwner = nullptr;
+  for (uint8_t board = 0; board < BOARDCOUNT; board++) {
+    if (enableShadow[board] != enableWritten[board]) {
+      writeEnableShadow(board);
+    }
+  }
+  xSemaphoreGive(i2cMutex);
+}
+
+// INTCAP_A, INTCAP_B, GPIO_A, GPIO_B are consecutive, so read them in one burst (the sensor
+// expanders are set to sequential addressing in halExpandersInit). Reading clears the interrupt.
+void halReadSensorPorts(uint8_t board, HalSensorPorts &ports) {
+  TwoWire& bus = boardBus(board);
+  uint8_t address = boardRegistry[board].sensorAddress;
+
+  xSemaphoreTake(i2cMutex, portMAX_DELAY);
+  bus.beginTransmission(address);
+  bus.write((uint8_t)MCP23017Register::INTCAP_A);
+  bus.endTransmission(false);
+  bus.requestFrom(address, (uint8_t)4);
+  ports.capturedA = bus.read();
+  ports.capturedB = bus.read();
+  ports.portA = bus.read();
+  ports.portB = bus.read();
+  i2cStats.transactions++;
+  i2cStats.bytes += 5;
+  xSemaphoreGive(i2cMutex);
+}
+
+void halGetI2cStats(HalI2cStats &stats) {
+  stats = i2cStats;
+}
+
+static void IRAM_ATTR boardSensorInterrupt(void* board) {
+  sensorISR((uint8_t)(uintptr_t)board);
+}
+
+void halAttachSensorInterrupt(void (*isr)(uint8_t board)) {
+  sensorISR = isr;
+
+  // Enable Sensor interrupts
+  for (uint8_t board = 0; board < BOARDCOUNT; board++) {
+    uint8_t pin = boardRegistry[board].interruptPin;
+
+    mcp_sensor[board]->interruptMode(MCP23017InterruptMode::Or); //Both ports logically ORed to same interrupt pin
+    mcp_sensor[board]->interrupt(MCP23017Port::A, CHANGE);
+    mcp_sensor[board]->interrupt(MCP23017Port::B, CHANGE);
+    mcp_sensor[board]->clearInterrupts();
+    pinMode(pin, INPUT_PULLUP);
+    attachInterruptArg(digitalPinToInterrupt(pin), boardSensorInterrupt, (void*)(uintptr_t)board, FALLING);
+  }
+}
+
+void halNetworkBegin(const char* ssid, const char* password) {
+  WiFi.begin(ssid, password);
+}
+
+bool halNetworkConnected() {
+  return WiFi.status() == WL_CONNECTED;
+}
+
+void halNetworkLocalIP(char* buffer, uint8_t size) {
+  strncpy(buffer, WiFi.localIP().toString().c_str(), size);
+  buffer[size - 1] = '\0';
+}
+
+bool halGroupBegin(const char* address, uint16_t port) {
+  if (!groupAddress.fromString(address)) {
+    return false;
+  }
+  groupPort = port;
+  return groupUdp.beginMulticast(groupAddress, port);
+}
+
+bool halGroupSend(const void* data, size_t size) {
+  if (!groupUdp.beginPacket(groupAddress, groupPort)) {
+    return false;
+  }
+  groupUdp.write((const uint8_t*)data, size);
+  return groupUdp.endPacket();
+}
+
+size_t halGroupReceive(void* data, size_t size) {
+  int available = groupUdp.parsePacket();
+
+  if (available <= 0) {
+    return 0;
+  }
+  // anything longer than the caller's buffer is malformed, so drop the rest of it
+  int length = groupUdp.read((uint8_t*)data, size);
+  groupUdp.flush();
+  return (length > 0 && available <= (int)size) ? length : 0;
+}
+
+// A plain lwIP socket: WiFiUDP allocates a buffer for every packet it receives
+bool halCommandBegin(uint16_t port) {
+  struct sockaddr_in local = {};
+
+  commandSocket = socket(AF_INET, SOCK_DGRAM, IPPROTO_IP);
+  if (commandSocket < 0) {
+    return false;
+  }
+  local.sin_family = AF_INET;
+  local.sin_port = htons(port);
+  local.sin_addr.s_addr = htonl(INADDR_ANY);
+  if (bind(commandSocket, (struct sockaddr*)&local, sizeof(local)) < 0) {
+    close(commandSocket);
+    commandSocket = -1;
+    return false;
+  }
+  return true;
+}
+
+size_t halCommandReceive(void* data, size_t size) {
+  socklen_t senderSize = sizeof(commandSender);
+
+  if (commandSocket < 0) {
+    return 0;
+  }
+  // lwIP truncates silently, so a datagram that fills the buffer may have been longer
+  int length = recvfrom(commandSocket, data, size, MSG_DONTWAIT, (struct sockaddr*)&commandSender, &senderSize);
+  return (length > 0 && (size_t)length < size) ? length : 0;
+}
+
+bool halCommandReply(const void* data, size_t size) {
+  return commandSocket >= 0 &&
+         sendto(commandSocket, data, size, 0, (struct sockaddr*)&commandSender, sizeof(commandSender)) == (int)size;
+}
+
+uint64_t halEpochMillis() {
+  struct timeval now;
+
+  gettimeofday(&now, nullptr);
+  if (now.tv_sec < NTP_MIN_VALID_EPOCH) {
+    return 0;
+  }
+  return (uint64_t)now.tv_sec * 1000 + now.tv_usec / 1000;
+}
+
+bool halStorageRead(const char* key, void* data, size_t size) {
+  Preferences prefs;
+  bool found = false;
+
+  if (prefs.begin(STORAGE_NAMESPACE, true)) {
+    if (prefs.getBytesLength(key) == size) {
+      found = (prefs.getBytes(key, data, size) == size);
+    }
+    prefs.end();
+  }
+  return found;
+}
+
+bool halStorageWrite(const char* key, const void* data, size_t size) {
+  Preferences prefs;
+  bool written = false;
+
+  if (prefs.begin(STORAGE_NAMESPACE, false)) {
+    written = (prefs.putBytes(key, data, size) == size);
+    prefs.end();
+  }
+  return written;
+}
+
+// Each task runs its step function, then sleeps until notified or the step's timeout expires
+static void halTaskRunner(void* param) {
+  HalTaskTiming& timing = halTaskTimings[(uintptr_t)param];
+
+  for (;;) {
+    uint32_t startUs = micros();
+    uint32_t waitMs = timing.step();
+    uint32_t busyUs = micros() - startUs;
+
+    // only this task writes its timing, so no read-modify-write is needed
+    timing.runs.store(timing.runs.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    timing.busyRemainderUs += busyUs;
+    timing.busyMs.store(timing.busyMs.load(std::memory_order_relaxed) + timing.busyRemainderUs / 1000, std::memory_order_relaxed);
+    timing.busyRemainderUs %= 1000;
+    if (busyUs > timing.longestUs.load(std::memory_order_relaxed)) {
+      timing.longestUs.store(busyUs, std::memory_order_relaxed);
+    }
+
+    ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(waitMs));
+  }
+}
+
+uint8_t halStartTask(const char* name, HalTaskStep step, uint8_t core, uint8_t priority) {
+  uint8_t task = halTaskCount++;
+  halTaskTimings[task].step = step;
+  halTaskTimings[task].name = name;
+  xTaskCreatePinnedToCore(halTaskRunner, name, HAL_TASK_STACK, (void*)(uintptr_t)task, priority, &halTasks[task], core);
+  return task;
+}
+
+bool halGetTaskStats(uint8_t task, HalTaskStats &stats) {
+  if (task >= halTaskCount) {
+    return false;
+  }
+  stats.name = halTaskTimings[task].name;
+  stats.runs = halTaskTimings[task].runs.load(std::memory_order_relaxed);
+  stats.busyMs = halTaskTimings[task].busyMs.load(std::memory_order_relaxed);
+  stats.longestUs = halTaskTimings[task].longestUs.load(std::memory_order_relaxed);
+  return true;
+}
+
+void halNotifyTask(uint8_t task) {
+  xTaskNotifyGive(halTasks[task]);
+}
+
+void IRAM_ATTR halNotifyTaskFromISR(uint8_t task) {
+  BaseType_t higherPriorityTaskWoken = pdFALSE;
+  vTaskNotifyGiveFromISR(halTasks[task], &higherPriorityTaskWoken);
+  portYIELD_FROM_ISR(higherPriorityTaskWoken);
+}
+
+void halGetHeapStats(HalHeapStats &stats) {
+  stats.freeBytes = ESP.getFreeHeap();
+  stats.largestFreeBlock = ESP.getMaxAllocHeap();
+  stats.minimumFreeBytes = ESP.getMinFreeHeap();
+  stats.allocations = 0; // not counted by the ESP32 heap
+}
+
+void halRestart() {
+  ESP.restart();
+}
+
+void halSleep() {
+  esp_deep_sleep_start();
+}
@@ -0,0 +1,151 @@
+#include <atomic>
+#include "log.h"
+#include "hal.h"
+
+typedef struct {
+  LogLevel level;
+  const char* format; // printf, with the arguments as int
+} LogEventFormat;
+
+static const LogEventFormat logEventFormats[] = {
+  {LOG_INFO, "Unit %02d restored at '%c'"},
+  {LOG_ERROR, "Unit %02d restored position out by %d steps, recalibrating"},
+  {LOG_INFO, "Unit %02d restored position verified (%d steps)"},
+  {LOG_WARNING, "Unit %02d revolution of %d steps ignored"},
+  {LOG_INFO, "Auto-tune started for Unit %d"},
+  {LOG_INFO, "Unit %02d speed tune level %d: %d us, accel %d"},
+  {LOG_WARNING, "Unit %02d busy, speed tune not started"},
+  {LOG_INFO, "Speed tune started for Unit %d"},
+  {LOG_ERROR, "Unit %02d speed tune abandoned"},
+  {LOG_WARNING, "Unit %02d missed %d steps at level %d"},
+  {LOG_INFO, "Unit %02d speed tuned: %d us, accel %d"},
+  {LOG_INFO, "Unit %02d offset set to %d"},
+  {LOG_WARNING, "Unit %02d has no '%c' flap, showing blank"},
+  {LOG_INFO, "Unit %02d flapsToMove %d"},
+  {LOG_INFO, "Unit %02d wrap to '%c'"},
+  {LOG_INFO, "Unit %02d move to '%c'"},
+  {LOG_INFO, "preInitialise started for Unit %d"},
+  {LOG_INFO, "preInitialise completed for Unit %d"},
+  {LOG_INFO, "Calibration started for Unit %d"},
+  {LOG_INFO, "calibration for Unit %d failed"},
+  {LOG_INFO, "Calb,%02d"},
+  {LOG_INFO, "Unit %d calibrated"},
+  {LOG_ERROR, "Unit %02d missed origin, recalibrating"},
+  {LOG_INFO, "Unit %02d origin at %d"},
+  {LOG_ERROR, "Unit %02d hall edges lost"},
+  {LOG_WARNING, "Unit %02d hall edge %d steps after origin ignored"},
+  {LOG_ERROR, "Unit %02d hall edges keep missing the origin, recalibrating"},
+  {LOG_WARNING, "Unit %02d hall edge %d steps from origin ignored"},
+  {LOG_INFO, "Unit %02d corrected by %d steps"},
+  {LOG_ERROR, "GLITCH,%02d,%d,%u,'%c'"},
+  {LOG_ERROR, "Frame queue full"},
+  {LOG_INFO, "Display lands in %d ms"},
+  {LOG_ERROR, "Unit %02d still moving after 20 secs, stopped"},
+  {LOG_ERROR, "Unit %02d out of service after %d failures, retrying in %d ms"},
+  {LOG_ERROR, "Unit %02d out of service after %d failures, disabled until restart"},
+  {LOG_WARNING, "Unit %02d homed after %d failures, degraded"},
+  {LOG_INFO, "Unit %02d recovered"},
+};
+
+static_assert(sizeof(logEventFormats) / sizeof(logEventFormats[0]) == LOG_EVENTS, "logEventFormats needs a format for every LogEvent");
+
+static const char* logLevelColours[] = {"", TXT_YELLOW, TXT_RED};
+
+static_assert((LOG_RING_SIZE & (LOG_RING_SIZE - 1)) == 0, "LOG_RING_SIZE must be a power of two");
+
+typedef struct {
+  std::atomic<uint32_t> committed; // index + 1 once the event has been written
+  uint32_t timeUs;
+  LogEvent event;
+  int32_t args[LOG_MAX_ARGS];
+} LogEntry;
+
+// Producers claim the next index by moving logHead on, write the entry, then commit it.
+// The drain reads entries in index order, waiting at one that hasn't been committed yet.
+static LogEntry logRing[LOG_RING_SIZE];
+static std::atomic<uint32_t> logHead(0);
+static std::atomic<uint32_t> logTail(0);
+static std::atomic<uint32_t> logDropped(0);
+static std::atomic<bool> logDraining(false);
+
+void IRAM_ATTR logEvent(LogEvent event, int32_t a, int32_t b, int32_t c, int32_t d) {
+  uint32_t index = logHead.load(std::memory_order_relaxed);
+
+  do {
+    if (index - logTail.load(std::memory_order_acquire) >= LOG_RING_SIZE) {
+      logDropped.fetch_add(1, std::memory_order_relaxed);
+      return;
+    }
+  } while (!logHead.compare_exchange_weak(index, index + 1, std::memory_order_relaxed));
+
+  LogEntry& entry = logRing[index & (LOG_RING_SIZE - 1)];
+  entry.timeUs = micros();
+  entry.event = event;
+  entry.args[0] = a;
+  entry.args[1] = b;
+  entry.args[2] = c;
+  entry.args[3] = d;
+  entry.committed.store(index + 1, std::memory_order_release);
+}
+
+size_t logFormatNext(char* line, size_t size, boolean colour) {
+  if (logDraining.exchange(true, std::memory_order_acquire)) {
+    return 0;
+  }
+
+  size_t length = 0;
+  uint32_t index = logTail.load(std::memory_order_relaxed);
+  LogEntry& entry = logRing[index & (LOG_RING_SIZE - 1)];
+  uint32_t dropped = logDropped.exchange(0, std::memory_order_relaxed);
+
+  if (dropped > 0) {
+    length = snprintf(line, size, "%s%lu log events dropped%s\n", colour ? TXT_RED : "", (unsigned long)dropped, colour ? TXT_RST : "");
+  }
+  else if (index != logHead.load(std::memory_order_relaxed) && entry.committed.load(std::memory_order_acquire) == index + 1) {
+    const LogEventFormat& format = logEventFormats[entry.event];
+    int32_t* args = entry.args;
+
+    length = snprintf(line, size, "%7lu.%03lu ms %s", (unsigned long)(entry.timeUs / 1000), (unsigned long)(entry.timeUs % 1000),
+                      colour ? logLevelColours[format.level] : "");
+    if (length < size) {
+      length += snprintf(line + length, size - length, format.format, (int)args[0], (int)args[1], (int)args[2], (int)args[3]);
+    }
+    if (length < size) {
+      length += snprintf(line + length, size - length, "%s\n", colour && format.level != LOG_INFO ? TXT_RST : "");
+    }
+    length = min(length, size - 1);
+    logTail.store(index + 1, std::memory_order_release);
+  }
+
+  logDraining.store(false, std::memory_order_release);
+  return length;
+}
+
+void logFlush() {
+  char line[LOG_LINE_SIZE];
+
+  while (logFormatNext(line, sizeof(line), true) > 0) {
+    Serial.print(line);
+  }
+}
+
+#if LOG_SINK == LOG_SINK_SERIAL
+// Write out what has been logged, a batch at a time
+static uint32_t logTaskStep() {
+  char line[LOG_LINE_SIZE];
+
+  for (uint8_t i = 0; i < LOG_DRAIN_BATCH; i++) {
+    if (logFormatNext(line, sizeof(line), true) == 0) {
+      return LOG_DRAIN_MS;
+    }
+    Serial.print(line);
+  }
+  return 0;
+}
+#endif
+
+void logStart() {
+#if LOG_SINK == LOG_SINK_SERIAL
+  halStartTask("log", logTaskStep, LOG_TASK_CORE, LOG_TASK_PRIORITY);
+#endif
+}
@@ -1,6 +1,7 @@
 /* Firmware for Mechanical Split-Flap Display
  *
  * This is the Arduino firmware for esp32Core_board_v2 (ESP32 DevKitC)
+ * All hardware access goes through hal.h, so this also builds for the native simulator
  *
  * Malcolm Yeoman (2024)
  *
@@ -13,59 +14,90 @@
 */
 
 #include <Arduino.h>
-#include <Wire.h>
-#include <MCP23017.h>
 #include <time.h>
+#include "hal.h"
 #include "system.h"
 #include "unit.h"
+#include "words.h"
+#include "boot.h"
+#include "frames.h"
+#include "scheduler.h"
+#include "sync.h"
+#include "udp_api.h"
+#include "log.h"
+#include "metrics.h"
+#include "trace.h"
 #if __has_include(<config-private.h>)
     #include "config-private.h"
 #else
     #include "config.h"
 #endif
 
+#define SENSOR_TASK_CORE 1
+#define SENSOR_TASK_PRIORITY 10 // above motion, so edges are captured as soon as they happen
+#define SENSOR_POLL_MS 1000 // re-read now and then in case an interrupt was missed
+#define MOTION_TASK_CORE 1
+#define MOTION_TASK_PRIORITY 5
+#define MOTION_ACTIVE_WAIT_MS 2 // how often to check progress while drums are moving
+#define MOTION_IDLE_WAIT_MS 500 // housekeeping interval when idle (otherwise woken by notification)
+#define NETWORK_TASK_CORE 0
+#define NETWORK_TASK_PRIORITY 1
+#define NETWORK_POLL_MS 10 // WebServer has no notification, so poll it at this interval
+#define NETWORK_CONNECT_POLL_MS 100 // how often to check for WiFi while connecting
+
 // Function headers
 void print_test_menu ();
-bool setExternalPin(uint8_t pin, uint8_t value);
+uint32_t sensorTaskStep();
+uint32_t motionTaskStep();
+uint32_t motionTaskUpdate();
+uint32_t networkTaskStep();
+void networkConnected();
 // boolean calibrate_all_units();
 void recalibrate_units();
-void IRAM_ATTR sensor_ISR();
-void updateHallSensors();
-void displayString(String display);
+void IRAM_ATTR sensor_ISR(uint8_t board);
+uint8_t hallValueFromPorts(uint8_t unit, uint8_t portA, uint8_t portB);
+void initHallSensors();
+void displayString(const char* text);
+void displayStringAt(const char* text, uint32_t landMillis);
 boolean diplayStillMoving();
+void bootMarkIdle();
 // void intToBinary(int num, char* binaryStr);
 // void debugUnitFlags(String prefix);
 
 // Global vars
-uint32_t previousMillis = 0;
 uint32_t displayLastStoppedMillis;
 uint32_t nextWordAPIMillis = 0;
-MCP23017 mcp_en_steppers = MCP23017(0x20);
-MCP23017 mcp_sensor = MCP23017(0x21);
 Unit *splitFlap[UNITCOUNT];
-volatile bool sensortriggered = false;
+volatile bool sensortriggered[BOARDCOUNT];
+volatile uint32_t sensorTriggeredMicros[BOARDCOUNT];
+volatile boolean displayIdle = false;
+volatile uint32_t displayLandMillis = 0; // when the units of the last displayString() are predicted to land
+SpscQueue<DisplayCommand, COMMAND_QUEUE_SIZE> commandQueue;
+uint8_t sensorTaskId;
+uint8_t motionTaskId;
+uint8_t networkTaskId;
 uint16_t counter = 0;
 uint8_t active_menu_unit = 0;
 boolean getting_first_word = true;
+boolean networkReady = false;
+boolean ntpSynced = false;
 const char* ssid = WIFI_SSID;
 const char* password = WIFI_PWD;
 time_t now; // this is the epoch
 tm timeinfo;  // structure tm holds time information in a more convenient way
 String test_command_previous = "";
-uint8_t charSeq = 40;
-char save_display[13];
-char previous_display[13];
-uint8_t reboot_count;
-String localIP;
-FastAccelStepperEngine engine;
-extern WebServer server;
+uint8_t charSeq = FLAPCOUNT;
+char save_display[UNITCOUNT + 1];
+char previous_display[UNITCOUNT + 1];
+char localIP[16];
 uint8_t word_updates_per_hour = WORDUPDATESPERHOUR; //store config value in variable to prevent div by zero compiler warnings
 
 // RTC memory structure - for persisting data between reboots
 typedef struct {
   uint32_t magic;
-  char previous_display[13];
-  uint8_t reboot_count;
+  char previous_display[UNITCOUNT + 1];
+  UnitState units[UNITCOUNT]; // each unit keeps its own, with its own checksum
+  RestartHistory restarts;
 } RTC;
 RTC_NOINIT_ATTR RTC nvmem;
 
@@ -73,97 +105,46 @@ RTC_NOINIT_ATTR RTC nvmem;
 // SETUP
 void setup() {
 
-#if DEBUG == 1
+#if DEBUG == 1 || LOG_SINK == LOG_SINK_SERIAL
   Serial.begin(115200);
 #endif
-  
-  WiFi.begin(ssid, password);
-  debugln(TXT_BLUE "Starting" TXT_RST);
+  logStart();
+  metricsRestoreRestarts(&nvmem.restarts);
+  traceStart();
 
-  // Future expansion possibility: Set up external I2C to chain multiple controller boards
-  // Wire2.begin(32,33); //(SDA=32, SCL=33);
-
-  // Configure I2C for MCP23017 port expanders
-  Wire.begin(21, 22, 800000); // SDA=21, SCL=22, 800kHz
-
-  mcp_en_steppers.init();
-  mcp_en_steppers.portMode(MCP23017Port::A, 0);          //Port A as output
-  mcp_en_steppers.portMode(MCP23017Port::B, 0);          //Port B as output
-  mcp_en_steppers.writeRegister(MCP23017Register::GPIO_A, 0x00);  //Reset port A 
-  mcp_en_steppers.writeRegister(MCP23017Register::GPIO_B, 0x00);  //Reset port B
+  // WiFi associates in the background
+  halNetworkBegin(ssid, password);
+  debugln(TXT_BLUE "Starting" TXT_RST);
+  debug("Attempting to connect to SSID: ");
+  debugln(ssid);
 
-  mcp_sensor.init();
-  mcp_sensor.portMode(MCP23017Port::A, 0b01111111); //Port A 7 bits as input
-  mcp_sensor.portMode(MCP23017Port::B, 0b01111111); //Port B 7 bits as input
-  mcp_sensor.writeRegister(MCP23017Register::IPOL_A, 0x00);
-  mcp_sensor.writeRegister(MCP23017Register::IPOL_B, 0x00);
-  mcp_sensor.writeRegister(MCP23017Register::GPIO_A, 0xFF);
-  mcp_sensor.writeRegister(MCP23017Register::GPIO_B, 0xFF);
+  // Configure MCP23017 port expanders
+  halExpandersInit();
 
   // Set up fast stepper engine
-  engine = FastAccelStepperEngine();
-  engine.init();
-  engine.setExternalCallForPin(setExternalPin);
+  halSteppersInit();
 
-  // Initialise split-flap display units
+  // Initialise split-flap display units, picking up where they were before a restart
+  uint8_t unitsRestored = 0;
   for (uint8_t unit = 0; unit < UNITCOUNT; unit++) {
-    splitFlap[unit] = new Unit(engine, unit);
-  }
-
-  // Enable Sensor interrupts
-  mcp_sensor.interruptMode(MCP23017InterruptMode::Or); //Both ports logically ORed to same interrupt pin     
-  mcp_sensor.interrupt(MCP23017Port::A, CHANGE);
-  mcp_sensor.interrupt(MCP23017Port::B, CHANGE);
-  mcp_sensor.clearInterrupts();
-  pinMode(interruptPin, INPUT_PULLUP);
-  attachInterrupt(digitalPinToInterrupt(interruptPin), sensor_ISR, FALLING);
-
-  // attempt to connect to Wifi network
-  debug("Attempting to connect to SSID: ");
-  debugln(ssid);
-  while (WiFi.status() != WL_CONNECTED) {
-    debug(".");
-    // wait 1 second between retries
-    delay(1000);
+    splitFlap[unit] = new Unit(unit);
+    if (splitFlap[unit]->restoreState(&nvmem.units[unit])) {
+      unitsRestored++;
+    }
   }
-
-  debug("\nConnected to " TXT_BLUE);
-  debugln(ssid);
-  localIP = WiFi.localIP().toString();
-  debug(localIP);
-  debugln(TXT_RST);
-
-  disableCertificates(); 
-
-  // Lookup NTP time
-  configTzTime(MY_TZ, MY_NTP_SERVER);
-  now = time(nullptr); //start time sync in background
-
-  // Set up REST API
-  setup_routing();
+  debugf("%d units restored, %d to home\n", unitsRestored, UNITCOUNT - unitsRestored);
 
   // Read hall sensors to get current values
-  updateHallSensors();
+  initHallSensors();
 
   // Read any previous display before last reboot
   if (nvmem.magic == RTC_MAGIC) {
-    strncpy(previous_display, nvmem.previous_display, 13);
-    previous_display[12]='\0';
-    reboot_count = nvmem.reboot_count;
-    debugf(TXT_YELLOW "previous_display: [%s], reboots: %d\n" TXT_RST, previous_display, reboot_count);
+    strncpy(previous_display, nvmem.previous_display, sizeof(previous_display));
+    previous_display[UNITCOUNT]='\0';
+    debugf(TXT_YELLOW "previous_display: [%s]\n" TXT_RST, previous_display);
   }
   else {
     previous_display[0] = '\0';
-    reboot_count = 0;
-  }
-
-  delay(101); // Delay to avoid initially false triggering the glitch detection
-
-  // Try up to 3 times to get NTP
-  uint8_t getntpcount = 0;
-  while (getntpcount++ < 3 && !getNTP(now, timeinfo)) {
-    delay(1000);
-    debugln("Retrying NTP...");
   }
 
   displayLastStoppedMillis = 0;
@@ -171,20 +152,79 @@ void setup() {
 #if DEBUG == 1
   print_test_menu();
 #endif
+
+  // Sensor and motion handling on one core, network on the other. Homing starts straight
+  // away; the network task brings up WiFi, the web server and NTP in the meantime.
+  sensorTaskId = halStartTask("sensor", sensorTaskStep, SENSOR_TASK_CORE, SENSOR_TASK_PRIORITY);
+  halAttachSensorInterrupt(sensor_ISR);
+  motionTaskId = halStartTask("motion", motionTaskStep, MOTION_TASK_CORE, MOTION_TASK_PRIORITY);
+  networkTaskId = halStartTask("network", networkTaskStep, NETWORK_TASK_CORE, NETWORK_TASK_PRIORITY);
+  bootMark(BOOT_HARDWARE);
 }
 
 void loop() {
-  String test_command;
-  uint16_t test_num;
+  // All work is done in the motion and network tasks started in setup()
+  delay(1000);
+}
+
+////////////////////////
+// SENSOR TASK (core 1): timestamp hall sensor edges as soon as the expander interrupts
+////////////////////////
+uint32_t sensorTaskStep() {
+  HalSensorPorts ports;
+
+  for (uint8_t board = 0; board < BOARDCOUNT; board++) {
+    boolean triggered = sensortriggered[board];
+    uint32_t triggeredMicros = sensorTriggeredMicros[board];
+
+    sensortriggered[board] = false;
+    halReadSensorPorts(board, ports);
+    uint32_t readMicros = micros();
+
+    for (uint8_t unit = 0; unit < UNITCOUNT; unit++) {
+      if (unitRegistry[unit].board != board) {
+        continue;
+      }
+      // INTCAP holds the ports as they were when the interrupt was raised, so that change
+      // gets the interrupt's timestamp. Anything since then is timed from this read.
+      if (triggered) {
+        splitFlap[unit]->recordHallEdge(hallValueFromPorts(unit, ports.capturedA, ports.capturedB), triggeredMicros);
+      }
+      splitFlap[unit]->recordHallEdge(hallValueFromPorts(unit, ports.portA, ports.portB), readMicros);
+    }
+  }
+  halNotifyTask(motionTaskId);
+
+  return SENSOR_POLL_MS;
+}
+
+////////////////////////
+// MOTION TASK (core 1): hall sensors, calibration and moving the drums
+////////////////////////
+uint32_t motionTaskStep() {
+  // Coalesce the stepper enables from everything started in this pass into one I2C write
+  halEnableBatchBegin();
+  uint32_t waitMs = motionTaskUpdate();
+  halEnableBatchEnd();
+
+  // Remember where settled drums are, in case of a restart, and bring failed units back
+  for (uint8_t unit = 0; unit < UNITCOUNT; unit++) {
+    splitFlap[unit]->healthUpdate();
+    splitFlap[unit]->persistState();
+    splitFlap[unit]->recordSettle();
+  }
+
+  return waitMs;
+}
 
-  ////////////////////////
-  // HIGH LEVEL EVENT LOOP
-  ////////////////////////
+uint32_t motionTaskUpdate() {
+  DisplayCommand command;
 
-  // Read hall sensors if change detected via interrupt
-  if (sensortriggered) {
-    sensortriggered = false;
-    updateHallSensors();
+  // Act on hall sensor edges captured by the sensor task
+  for (uint8_t unit = 0; unit < UNITCOUNT; unit++) {
+    if (!splitFlap[unit]->processHallEdges()) {
+      splitFlap[unit]->recalibrate();
+    }
   }
 
   // Calibrate any units that require it
@@ -192,168 +232,383 @@ void loop() {
 
   // Move any units pending due to drum passing origin (after they have recalibrated)
   for (uint8_t unit = 0; unit < UNITCOUNT; unit++) {
-    if (splitFlap[unit]->pendingLetter > 0 && splitFlap[unit]->calibrationComplete) {
+    splitFlap[unit]->checkOriginCrossing();
+    if (splitFlap[unit]->pendingLetter > 0 && splitFlap[unit]->calibrationComplete && !splitFlap[unit]->isSpeedTuning()) {
       splitFlap[unit]->moveSteppertoLetter(splitFlap[unit]->pendingLetter);
     }
+    if (splitFlap[unit]->speedTuneUpdate()) {
+      displayLastStoppedMillis = millis(); // still making progress
+    }
+  }
+
+  // Action any commands received from the network task
+  while (commandQueue.pop(command)) {
+    traceCommand(command);
+    switch (command.type) {
+      case CMD_DISPLAY:
+        frameQueueClear();
+        displayStringAt(command.text, command.landMillis);
+        break;
+      case CMD_QUEUE_FRAME:
+        if (!frameQueuePush(command.text, (uint16_t)command.count, command.flags & CMD_FLAG_BARRIER)) {
+          logEvent(LOG_FRAME_QUEUE_FULL);
+        }
+        break;
+      case CMD_MOVE_FLAPS:
+        splitFlap[command.unit]->moveStepperbyFlap(command.count);
+        break;
+      case CMD_MOVE_ALL_FLAPS:
+        for (uint8_t unit = 0; unit < UNITCOUNT; unit++) {
+          splitFlap[unit]->moveStepperbyFlap(command.count);
+        }
+        break;
+      case CMD_MOVE_STEPS:
+        splitFlap[command.unit]->moveStepperbyStep(command.count);
+        break;
+      case CMD_AUTOTUNE:
+        splitFlap[command.unit]->autoTuneStart();
+        break;
+      case CMD_SPEED_TUNE:
+        splitFlap[command.unit]->speedTuneStart();
+        break;
+      case CMD_SET_OFFSET:
+        splitFlap[command.unit]->setCalOffset(command.count);
+        break;
+      case CMD_CLEAR_FRAMES:
+        frameQueueClear();
+        break;
+    }
+  }
+
+  // Each unit starts its next frame as soon as it is ready
+  frameQueueUpdate(splitFlap);
+
+  // Start moves that are due, within the motor budget
+  if (schedulerStartMoves(splitFlap)) {
+    displayLastStoppedMillis = millis(); // still making progress
+  }
+
+  if (!diplayStillMoving()) {
+    displayIdle = frameQueueEmpty();
+    displayLastStoppedMillis = millis();
+    bootMarkIdle();
+
+    // Keep anything the units have learned while moving
+    for (uint8_t unit = 0; unit < UNITCOUNT; unit++) {
+      splitFlap[unit]->saveTuning();
+    }
+
+    // Check if need to redisplay after reboot
+    if (previous_display[0] != '\0') {
+      debugf("Display previous string: [%s]\n", previous_display);
+      displayString(previous_display);
+      previous_display[0] = '\0';
+      getting_first_word = false;
+    }
+    // Nothing moving: sleep until a sensor interrupt or a new command arrives
+    else if (commandQueue.empty() && frameQueueEmpty()) {
+      return MOTION_IDLE_WAIT_MS;
+    }
+  }
+  //If display has been moving for more than 20 seconds, must be an error condition: take the
+  //units still moving out of service, and let the rest carry on
+  else if (millis() - displayLastStoppedMillis > 20000) {
+    for (uint8_t unit = 0; unit < UNITCOUNT; unit++) {
+      if (splitFlap[unit]->checkIfRunning() || splitFlap[unit]->isSpeedTuning()) {
+        splitFlap[unit]->stopStuck();
+      }
+    }
+    displayLastStoppedMillis = millis();
+  }
+  else {
+    displayIdle = false;
   }
 
-  // Lower priority events below
-  if ((uint32_t)millis() - previousMillis >= 500) {
-    previousMillis = millis();
+  // Drums moving or calibrating: keep checking progress
+  return MOTION_ACTIVE_WAIT_MS;
+}
+
+////////////////////////
+// NETWORK TASK (core 0): web server, word updates and the serial console
+////////////////////////
+uint32_t networkTaskStep() {
+  String test_command;
+  uint16_t test_num;
+  DisplayCommand command;
+  char word[SIGN_MAX_COLUMNS + 1];
 
+  // Bring up the network services once WiFi has associated
+  if (!networkReady) {
+    if (halNetworkConnected()) {
+      networkConnected();
+    }
+  }
+  else {
     // Rest API server
-    server.handleClient();
-
-    //If display not moving, check if anything new to display
-    if (!diplayStillMoving()) {
-      displayLastStoppedMillis = millis();
-
-      // Check if need to redisplay after reboot
-      if (previous_display[0] != '\0') {
-        // don't allow more than 3 reboots per period - to avoid continous running in the event of fault
-        if (reboot_count++ > 3) {
-          debugln(TXT_RED "HALTING due to reboot count." TXT_RST);
-          while (true);
-        }
-        debugf("Display previous string: [%s], reboots: %d\n", previous_display, reboot_count);
-        displayString(String(previous_display));
-        previous_display[0] = '\0';
+    handle_client();
+
+    // Frames from the display group's leader
+    syncUpdate();
+
+    // Binary commands
+    udpApiUpdate();
+
+    // SNTP sets the clock in the background
+    if (!ntpSynced && ntpSynchronised()) {
+      getNTP(now, timeinfo);
+      ntpSynced = true;
+      bootMark(BOOT_NTP);
+    }
+  }
+
+  //If display not moving, check if anything new to display
+  if (networkReady && displayIdle && previous_display[0] == '\0') {
+    if (getting_first_word) {
+      if (word_updates_per_hour == 0) {
         getting_first_word = false;
       }
-
-      else if (getting_first_word) {
-        if (word_updates_per_hour > 0) {
-          String word = wordOfTheDay();
-          displayLastStoppedMillis = millis();
-          debugf("Word, %02d:%02d, [%s]\n", timeinfo.tm_hour, timeinfo.tm_min, word);
-          displayString(word);    
-          nextWordAPIMillis = millis() + 60000; //dont check again until this minute passed
-        }
+      // wait for the first word to be fetched in the background
+      else if (nextWord(word)) {
+        debugf("Word, %02d:%02d, [%s]\n", timeinfo.tm_hour, timeinfo.tm_min, word);
+        queueDisplayString(word);
+        nextWordAPIMillis = millis() + 60000; //dont check again until this minute passed
         getting_first_word = false;
       }
+    }
 
-      // Display random word according to WORDUPDATESPERHOUR
-      else if (word_updates_per_hour > 0 && ((uint32_t)millis() > nextWordAPIMillis)) {
-        // Only update during daytime hours
-        if (getNTP(now, timeinfo)) {
-          if ((timeinfo.tm_min % (60 / word_updates_per_hour) == 0) && (timeinfo.tm_hour >= 8 && timeinfo.tm_hour <= 19)) {
-            reboot_count = 0;
-            nextWordAPIMillis = (millis() + (3600 / word_updates_per_hour) * 1000) - 3000; //dont check again until nearly next word update time
-            String word = wordOfTheDay();
-            displayLastStoppedMillis = millis();
+    // Display random word according to WORDUPDATESPERHOUR
+    else if (word_updates_per_hour > 0 && ((uint32_t)millis() > nextWordAPIMillis)) {
+      // Only update during daytime hours
+      if (getNTP(now, timeinfo)) {
+        if ((timeinfo.tm_min % (60 / word_updates_per_hour) == 0) && (timeinfo.tm_hour >= 8 && timeinfo.tm_hour <= 19)) {
+          nextWordAPIMillis = (millis() + (3600 / word_updates_per_hour) * 1000) - 3000; //dont check again until nearly next word update time
+          if (nextWord(word)) {
             debugf("Word, %02d:%02d, [%s]\n", timeinfo.tm_hour, timeinfo.tm_min, word);
-            displayString(word);
-
-            // For testing only (changes all characters and requires a drum rotation + calibration each time)
-            // nextWordAPIMillis = (millis() + (3600 / word_updates_per_hour) * 1000) - 3000; //dont check again until nearly next word update time
-            // String thisSeq = "@@@@@@@@@@@@";
-            // charSeq--;
-            // if (charSeq == 0) {
-            //   charSeq = 39;
-            // }
-            // thisSeq.replace("@",String(letters[charSeq]));
-            // displayString(thisSeq);
-
+            queueDisplayString(word);
           }
+
+          // For testing only (changes all characters and requires a drum rotation + calibration each time)
+          // nextWordAPIMillis = (millis() + (3600 / word_updates_per_hour) * 1000) - 3000; //dont check again until nearly next word update time
+          // String thisSeq = "@@@@@@@@@@@@";
+          // charSeq--;
+          // if (charSeq == 0) {
+          //   charSeq = 39;
+          // }
+          // thisSeq.replace("@",String(letters[charSeq]));
+          // queueDisplayString(thisSeq.c_str());
+
         }
       }
-
-      // Handle Button Press Code Here
-      // else if (digitalRead(button1Pin) == 0) {
-      //   do something;
-      // }
-    }
-    //If display has been moving for more than 20 seconds, must be an error condition
-    else if (millis() - displayLastStoppedMillis > 20000) {
-      debugln(TXT_RED "Moving > 20 secs - RESTARTING!!!" TXT_RST);
-      nvmem.magic = RTC_MAGIC;
-      strncpy(nvmem.previous_display,save_display,13);
-      nvmem.reboot_count = reboot_count;
-      ESP.restart();
     }
 
-    // Handle interactive serial commands over USB (used for debugging)
-#if DEBUG == 1
-    if (Serial.available()) {
-      test_command = Serial.readStringUntil('\n');
-      test_command.replace("\r","");
-      test_command.toUpperCase();
+    // Handle Button Press Code Here
+    // else if (digitalRead(button1Pin) == 0) {
+    //   do something;
+    // }
+  }
 
-      // if only return was pressed then repeat last command
-      if (test_command.length() == 0) { 
-        test_command = test_command_previous;
-      }
+  // Handle interactive serial commands over USB (used for debugging)
+#if DEBUG == 1
+  if (Serial.available()) {
+    test_command = Serial.readStringUntil('\n');
+    test_command.replace("\r","");
+    test_command.toUpperCase();
+
+    // if only return was pressed then repeat last command
+    if (test_command.length() == 0) { 
+      test_command = test_command_previous;
+    }
 
-      if (test_command.charAt(0) == char(92)) { //backslash
-        print_test_menu();
-      }
-      else if (test_command.charAt(0) == ']') {
-        test_num = test_command.substring(1,3).toInt();
-        if (test_num >= 0) {
-          active_menu_unit = test_num;
-          debugf("Active unit set to %d\n", active_menu_unit);
-        }
+    if (test_command.charAt(0) == char(92)) { //backslash
+      print_test_menu();
+    }
+    else if (test_command.charAt(0) == ']') {
+      test_num = test_command.substring(1,3).toInt();
+      if (test_num < UNITCOUNT) {
+        active_menu_unit = test_num;
+        debugf("Active unit set to %d\n", active_menu_unit);
       }
-      else if (test_command.charAt(0) == '>') {
-        test_num = test_command.substring(1,5).toInt();
-        if (test_num > 0) {
-          debugf("Move %d flaps\n", test_num);
-          splitFlap[active_menu_unit]->moveStepperbyFlap(test_num);
-        }
+    }
+    else if (test_command.charAt(0) == '>') {
+      test_num = test_command.substring(1,5).toInt();
+      if (test_num > 0) {
+        debugf("Move %d flaps\n", test_num);
+        command = makeCommand(CMD_MOVE_FLAPS, active_menu_unit, (int16_t)test_num);
+        queueCommand(command);
       }
-      else if (test_command.charAt(0) == '}') {
-        test_num = test_command.substring(1,5).toInt();
-        if (test_num > 0) {
-            debugf("Move all flaps by %d\n", test_num);
-            for (uint8_t unit = 0; unit < UNITCOUNT; unit++) {
-              splitFlap[unit]->moveStepperbyFlap(test_num);
-            }
-        }
+    }
+    else if (test_command.charAt(0) == '}') {
+      test_num = test_command.substring(1,5).toInt();
+      if (test_num > 0) {
+          debugf("Move all flaps by %d\n", test_num);
+          command = makeCommand(CMD_MOVE_ALL_FLAPS, 0, (int16_t)test_num);
+          queueCommand(command);
       }
-      // Move stepper by a raw number of steps
-      else if (test_command.charAt(0) == '~') {
-        test_num = test_command.substring(1,5).toInt();
-        if (test_num > 0) {
-          debugf("Move %d steps\n", test_num);
-          splitFlap[active_menu_unit]->moveStepperbyStep(test_num);
-        }
+    }
+    // Move stepper by a raw number of steps
+    else if (test_command.charAt(0) == '~') {
+      test_num = test_command.substring(1,5).toInt();
+      if (test_num > 0) {
+        debugf("Move %d steps\n", test_num);
+        command = makeCommand(CMD_MOVE_STEPS, active_menu_unit, (int16_t)test_num);
+        queueCommand(command);
       }
-      else if (test_command.charAt(0) == '|') {
-        ESP.restart();
+    }
+    // Measure steps per revolution of the active unit
+    else if (test_command.charAt(0) == '*') {
+      debugf("Auto-tune unit %d\n", active_menu_unit);
+      command = makeCommand(CMD_AUTOTUNE, active_menu_unit);
+      queueCommand(command);
+    }
+    // Find the fastest speed and acceleration the active unit runs at without missing steps
+    else if (test_command.charAt(0) == '(') {
+      debugf("Speed tune unit %d\n", active_menu_unit);
+      command = makeCommand(CMD_SPEED_TUNE, active_menu_unit);
+      queueCommand(command);
+    }
+    // Set steps from the hall sensor to the blank flap for the active unit
+    else if (test_command.charAt(0) == '^') {
+      test_num = test_command.substring(1,4).toInt();
+      if (test_num > 0 && test_num < 256) {
+        debugf("Set offset %d\n", test_num);
+        command = makeCommand(CMD_SET_OFFSET, active_menu_unit, (int16_t)test_num);
+        queueCommand(command);
       }
-      else if (test_command.charAt(0) == '%') {
-        String word = wordOfTheDay();
+    }
+    else if (test_command.charAt(0) == '|') {
+      metricsRecordRestart(RESTART_REQUESTED);
+      nvmem.magic = RTC_MAGIC;
+      strncpy(nvmem.previous_display, save_display, sizeof(nvmem.previous_display));
+      halRestart();
+    }
+    else if (test_command.charAt(0) == '=') {
+      HalI2cStats i2c;
+      halGetI2cStats(i2c);
+      debugf("I2C transactions: %lu, bytes: %lu\n", (unsigned long)i2c.transactions, (unsigned long)i2c.bytes);
+      HalHeapStats heap;
+      halGetHeapStats(heap);
+      debugf("Heap free: %lu (least %lu), largest block: %lu\n", (unsigned long)heap.freeBytes, (unsigned long)heap.minimumFreeBytes,
+             (unsigned long)heap.largestFreeBlock);
+    }
+    else if (test_command.charAt(0) == '%') {
+      if (nextWord(word)) {
         debugf("Word, %02d:%02d, [%s]\n", timeinfo.tm_hour, timeinfo.tm_min, word);
-        displayString(word);
-      }   
-      else if (test_command.charAt(0) == '+') {
-        String thisSeq = "@@@@@@@@@@@@";
-        // String thisSeq = "       @ ";
-        charSeq--;
-        if (charSeq == 0) {
-          charSeq = 39;
-        }
-        thisSeq.replace("@",String(letters[charSeq]));
-        displayString(thisSeq);
-      }  
-      else if (test_command.charAt(0) == '<') {
-        debugln("Put ESP to sleep until power reset");
-        esp_deep_sleep_start();
-      }      
-      else {
-        test_command.toUpperCase();
-        debugf("Display %s\n", test_command);
-        displayString(test_command);
+        queueDisplayString(word);
       }
-      test_command_previous = test_command;
+    }   
+    else if (test_command.charAt(0) == '+') {
+      char thisSeq[UNITCOUNT + 1];
+      charSeq--;
+      if (charSeq == 0) {
+        charSeq = FLAPCOUNT - 1;
+      }
+      memset(thisSeq, letters[charSeq], UNITCOUNT);
+      thisSeq[UNITCOUNT] = '\0';
+      queueDisplayString(thisSeq);
+    }  
+    else if (test_command.charAt(0) == '<') {
+      debugln("Put ESP to sleep until power reset");
+      halSleep();
+    }      
+    else {
+      test_command.toUpperCase();
+      debugf("Display %s\n", test_command.c_str());
+      queueDisplayString(test_command.c_str());
     }
+    test_command_previous = test_command;
+  }
 #endif
+
+  return networkReady ? NETWORK_POLL_MS : NETWORK_CONNECT_POLL_MS;
+}
+
+void networkConnected() {
+  debug("Connected to " TXT_BLUE);
+  debugln(ssid);
+  halNetworkLocalIP(localIP, sizeof(localIP));
+  debug(localIP);
+  debugln(TXT_RST);
+  bootMark(BOOT_WIFI);
+
+  disableCertificates();
+
+  // Lookup NTP time
+  startNTP(now); //start time sync in background
+
+  // Set up REST API and mDNS
+  setup_routing();
+  udpApiStart();
+  bootMark(BOOT_SERVER);
+
+  // Join the display group, if in one. Followers show the leader's text, not their own words.
+  syncStart(splitFlap);
+  if (syncIsFollower()) {
+    word_updates_per_hour = 0;
+  }
+
+  wordProviderStart();
+  networkReady = true;
+}
+
+// A command with no text, to be filled in if it needs any
+DisplayCommand makeCommand(DisplayCommandType type, uint8_t unit, int16_t count, uint8_t flags) {
+  DisplayCommand command = {};
+
+  command.type = type;
+  command.unit = unit;
+  command.count = count;
+  command.flags = flags;
+  return command;
+}
+
+// Pass a command to the motion task (only called from the network task)
+boolean queueCommand(const DisplayCommand& command) {
+  if (!commandQueue.push(command)) {
+    debugln(TXT_RED "Command queue full" TXT_RST);
+    return false;
   }
+  halNotifyTask(motionTaskId);
+  return true;
+}
 
+// Text for the whole sign: the leader of a display group passes it on to the followers
+boolean queueDisplayString(const char* text) {
+  if (syncIsLeader()) {
+    return syncLeadDisplay(text);
+  }
+  return queueDisplayAt(syncColumns(text), millis());
+}
+
+// Text for this controller's units, to land at landMillis (or as soon as possible)
+boolean queueDisplayAt(const char* text, uint32_t landMillis) {
+  DisplayCommand command = makeCommand(CMD_DISPLAY);
+
+  strncpy(command.text, text, UNITCOUNT);
+  command.text[UNITCOUNT] = '\0';
+  command.landMillis = landMillis;
+  return queueCommand(command);
+}
+
+// Queue one frame of a sequence (padded to the display width)
+boolean queueFrame(const char* text, uint16_t holdMs, boolean barrier) {
+  char padded[SIGN_MAX_COLUMNS + 1];
+
+  return queueFrameText(syncColumns(padToFullWidth(text, padded, sizeof(padded))), holdMs, barrier);
+}
+
+// Queue one frame of a sequence, as given for this controller's units
+boolean queueFrameText(const char* text, uint16_t holdMs, boolean barrier) {
+  DisplayCommand command = makeCommand(CMD_QUEUE_FRAME, 0, (int16_t)holdMs, barrier ? CMD_FLAG_BARRIER : 0);
+
+  strncpy(command.text, text, UNITCOUNT);
+  command.text[UNITCOUNT] = '\0';
+  return queueCommand(command);
 }
 
 void print_test_menu() {
-  getNTP(now, timeinfo);
+  if (ntpSynced) {
+    getNTP(now, timeinfo);
+  }
 
   debugln(TXT_GREEN "----------------------------------");
   debugf ("     %s", asctime(&timeinfo));
@@ -364,7 +619,11 @@ void print_test_menu() {
   debugf ("]   : Set active unit for this menu [%d]\n", active_menu_unit);
   debugln(">   : Move forward number of flaps");
   debugln("~   : Move forward number steps");
+  debugln("*   : Auto-tune steps per flap");
+  debugln("(   : Auto-tune speed and acceleration");
+  debugln("^   : Set blank flap offset (steps)");
   debugln("|   : Reset Display");
+  debugln("=   : Show I2C bus statistics");
   debugln("%   : Display a random word");
   debugln("+   : Test: countdown of all flaps");
   debugln("<   : Idle");
@@ -372,93 +631,150 @@ void print_test_menu() {
   debugln("----------------------------------" TXT_RST);
 }
 
-// Callback routine that actions the enable on or off triggered by setAutoEnable
-bool setExternalPin(uint8_t pin, uint8_t value) {
-  pin = pin & ~PIN_EXTERNAL_FLAG;
-
-  // When using SLEEP instead of /ENABLE on the A4988 to save idle power, need to invert
-  // debugf("mcp en pin %d set to %d\n", pin, value ^ 0x01);
-  mcp_en_steppers.digitalWrite(pin, value ^ 0x01);
-
-  return value;
-}
-
 void recalibrate_units() {
   uint8_t unitsCalibrating;
   int8_t calibrationResult;
+  uint8_t motorsEnabled = schedulerMotorsEnabled(splitFlap);
 
   unitsCalibrating = 0;
   for (uint8_t unit = 0; unit < UNITCOUNT; unit++) {
-    if (!splitFlap[unit]->calibrationComplete) {
+    if (!splitFlap[unit]->calibrationComplete && splitFlap[unit]->inService()) {
       if (!splitFlap[unit]->calibrationStarted) {
+        // Within the motor budget; the rest start homing as others finish
+        if (!splitFlap[unit]->isMotorEnabled()) {
+          if (motorsEnabled >= schedulerMotorBudget()) {
+            continue;
+          }
+          motorsEnabled++;
+        }
         splitFlap[unit]->calibrateStart();
+        displayLastStoppedMillis = millis(); // still making progress
         unitsCalibrating++;
       }
       else {
+        // a failure takes just that unit out of service (see Unit::healthUpdate)
         calibrationResult = splitFlap[unit]->calibrate();
         if (calibrationResult == 0) {
           unitsCalibrating++;
         }
-        else if (calibrationResult < 0) {
-          debugf("Calibration failed for unit %d\n", unit);
-          debugln(TXT_RED "RESTARTING!!!" TXT_RST);
-          nvmem.magic = RTC_MAGIC;
-          strncpy(nvmem.previous_display,save_display,13);
-          nvmem.reboot_count = reboot_count;
-          ESP.restart();
-        }
       }
     }
   }
 }
 
-void IRAM_ATTR sensor_ISR() {
-    sensortriggered = true;
+void IRAM_ATTR sensor_ISR(uint8_t board) {
+    sensorTriggeredMicros[board] = micros();
+    sensortriggered[board] = true;
+    halNotifyTaskFromISR(sensorTaskId);
 }
 
-void updateHallSensors() {
-  uint8_t newvalue;
+uint8_t hallValueFromPorts(uint8_t unit, uint8_t portA, uint8_t portB) {
+  uint16_t ports = portA | (portB << 8);
+  return (ports >> unitRegistry[unit].sensorBit) & 1;
+}
 
-  mcp_sensor.clearInterrupts();
-  uint8_t sensor_port_current_a = mcp_sensor.readPort(MCP23017Port::A);
-  uint8_t sensor_port_current_b = mcp_sensor.readPort(MCP23017Port::B);
+void initHallSensors() {
+  HalSensorPorts ports;
 
-  for (uint8_t unit = 0; unit < UNITCOUNT; unit++) {
-    if (sensorPort[unit] == 'A') {
-        newvalue = ((~sensor_port_current_a & sensorPortBit[unit]) == 0);
-        if (!splitFlap[unit]->updateHallValue(newvalue)) {
-          splitFlap[unit]->moveStepperbyFlap(1);
-          splitFlap[unit]->calibrationComplete = false;
-          splitFlap[unit]->calibrationStarted = false;
-          splitFlap[unit]->pendingLetter = splitFlap[unit]->destinationLetter;
-        }
+  for (uint8_t board = 0; board < BOARDCOUNT; board++) {
+    halReadSensorPorts(board, ports);
+    for (uint8_t unit = 0; unit < UNITCOUNT; unit++) {
+      if (unitRegistry[unit].board == board) {
+        splitFlap[unit]->initHallValue(hallValueFromPorts(unit, ports.portA, ports.portB));
+      }
     }
-    else {
-        newvalue = ((~sensor_port_current_b & sensorPortBit[unit]) == 0);
-        if (!splitFlap[unit]->updateHallValue(newvalue)) {
-          splitFlap[unit]->moveStepperbyFlap(1);
-          splitFlap[unit]->calibrationComplete = false;
-          splitFlap[unit]->calibrationStarted = false;
-          splitFlap[unit]->pendingLetter = splitFlap[unit]->destinationLetter;
-        }
+  }
+}
+
+// Boot phases the motion task can see: all units homed, then the first text shown
+void bootMarkIdle() {
+  if (bootReached(BOOT_FIRST_DISPLAY)) {
+    return;
+  }
+
+  for (uint8_t unit = 0; unit < UNITCOUNT; unit++) {
+    if (!splitFlap[unit]->calibrationComplete || splitFlap[unit]->pendingLetter > 0) {
+      return;
     }
   }
+  bootMark(BOOT_HOMED);
+
+  if (save_display[0] != '\0') {
+    bootMark(BOOT_FIRST_DISPLAY);
+  }
+}
+
+void displayString(const char* text) {
+  displayStringAt(text, millis());
 }
 
-void displayString(String display) {
+// Show the text, landing at landMillis if there's time to
+void displayStringAt(const char* text, uint32_t landMillis) {
+  char display[UNITCOUNT + 1];
   uint8_t test_length;
-  char display_char;
+  uint8_t savedLength = strlen(save_display);
 
-  display.toUpperCase();
-  strncpy(save_display, display.c_str(), 13); // save display in case of reboot
+  strncpy(display, text, UNITCOUNT);
+  display[UNITCOUNT] = '\0';
+  upperCaseText(display);
+  test_length = strlen(display);
 
-  test_length = display.length();
-  if (test_length > UNITCOUNT) {
-    test_length = UNITCOUNT;
+  // save display in case of reboot, keeping the letters of units left as they are
+  for (uint8_t unit = 0; unit < test_length; unit++) {
+    if (display[unit] != DISPLAY_KEEP_LETTER || unit >= savedLength) {
+      save_display[unit] = display[unit];
+    }
+  }
+  if (test_length >= savedLength || strchr(display, DISPLAY_KEEP_LETTER) == nullptr) {
+    save_display[test_length] = '\0';
   }
-  for (uint8_t char_pos = 0; char_pos < test_length; char_pos++) {
-    display_char = display.charAt(char_pos);
-    splitFlap[char_pos]->moveSteppertoLetter(display_char);
+
+  uint32_t landsInMs = schedulerPlanDisplayAt(splitFlap, display, test_length, landMillis);
+  displayLandMillis = millis() + landsInMs;
+  logEvent(LOG_DISPLAY_LANDS, landsInMs);
+}
+
+// Letter each unit is showing, or moving to, blank padded
+void displayCurrentText(char* buffer, uint8_t size) {
+  for (uint8_t i = 0; i < size; i++) {
+    char letter = (i < UNITCOUNT) ? splitFlap[i]->destinationLetter : ' ';
+    buffer[i] = (letter != 0) ? letter : ' ';
+  }
+}
+
+// Health of the unit, for /status
+const char* displayUnitHealth(uint8_t unit) {
+  return unitHealthName(splitFlap[unit]->health());
+}
+
+// Predicted time until the display settles (0 when idle)
+uint32_t displayLandsInMs() {
+  uint32_t landMillis = displayLandMillis;
+  int32_t remaining = (int32_t)(landMillis - millis());
+
+  if (displayIdle || remaining < 0) {
+    return 0;
+  }
+  return remaining;
+}
+
+// Pad to the width of the sign with blanks, starting one column in if there's room to spare.
+// padded holds size bytes, and may be word itself.
+char* padToFullWidth (const char* word, char* padded, size_t size) {
+  size_t width = min((size_t)syncSignWidth(), size - 1);
+  size_t length = strnlen(word, width);
+  size_t lead = (length + 2 <= width) ? 1 : 0;
+
+  memmove(padded + lead, word, length);
+  memset(padded, ' ', lead);
+  memset(padded + lead + length, ' ', width - lead - length);
+  padded[width] = '\0';
+  return padded;
+}
+
+void upperCaseText(char* text) {
+  for (; *text != '\0'; text++) {
+    *text = toupper((unsigned char)*text);
   }
 }
 
@@ -466,7 +782,7 @@ boolean diplayStillMoving () {
   boolean display_busy = true;
   display_busy = false;
   for (uint8_t unit = 0; unit < UNITCOUNT; unit++) {
-    if (splitFlap[unit]->checkIfRunning()) {
+    if (splitFlap[unit]->checkIfRunning() || splitFlap[unit]->moveScheduled() || splitFlap[unit]->isSpeedTuning()) {
       display_busy = true;
     }
   }
@@ -0,0 +1,221 @@
+#include <atomic>
+#include <stdarg.h>
+#include "metrics.h"
+#include "hal.h"
+#include "unit.h"
+
+typedef struct {
+  std::atomic<uint32_t> moves;
+  std::atomic<uint32_t> stepsMoved;
+  std::atomic<uint32_t> settleBuckets[METRICS_SETTLE_BUCKETS + 1]; // the last is over every bound
+  std::atomic<uint32_t> settleMs;
+  std::atomic<uint32_t> calibrations;
+  std::atomic<uint32_t> calibrationMs;
+  std::atomic<uint32_t> calibrationFailures;
+  std::atomic<uint32_t> glitches;
+  std::atomic<uint32_t> noiseEdges;
+  std::atomic<uint32_t> faults;
+  std::atomic<uint8_t> health;
+} UnitMetrics;
+
+static UnitMetrics unitMetrics[UNITCOUNT];
+static const uint32_t settleBucketMs[METRICS_SETTLE_BUCKETS] = METRICS_SETTLE_BUCKET_MS;
+static const char* restartReasonNames[RESTART_REASONS] = {"power_on", "other", "requested"};
+static RestartHistory* restartHistory = nullptr;
+
+// Only the motion task writes, so no read-modify-write is needed
+static inline void metricsAdd(std::atomic<uint32_t>& counter, uint32_t amount) {
+  counter.store(counter.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+}
+
+// At boot: count the restart that just happened, and expect the next one to be unasked for
+void metricsRestoreRestarts(RestartHistory* history) {
+  restartHistory = history;
+  if (history->magic != RESTART_HISTORY_MAGIC || history->pendingReason >= RESTART_REASONS) {
+    memset(history, 0, sizeof(RestartHistory));
+    history->magic = RESTART_HISTORY_MAGIC;
+    history->pendingReason = RESTART_POWER_ON;
+  }
+  history->lastReason = history->pendingReason;
+  history->counts[history->lastReason]++;
+  history->pendingReason = RESTART_OTHER;
+}
+
+void metricsRecordRestart(RestartReason reason) {
+  if (restartHistory != nullptr) {
+    restartHistory->pendingReason = reason;
+  }
+}
+
+void metricsMoveStarted(uint8_t unit) {
+  metricsAdd(unitMetrics[unit].moves, 1);
+}
+
+void metricsMoveSettled(uint8_t unit, uint32_t settleMs, uint32_t steps) {
+  uint8_t bucket = 0;
+
+  while (bucket < METRICS_SETTLE_BUCKETS && settleMs > settleBucketMs[bucket]) {
+    bucket++;
+  }
+  metricsAdd(unitMetrics[unit].settleBuckets[bucket], 1);
+  metricsAdd(unitMetrics[unit].settleMs, settleMs);
+  metricsAdd(unitMetrics[unit].stepsMoved, steps);
+}
+
+void metricsCalibrationStarted(uint8_t unit) {
+  metricsAdd(unitMetrics[unit].calibrations, 1);
+}
+
+void metricsCalibrationCompleted(uint8_t unit, uint32_t durationMs) {
+  metricsAdd(unitMetrics[unit].calibrationMs, durationMs);
+}
+
+void metricsCalibrationFailed(uint8_t unit) {
+  metricsAdd(unitMetrics[unit].calibrationFailures, 1);
+}
+
+void metricsGlitch(uint8_t unit) {
+  metricsAdd(unitMetrics[unit].glitches, 1);
+}
+
+void metricsNoiseEdge(uint8_t unit) {
+  metricsAdd(unitMetrics[unit].noiseEdges, 1);
+}
+
+void metricsUnitFault(uint8_t unit) {
+  metricsAdd(unitMetrics[unit].faults, 1);
+}
+
+void metricsUnitHealth(uint8_t unit, uint8_t health) {
+  unitMetrics[unit].health.store(health, std::memory_order_relaxed);
+}
+
+// Text is gathered here and handed to write() whenever the next line might not fit
+static char metricsBuffer[1024];
+static size_t metricsLength;
+static void (*metricsOutput)(const char* text, size_t length);
+
+static void metricsPrintf(const char* format, ...) __attribute__((format(printf, 1, 2)));
+static void metricsPrintf(const char* format, ...) {
+  va_list args;
+
+  if (metricsLength > sizeof(metricsBuffer) - 160) {
+    metricsOutput(metricsBuffer, metricsLength);
+    metricsLength = 0;
+  }
+  va_start(args, format);
+  int length = vsnprintf(metricsBuffer + metricsLength, sizeof(metricsBuffer) - metricsLength, format, args);
+  va_end(args);
+  if (length > 0) {
+    metricsLength += length;
+  }
+  if (metricsLength >= sizeof(metricsBuffer)) {
+    metricsLength = sizeof(metricsBuffer) - 1; // truncated
+  }
+}
+
+static void metricsHeader(const char* name, const char* type, const char* help) {
+  metricsPrintf("# HELP splitflap_%s %s\n# TYPE splitflap_%s %s\n", name, help, name, type);
+}
+
+// One line per unit of a per-unit counter
+static void metricsUnitCounter(const char* name, const char* help, std::atomic<uint32_t> UnitMetrics::*counter) {
+  metricsHeader(name, "counter", help);
+  for (uint8_t unit = 0; unit < UNITCOUNT; unit++) {
+    metricsPrintf("splitflap_%s{unit=\"%u\"} %lu\n", name, unit, (unsigned long)(unitMetrics[unit].*counter).load(std::memory_order_relaxed));
+  }
+}
+
+void metricsWrite(void (*write)(const char* text, size_t length)) {
+  metricsOutput = write;
+  metricsLength = 0;
+
+  metricsUnitCounter("unit_moves_total", "Moves started", &UnitMetrics::moves);
+  metricsUnitCounter("unit_steps_total", "Steps moved, counted as each move settles", &UnitMetrics::stepsMoved);
+  metricsUnitCounter("unit_calibrations_total", "Homing runs started", &UnitMetrics::calibrations);
+  metricsUnitCounter("unit_calibration_failures_total", "Homing runs that didn't find the magnet in time", &UnitMetrics::calibrationFailures);
+  metricsUnitCounter("unit_glitches_total", "Hall sensor edges too close together, forcing a recalibration", &UnitMetrics::glitches);
+  metricsUnitCounter("unit_noise_edges_total", "Hall sensor edges ignored once homed, as nowhere near the magnet", &UnitMetrics::noiseEdges);
+  metricsUnitCounter("unit_faults_total", "Failed homing runs and stuck moves, each taking the unit out of service", &UnitMetrics::faults);
+
+  metricsHeader("unit_health", "gauge", "Whether each unit is in each health state");
+  for (uint8_t unit = 0; unit < UNITCOUNT; unit++) {
+    uint8_t health = unitMetrics[unit].health.load(std::memory_order_relaxed);
+    for (uint8_t state = 0; state < UNIT_HEALTH_STATES; state++) {
+      metricsPrintf("splitflap_unit_health{unit=\"%u\",state=\"%s\"} %d\n", unit, unitHealthName((UnitHealth)state), health == state ? 1 : 0);
+    }
+  }
+
+  metricsHeader("unit_calibration_seconds_total", "counter", "Time spent homing");
+  for (uint8_t unit = 0; unit < UNITCOUNT; unit++) {
+    uint32_t ms = unitMetrics[unit].calibrationMs.load(std::memory_order_relaxed);
+    metricsPrintf("splitflap_unit_calibration_seconds_total{unit=\"%u\"} %lu.%03lu\n", unit, (unsigned long)(ms / 1000), (unsigned long)(ms % 1000));
+  }
+
+  metricsHeader("unit_settle_seconds", "histogram", "Time from a move starting to the unit settling");
+  for (uint8_t unit = 0; unit < UNITCOUNT; unit++) {
+    uint32_t count = 0;
+    for (uint8_t bucket = 0; bucket <= METRICS_SETTLE_BUCKETS; bucket++) {
+      count += unitMetrics[unit].settleBuckets[bucket].load(std::memory_order_relaxed);
+      if (bucket < METRICS_SETTLE_BUCKETS) {
+        metricsPrintf("splitflap_unit_settle_seconds_bucket{unit=\"%u\",le=\"%lu.%03lu\"} %lu\n", unit, (unsigned long)(settleBucketMs[bucket] / 1000),
+                      (unsigned long)(settleBucketMs[bucket] % 1000), (unsigned long)count);
+      }
+      else {
+        metricsPrintf("splitflap_unit_settle_seconds_bucket{unit=\"%u\",le=\"+Inf\"} %lu\n", unit, (unsigned long)count);
+      }
+    }
+    uint32_t ms = unitMetrics[unit].settleMs.load(std::memory_order_relaxed);
+    metricsPrintf("splitflap_unit_settle_seconds_sum{unit=\"%u\"} %lu.%03lu\n", unit, (unsigned long)(ms / 1000), (unsigned long)(ms % 1000));
+    metricsPrintf("splitflap_unit_settle_seconds_count{unit=\"%u\"} %lu\n", unit, (unsigned long)count);
+  }
+
+  if (restartHistory != nullptr) {
+    metricsHeader("restarts_total", "counter", "Starts since power on, by reason");
+    for (uint8_t reason = 0; reason < RESTART_REASONS; reason++) {
+      metricsPrintf("splitflap_restarts_total{reason=\"%s\"} %lu\n", restartReasonNames[reason], (unsigned long)restartHistory->counts[reason]);
+    }
+    metricsHeader("last_restart", "gauge", "Why this start happened");
+    for (uint8_t reason = 0; reason < RESTART_REASONS; reason++) {
+      metricsPrintf("splitflap_last_restart{reason=\"%s\"} %d\n", restartReasonNames[reason], restartHistory->lastReason == reason ? 1 : 0);
+    }
+  }
+
+  HalI2cStats i2c;
+  halGetI2cStats(i2c);
+  metricsHeader("i2c_transactions_total", "counter", "Port expander transactions");
+  metricsPrintf("splitflap_i2c_transactions_total %lu\n", (unsigned long)i2c.transactions);
+  metricsHeader("i2c_bytes_total", "counter", "Port expander bytes transferred");
+  metricsPrintf("splitflap_i2c_bytes_total %lu\n", (unsigned long)i2c.bytes);
+
+  HalHeapStats heap;
+  halGetHeapStats(heap);
+  metricsHeader("heap_free_bytes", "gauge", "Free heap");
+  metricsPrintf("splitflap_heap_free_bytes %lu\n", (unsigned long)heap.freeBytes);
+  metricsHeader("heap_largest_free_block_bytes", "gauge", "Largest block that could be allocated");
+  metricsPrintf("splitflap_heap_largest_free_block_bytes %lu\n", (unsigned long)heap.largestFreeBlock);
+  metricsHeader("heap_minimum_free_bytes", "gauge", "Least free heap since boot");
+  metricsPrintf("splitflap_heap_minimum_free_bytes %lu\n", (unsigned long)heap.minimumFreeBytes);
+
+  HalTaskStats task;
+  metricsHeader("task_runs_total", "counter", "Passes of each task's work");
+  for (uint8_t i = 0; halGetTaskStats(i, task); i++) {
+    metricsPrintf("splitflap_task_runs_total{task=\"%s\"} %lu\n", task.name, (unsigned long)task.runs);
+  }
+  metricsHeader("task_busy_seconds_total", "counter", "Time each task has spent working");
+  for (uint8_t i = 0; halGetTaskStats(i, task); i++) {
+    metricsPrintf("splitflap_task_busy_seconds_total{task=\"%s\"} %lu.%03lu\n", task.name, (unsigned long)(task.busyMs / 1000), (unsigned long)(task.busyMs % 1000));
+  }
+  metricsHeader("task_longest_run_seconds", "gauge", "Longest single pass of each task's work");
+  for (uint8_t i = 0; halGetTaskStats(i, task); i++) {
+    metricsPrintf("splitflap_task_longest_run_seconds{task=\"%s\"} %lu.%06lu\n", task.name, (unsigned long)(task.longestUs / 1000000),
+                  (unsigned long)(task.longestUs % 1000000));
+  }
+
+  metricsHeader("uptime_seconds", "gauge", "Time since this start");
+  metricsPrintf("splitflap_uptime_seconds %lu\n", (unsigned long)(millis() / 1000));
+
+  if (metricsLength > 0) {
+    write(metricsBuffer, metricsLength);
+  }
+}
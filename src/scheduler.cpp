@@ -0,0 +1,142 @@
+#include "scheduler.h"
+
+static uint8_t motorBudget = MOTOR_BUDGET;
+
+void schedulerSetMotorBudget(uint8_t budget) {
+  motorBudget = min(max(budget, (uint8_t)1), (uint8_t)UNITCOUNT);
+}
+
+uint8_t schedulerMotorBudget() {
+  return motorBudget;
+}
+
+uint8_t schedulerMotorsEnabled(Unit* units[]) {
+  uint8_t enabled = 0;
+
+  for (uint8_t unit = 0; unit < UNITCOUNT; unit++) {
+    if (units[unit]->isMotorEnabled()) {
+      enabled++;
+    }
+  }
+  return enabled;
+}
+
+// Order unit numbers by decreasing move time (insertion sort, at most UNITCOUNT entries)
+static void sortLongestFirst(uint8_t order[], const uint32_t durations[], uint8_t count) {
+  for (uint8_t i = 1; i < count; i++) {
+    uint8_t unit = order[i];
+    int8_t j = i - 1;
+    while (j >= 0 && durations[order[j]] < durations[unit]) {
+      order[j + 1] = order[j];
+      j--;
+    }
+    order[j + 1] = unit;
+  }
+}
+
+// Finish time of longest-first list scheduling on motorBudget motors
+static uint32_t predictMakespan(const uint32_t durations[], uint8_t count) {
+  uint8_t order[UNITCOUNT];
+  uint32_t motorFree[UNITCOUNT] = {0};
+  uint32_t makespan = 0;
+
+  for (uint8_t unit = 0; unit < count; unit++) {
+    order[unit] = unit;
+  }
+  sortLongestFirst(order, durations, count);
+
+  for (uint8_t i = 0; i < count; i++) {
+    uint8_t motor = 0;
+    for (uint8_t m = 1; m < motorBudget; m++) {
+      if (motorFree[m] < motorFree[motor]) {
+        motor = m;
+      }
+    }
+    motorFree[motor] += durations[order[i]];
+    makespan = max(makespan, motorFree[motor]);
+  }
+  return makespan;
+}
+
+// Schedule a new display on the units, returning the predicted ms until it has landed
+uint32_t schedulerPlanDisplay(Unit* units[], const char* text, uint8_t length) {
+  return schedulerPlanDisplayAt(units, text, length, millis());
+}
+
+// Schedule a new display to land at landMillis, or as soon as it can if that's too soon.
+// Returns the predicted ms until it has landed.
+uint32_t schedulerPlanDisplayAt(Unit* units[], const char* text, uint8_t length, uint32_t landMillis) {
+  uint32_t durations[UNITCOUNT];
+  uint32_t longest = 0;
+  uint8_t moving = 0;
+  uint32_t nowMillis = millis();
+  int32_t untilLand = max((int32_t)(landMillis - nowMillis), (int32_t)0);
+
+  for (uint8_t unit = 0; unit < length; unit++) {
+    if (text[unit] == DISPLAY_KEEP_LETTER) {
+      durations[unit] = 0;
+      continue;
+    }
+    durations[unit] = units[unit]->moveDurationToLetter(text[unit]);
+    longest = max(longest, durations[unit]);
+    if (durations[unit] > 0) {
+      moving++;
+    }
+  }
+
+  // All can run at once: stagger the starts so every unit lands together. A unit with no
+  // duration is already there, or busy and can't be predicted, so it isn't held back.
+  if (moving <= motorBudget) {
+    uint32_t landsInMs = max(longest, (uint32_t)untilLand);
+    for (uint8_t unit = 0; unit < length; unit++) {
+      if (text[unit] != DISPLAY_KEEP_LETTER) {
+        uint32_t startMillis = (durations[unit] > 0) ? nowMillis + landsInMs - durations[unit] : nowMillis;
+        units[unit]->scheduleMoveToLetter(text[unit], startMillis);
+      }
+    }
+    return landsInMs;
+  }
+
+  // Otherwise all are due together, and schedulerStartMoves() runs them longest first
+  uint32_t makespan = predictMakespan(durations, length);
+  uint32_t startsInMs = max((int32_t)makespan, untilLand) - makespan;
+  for (uint8_t unit = 0; unit < length; unit++) {
+    if (text[unit] != DISPLAY_KEEP_LETTER) {
+      units[unit]->scheduleMoveToLetter(text[unit], nowMillis + startsInMs);
+    }
+  }
+  return startsInMs + makespan;
+}
+
+// Start any moves that are due, longest first, while motors are within the budget.
+// Units whose motor is already enabled, or have nothing to move, don't use up the budget.
+// Returns true if any move was started.
+boolean schedulerStartMoves(Unit* units[]) {
+  uint8_t order[UNITCOUNT];
+  uint32_t durations[UNITCOUNT];
+  uint8_t due = 0;
+  uint8_t enabled = schedulerMotorsEnabled(units);
+  boolean started = false;
+
+  for (uint8_t unit = 0; unit < UNITCOUNT; unit++) {
+    durations[unit] = units[unit]->scheduledDuration();
+    if (units[unit]->moveDue()) {
+      order[due++] = unit;
+    }
+  }
+  sortLongestFirst(order, durations, due);
+
+  for (uint8_t i = 0; i < due; i++) {
+    Unit* unit = units[order[i]];
+    boolean wasEnabled = unit->isMotorEnabled();
+
+    if (wasEnabled || durations[order[i]] == 0 || enabled < motorBudget) {
+      unit->startScheduledMove();
+      if (!wasEnabled && unit->isMotorEnabled()) {
+        enabled++;
+      }
+      started = true;
+    }
+  }
+  return started;
+}
@@ -0,0 +1,731 @@
+// Native implementation of the hardware abstraction layer (see hal.h), backed by a
+// simulated drum and hall-sensor model (see sim.h)
+
+#include <Arduino.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <malloc.h>
+#include <new>
+#include <map>
+#include <string>
+#include <vector>
+#include "hal.h"
+#include "unit.h"
+#include "system.h"
+#include "sim.h"
+
+static uint64_t simNowUs = 0;
+
+class SimStepper : public HalStepper {
+  public:
+    SimStepper(uint8_t unit, uint8_t enablePin);
+    void move(int32_t steps) override;
+    void moveTo(int32_t position) override;
+    void runForward() override;
+    void forceStop() override;
+    void forceStopAndNewPosition(int32_t position) override;
+    bool isRunning() override { return mode != IDLE; }
+    void setSpeedInUs(uint32_t speed_us) override { speedUs = speed_us; }
+    void setAcceleration(int32_t acceleration) override { accel = acceleration; }
+    int32_t getCurrentPosition() override { return position; }
+    int32_t getStoppingPosition() override;
+
+    void tick(uint32_t dt_us);
+    uint8_t hallValue();
+    uint8_t flapPosition();
+    void glitch(uint32_t us) { glitchUntilUs = simNowUs + us; }
+    void setHallDead(bool dead) { hallDead = dead; }
+    uint32_t reversalCount() { return reversals; }
+
+  private:
+    enum Mode { IDLE, MOVING, RUN_FORWARD };
+
+    uint8_t unitNum;
+    uint8_t enablePin;
+    Mode mode;
+    int32_t position;
+    int32_t target;
+    uint32_t speedUs;
+    int32_t accel;
+    double velocity; // steps per second
+    int8_t direction; // of the motion, 1 forward
+    bool overshooting; // slowing down past the target, to turn back to it
+    uint32_t reversals; // times the drum turned back part way through a move
+    double stepFraction;
+    double stepsPerRev;
+    double angle; // physical drum position in steps past the hall sensor edge
+    int32_t enableDelayUs;
+    int32_t disableDelayUs;
+    uint8_t slipCount;
+    uint64_t glitchUntilUs;
+    bool hallDead;
+
+    void start();
+    void stop();
+    void stepOnce(int8_t direction, bool slipping);
+};
+
+static SimStepper* simSteppers[UNITCOUNT];
+static uint8_t simStepperCount = 0;
+static HalStepper* (*simStepperFactory)(uint8_t unit) = nullptr;
+static uint16_t simEnableShadow[BOARDCOUNT];
+static uint16_t simEnableWritten[BOARDCOUNT]; // what each enable expander is actually outputting
+static bool simEnableBatch = false;
+static HalI2cStats simI2cStats;
+
+static bool simEnablePinWritten(uint8_t pin) {
+  return (simEnableWritten[pin / 16] & (1 << (pin % 16))) != 0;
+}
+
+// Each board's sensor expander
+typedef struct {
+  uint8_t portA;
+  uint8_t portB;
+  uint8_t capturedA; // INTCAP: ports latched when the interrupt was raised
+  uint8_t capturedB;
+  bool interruptPending;
+} SimSensorExpander;
+static SimSensorExpander simSensors[BOARDCOUNT];
+static void (*simSensorISR)(uint8_t board) = nullptr;
+// The real drums turn a little differently from FlapStep[], for the self-tuning to find
+static const int8_t simRevolutionError[] = {0, 3, 0, -5, 0, 0, 8, 0, 0, -2, 0, 0, 4, 0};
+// ... and each motor has its own limits, above which it slips (see SIM_SLIP_STEPS)
+static const uint16_t simPullOutUs[] = {1100, 1250, 1000, 1400, 1150, 1050, 1300, 1200, 1000, 1350, 1100, 1250, 1150, 1300};
+static const uint16_t simMaxAcceleration[] = {12000, 9000, 15000, 8000, 11000, 14000, 9000, 10000, 16000, 8500, 13000, 10000, 12000, 9500};
+static_assert(sizeof(simRevolutionError) >= UNITCOUNT, "simulated drums needed for every unit");
+static std::map<std::string, std::vector<uint8_t>> simStorage; // NVS, lost when the simulator exits
+static uint64_t simNetworkBeginUs = 0;
+static bool simNetworkStarted = false;
+static bool simRealTime = false;
+static uint64_t simRealStartUs = 0; // wall clock when simulated time was 0, in real time mode
+static int simGroupSocket = -1;
+static struct sockaddr_in simGroupAddress;
+static int simCommandSocket = -1;
+static struct sockaddr_in simCommandSender;
+
+#define SIM_MAX_TASKS 5
+typedef struct {
+  HalTaskStep step;
+  uint64_t wakeUs;
+  bool notified;
+  const char* name;
+  uint32_t runs;
+  uint64_t busyUs; // host time
+  uint32_t longestUs;
+} SimTask;
+static SimTask simTasks[SIM_MAX_TASKS];
+static uint8_t simTaskCount = 0;
+
+SimStepper::SimStepper(uint8_t unit, uint8_t pin) {
+  unitNum = unit;
+  enablePin = pin;
+  mode = IDLE;
+  position = 0;
+  target = 0;
+  speedUs = 1000;
+  accel = 1000;
+  velocity = 0;
+  direction = 1;
+  overshooting = false;
+  reversals = 0;
+  stepFraction = 0;
+  stepsPerRev = FlapStep[unitNum] * SIM_FLAPCOUNT + simRevolutionError[unitNum];
+  // deterministic but different starting position for each drum
+  angle = fmod(unitNum * 997.0 + 311.0, stepsPerRev);
+  enableDelayUs = 0;
+  disableDelayUs = -1;
+  slipCount = 0;
+  glitchUntilUs = 0;
+  hallDead = false;
+}
+
+void SimStepper::start() {
+  if (mode == IDLE) {
+    if (disableDelayUs < 0) {
+      halSetEnablePin(enablePin, true);
+      enableDelayUs = 1000; // matches setDelayToEnable() on the ESP32
+    }
+    disableDelayUs = -1;
+  }
+}
+
+void SimStepper::stop() {
+  mode = IDLE;
+  velocity = 0;
+  overshooting = false;
+  stepFraction = 0;
+  disableDelayUs = 2000; // matches setDelayToDisable() on the ESP32
+}
+
+void SimStepper::move(int32_t steps) {
+  if (steps == 0) {
+    return;
+  }
+  start();
+  target = (mode == MOVING) ? target + steps : position + steps;
+  mode = MOVING;
+}
+
+int32_t SimStepper::getStoppingPosition() {
+  int32_t steps = (int32_t)ceil((velocity * velocity) / (2.0 * accel));
+  int32_t toTarget = (target - position) * direction;
+  if (mode == MOVING && toTarget >= 0) {
+    steps = min(steps, toTarget);
+  }
+  return position + direction * steps;
+}
+
+void SimStepper::moveTo(int32_t newTarget) {
+  if (mode != MOVING && newTarget == position) {
+    return;
+  }
+  start();
+  target = newTarget;
+  mode = MOVING;
+}
+
+void SimStepper::runForward() {
+  start();
+  mode = RUN_FORWARD;
+}
+
+void SimStepper::forceStop() {
+  target = position;
+  stop();
+}
+
+void SimStepper::forceStopAndNewPosition(int32_t newPosition) {
+  position = newPosition;
+  target = newPosition;
+  stop();
+}
+
+void SimStepper::stepOnce(int8_t direction, bool slipping) {
+  position += direction;
+  // past its limits the rotor loses some steps: the count moves on but the drum doesn't
+  if (slipping && ++slipCount >= SIM_SLIP_STEPS) {
+    slipCount = 0;
+    return;
+  }
+  angle += direction;
+  if (angle >= stepsPerRev) angle -= stepsPerRev;
+  if (angle < 0) angle += stepsPerRev;
+}
+
+void SimStepper::tick(uint32_t dt_us) {
+  if (mode == IDLE) {
+    if (disableDelayUs >= 0) {
+      disableDelayUs -= dt_us;
+      if (disableDelayUs < 0) {
+        halSetEnablePin(enablePin, false);
+      }
+    }
+    return;
+  }
+
+  // as on the ESP32, the delay only starts once the enable has been written out
+  if (enableDelayUs > 0) {
+    if (simEnablePinWritten(enablePin)) {
+      enableDelayUs -= dt_us;
+    }
+    return;
+  }
+
+  if (mode == MOVING && position == target && !overshooting) {
+    stop();
+    return;
+  }
+
+  double dt = dt_us / 1000000.0;
+  double maxVelocity = 1000000.0 / speedUs;
+  int8_t towards = (mode == MOVING && target < position) ? -1 : 1;
+  if (velocity == 0) {
+    direction = towards;
+  }
+  int32_t remaining = (mode == MOVING) ? (target - position) * direction : INT32_MAX; // negative once behind
+  double stoppingSteps = (velocity * velocity) / (2.0 * accel);
+  double lastVelocity = velocity;
+  // as FastAccelStepper does, a target too close to stop at is overshot, then come back to
+  if (direction != towards || (mode == MOVING && stoppingSteps > remaining + SIM_OVERSHOOT_STEPS)) {
+    overshooting = true;
+  }
+  else if (stoppingSteps <= remaining) {
+    overshooting = false; // a new target it can reach
+  }
+
+  if (overshooting) {
+    velocity = fmax(velocity - accel * dt, 0.0);
+    if (velocity == 0) {
+      direction = towards;
+      overshooting = false;
+      reversals++;
+    }
+  }
+  else if (mode == MOVING && remaining <= stoppingSteps) {
+    velocity = fmax(velocity - accel * dt, 50.0);
+  }
+  else {
+    velocity = fmin(velocity + accel * dt, maxVelocity);
+  }
+  bool slipping = velocity > 1000000.0 / simPullOutUs[unitNum] ||
+                  (velocity != lastVelocity && accel > simMaxAcceleration[unitNum]);
+
+  stepFraction += velocity * dt;
+  while (stepFraction >= 1.0) {
+    stepFraction -= 1.0;
+    if (mode == MOVING) {
+      stepOnce(direction, slipping);
+      if (position == target && !overshooting) {
+        stop();
+        break;
+      }
+    }
+    else {
+      stepOnce(1, slipping);
+    }
+  }
+}
+
+uint8_t SimStepper::hallValue() {
+  if (hallDead) {
+    return 1;
+  }
+  return (angle < SIM_HALL_WIDTH || simNowUs < glitchUntilUs) ? 0 : 1;
+}
+
+uint8_t SimStepper::flapPosition() {
+  double flap = (angle - calOffsetUnit[unitNum]) / (stepsPerRev / SIM_FLAPCOUNT);
+  int32_t nearest = (int32_t)floor(flap + 0.5);
+  return ((nearest % SIM_FLAPCOUNT) + SIM_FLAPCOUNT) % SIM_FLAPCOUNT;
+}
+
+// Recompute the sensor expander ports and raise each board's interrupt on any change
+static void simUpdateSensors() {
+  uint16_t ports[BOARDCOUNT];
+
+  for (uint8_t board = 0; board < BOARDCOUNT; board++) {
+    ports[board] = 0xFFFF;
+  }
+  for (uint8_t unit = 0; unit < simStepperCount; unit++) {
+    if (simSteppers[unit]->hallValue() == 0) {
+      ports[unitRegistry[unit].board] &= ~(1 << unitRegistry[unit].sensorBit);
+    }
+  }
+
+  for (uint8_t board = 0; board < BOARDCOUNT; board++) {
+    SimSensorExpander& sensor = simSensors[board];
+    uint8_t portA = ports[board] & 0xFF;
+    uint8_t portB = ports[board] >> 8;
+
+    if (portA != sensor.portA || portB != sensor.portB) {
+      sensor.portA = portA;
+      sensor.portB = portB;
+      // INT output stays asserted until the ports are read, like the MCP23017
+      if (!sensor.interruptPending && simSensorISR != nullptr) {
+        sensor.interruptPending = true;
+        sensor.capturedA = portA;
+        sensor.capturedB = portB;
+        simSensorISR(board);
+      }
+    }
+  }
+}
+
+void simAdvance(uint32_t us) {
+  while (us > 0) {
+    uint32_t dt = (us < SIM_TICK_US) ? us : SIM_TICK_US;
+    for (uint8_t unit = 0; unit < simStepperCount; unit++) {
+      simSteppers[unit]->tick(dt);
+    }
+    simUpdateSensors();
+    simNowUs += dt;
+    us -= dt;
+  }
+}
+
+static uint64_t simWallClockUs() {
+  struct timespec now;
+
+  clock_gettime(CLOCK_REALTIME, &now);
+  return (uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+// Run the firmware tasks for a period of simulated time. Scheduling is cooperative: a task
+// runs whenever it has been notified or its requested wait has expired.
+void simRun(uint32_t us) {
+  uint64_t endUs = simNowUs + us;
+
+  while (simNowUs < endUs) {
+    for (uint8_t task = 0; task < simTaskCount; task++) {
+      if (simTasks[task].notified || simNowUs >= simTasks[task].wakeUs) {
+        simTasks[task].notified = false;
+        uint64_t startUs = simWallClockUs();
+        uint32_t waitMs = simTasks[task].step();
+        uint32_t busyUs = simWallClockUs() - startUs;
+        simTasks[task].runs++;
+        simTasks[task].busyUs += busyUs;
+        simTasks[task].longestUs = max(simTasks[task].longestUs, busyUs);
+        simTasks[task].wakeUs = simNowUs + waitMs * 1000ULL;
+      }
+    }
+    simAdvance(SIM_TICK_US);
+
+    if (simRealTime) {
+      uint64_t wallUs = simWallClockUs() - simRealStartUs;
+      if (simNowUs > wallUs + 1000) {
+        usleep(simNowUs - wallUs);
+      }
+    }
+  }
+}
+
+// Keep simulated time from running ahead of the wall clock
+void simSetRealTime(bool realTime) {
+  simRealTime = realTime;
+  simRealStartUs = simWallClockUs() - simNowUs;
+}
+
+uint64_t simMicros() {
+  return simNowUs;
+}
+
+// Move time straight on, without simulating what happens meanwhile (never backwards)
+void simSetClock(uint64_t us) {
+  if (us > simNowUs) {
+    simNowUs = us;
+  }
+}
+
+uint8_t simFlapPosition(uint8_t unit) {
+  return simSteppers[unit]->flapPosition();
+}
+
+uint32_t simReversals(uint8_t unit) {
+  return simSteppers[unit]->reversalCount();
+}
+
+char simDisplayedLetter(uint8_t unit) {
+  return letters[simFlapPosition(unit)];
+}
+
+// A spurious pulse on the unit's hall sensor, as from electrical noise
+void simHallGlitch(uint8_t unit, uint32_t us) {
+  simSteppers[unit]->glitch(us);
+}
+
+// The unit's hall sensor stops seeing the magnet, as if unplugged
+void simHallDead(uint8_t unit, bool dead) {
+  simSteppers[unit]->setHallDead(dead);
+}
+
+uint8_t simEnabledSteppers() {
+  uint8_t enabled = 0;
+  for (uint8_t board = 0; board < BOARDCOUNT; board++) {
+    enabled += __builtin_popcount(simEnableWritten[board]);
+  }
+  return enabled;
+}
+
+// Steppers connected from now on come from factory instead of the drum model (nullptr to go back)
+void simSetStepperFactory(HalStepper* (*factory)(uint8_t unit)) {
+  simStepperFactory = factory;
+}
+
+void halSteppersInit() {
+  simStepperCount = 0;
+}
+
+HalStepper* halStepperConnect(uint8_t stepPin, uint8_t enablePin) {
+  uint8_t unit = 0;
+  while (unit < UNITCOUNT - 1 && unitRegistry[unit].stepPin != stepPin) {
+    unit++;
+  }
+  if (simStepperFactory != nullptr) {
+    return simStepperFactory(unit);
+  }
+  simSteppers[unit] = new SimStepper(unit, enablePin);
+  if (unit >= simStepperCount) {
+    simStepperCount = unit + 1;
+  }
+  return simSteppers[unit];
+}
+
+void halExpandersInit() {
+  for (uint8_t board = 0; board < BOARDCOUNT; board++) {
+    simEnableShadow[board] = 0;
+    simEnableWritten[board] = 0;
+    simSensors[board] = {0xFF, 0xFF, 0xFF, 0xFF, false};
+  }
+}
+
+// Bus traffic is counted exactly as the ESP32 implementation would generate it
+static void simWriteEnableShadow(uint8_t board) {
+  simEnableWritten[board] = simEnableShadow[board];
+  simI2cStats.transactions++;
+  simI2cStats.bytes += 3;
+}
+
+void halSetEnablePin(uint8_t pin, bool enabled) {
+  uint8_t board = pin / 16;
+
+  if (enabled) {
+    simEnableShadow[board] |= (1 << (pin % 16));
+  }
+  else {
+    simEnableShadow[board] &= ~(1 << (pin % 16));
+  }
+  if (simEnableShadow[board] != simEnableWritten[board] && !simEnableBatch) {
+    simWriteEnableShadow(board);
+  }
+}
+
+bool halEnablePinSet(uint8_t pin) {
+  return (simEnableShadow[pin / 16] & (1 << (pin % 16))) != 0;
+}
+
+void halEnableBatchBegin() {
+  simEnableBatch = true;
+}
+
+void halEnableBatchEnd() {
+  simEnableBatch = false;
+  for (uint8_t board = 0; board < BOARDCOUNT; board++) {
+    if (simEnableShadow[board] != simEnableWritten[board]) {
+      simWriteEnableShadow(board);
+    }
+  }
+}
+
+void halReadSensorPorts(uint8_t board, HalSensorPorts &ports) {
+  SimSensorExpander& sensor = simSensors[board];
+
+  sensor.interruptPending = false;
+  ports.capturedA = sensor.capturedA;
+  ports.capturedB = sensor.capturedB;
+  ports.portA = sensor.portA;
+  ports.portB = sensor.portB;
+  simI2cStats.transactions++;
+  simI2cStats.bytes += 5;
+}
+
+void halGetI2cStats(HalI2cStats &stats) {
+  stats = simI2cStats;
+}
+
+void halAttachSensorInterrupt(void (*isr)(uint8_t board)) {
+  simSensorISR = isr;
+  simUpdateSensors();
+  for (uint8_t board = 0; board < BOARDCOUNT; board++) {
+    simSensors[board].interruptPending = false;
+  }
+}
+
+void halNetworkBegin(const char* ssid, const char* password) {
+  simNetworkBeginUs = simNowUs;
+  simNetworkStarted = true;
+}
+
+bool halNetworkConnected() {
+  return simNetworkStarted && (simNowUs - simNetworkBeginUs) >= SIM_NETWORK_CONNECT_MS * 1000ULL;
+}
+
+void halNetworkLocalIP(char* buffer, uint8_t size) {
+  strncpy(buffer, "127.0.0.1", size);
+  buffer[size - 1] = '\0';
+}
+
+// The group is joined on the loopback interface, so only simulators on this machine hear it
+bool halGroupBegin(const char* address, uint16_t port) {
+  struct sockaddr_in local = {};
+  struct ip_mreq membership = {};
+  struct in_addr loopback;
+  int reuse = 1;
+
+  simGroupSocket = socket(AF_INET, SOCK_DGRAM, 0);
+  if (simGroupSocket < 0) {
+    return false;
+  }
+  local.sin_family = AF_INET;
+  local.sin_port = htons(port);
+  local.sin_addr.s_addr = htonl(INADDR_ANY);
+  simGroupAddress = local;
+  inet_pton(AF_INET, address, &simGroupAddress.sin_addr);
+  inet_pton(AF_INET, "127.0.0.1", &loopback);
+  membership.imr_multiaddr = simGroupAddress.sin_addr;
+  membership.imr_interface = loopback;
+
+  setsockopt(simGroupSocket, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+  setsockopt(simGroupSocket, SOL_SOCKET, SO_REUSEPORT, &reuse, sizeof(reuse));
+  if (bind(simGroupSocket, (struct sockaddr*)&local, sizeof(local)) < 0 ||
+      setsockopt(simGroupSocket, IPPROTO_IP, IP_ADD_MEMBERSHIP, &membership, sizeof(membership)) < 0 ||
+      setsockopt(simGroupSocket, IPPROTO_IP, IP_MULTICAST_IF, &loopback, sizeof(loopback)) < 0) {
+    close(simGroupSocket);
+    simGroupSocket = -1;
+    return false;
+  }
+  fcntl(simGroupSocket, F_SETFL, O_NONBLOCK);
+  return true;
+}
+
+bool halGroupSend(const void* data, size_t size) {
+  return simGroupSocket >= 0 &&
+         sendto(simGroupSocket, data, size, 0, (struct sockaddr*)&simGroupAddress, sizeof(simGroupAddress)) == (ssize_t)size;
+}
+
+size_t halGroupReceive(void* data, size_t size) {
+  if (simGroupSocket < 0) {
+    return 0;
+  }
+  // MSG_TRUNC gives the real length, so anything longer than the buffer can be dropped
+  ssize_t length = recv(simGroupSocket, data, size, MSG_TRUNC);
+  return (length > 0 && (size_t)length <= size) ? length : 0;
+}
+
+// Only listens on loopback, for clients on this machine
+bool halCommandBegin(uint16_t port) {
+  struct sockaddr_in local = {};
+  int reuse = 1;
+
+  simCommandSocket = socket(AF_INET, SOCK_DGRAM, 0);
+  if (simCommandSocket < 0) {
+    return false;
+  }
+  local.sin_family = AF_INET;
+  local.sin_port = htons(port);
+  local.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  setsockopt(simCommandSocket, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+  if (bind(simCommandSocket, (struct sockaddr*)&local, sizeof(local)) < 0) {
+    close(simCommandSocket);
+    simCommandSocket = -1;
+    return false;
+  }
+  fcntl(simCommandSocket, F_SETFL, O_NONBLOCK);
+  return true;
+}
+
+size_t halCommandReceive(void* data, size_t size) {
+  socklen_t senderSize = sizeof(simCommandSender);
+
+  if (simCommandSocket < 0) {
+    return 0;
+  }
+  ssize_t length = recvfrom(simCommandSocket, data, size, 0, (struct sockaddr*)&simCommandSender, &senderSize);
+  return (length > 0 && (size_t)length < size) ? length : 0;
+}
+
+bool halCommandReply(const void* data, size_t size) {
+  return simCommandSocket >= 0 &&
+         sendto(simCommandSocket, data, size, 0, (struct sockaddr*)&simCommandSender, sizeof(simCommandSender)) == (ssize_t)size;
+}
+
+uint64_t halEpochMillis() {
+  if (simRealTime) {
+    return (simRealStartUs + simNowUs) / 1000;
+  }
+  return SIM_EPOCH * 1000ULL + simNowUs / 1000;
+}
+
+uint8_t halStartTask(const char* name, HalTaskStep step, uint8_t core, uint8_t priority) {
+  simTasks[simTaskCount] = {step, simNowUs, true, name, 0, 0, 0};
+  return simTaskCount++;
+}
+
+bool halGetTaskStats(uint8_t task, HalTaskStats &stats) {
+  if (task >= simTaskCount) {
+    return false;
+  }
+  stats.name = simTasks[task].name;
+  stats.runs = simTasks[task].runs;
+  stats.busyMs = simTasks[task].busyUs / 1000;
+  stats.longestUs = simTasks[task].longestUs;
+  return true;
+}
+
+void halNotifyTask(uint8_t task) {
+  simTasks[task].notified = true;
+}
+
+void halNotifyTaskFromISR(uint8_t task) {
+  simTasks[task].notified = true;
+}
+
+bool halStorageRead(const char* key, void* data, size_t size) {
+  auto entry = simStorage.find(key);
+  if (entry == simStorage.end() || entry->second.size() != size) {
+    return false;
+  }
+  memcpy(data, entry->second.data(), size);
+  return true;
+}
+
+bool halStorageWrite(const char* key, const void* data, size_t size) {
+  const uint8_t* bytes = (const uint8_t*)data;
+  simStorage[key] = std::vector<uint8_t>(bytes, bytes + size);
+  return true;
+}
+
+// Every C++ allocation in the simulator is counted, against a heap the size of the ESP32's
+static uint32_t simAllocations = 0;
+static size_t simHeapUsed = 0;
+static size_t simHeapPeak = 0;
+
+// GCC takes free() in the replacement operator delete for a mismatch with operator new
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+
+void* operator new(size_t size) {
+  void* block = malloc(size > 0 ? size : 1);
+  if (block == nullptr) {
+    throw std::bad_alloc();
+  }
+  simAllocations++;
+  simHeapUsed += malloc_usable_size(block);
+  simHeapPeak = simHeapUsed > simHeapPeak ? simHeapUsed : simHeapPeak;
+  return block;
+}
+
+void* operator new[](size_t size) {
+  return operator new(size);
+}
+
+void operator delete(void* block) noexcept {
+  if (block != nullptr) {
+    simHeapUsed -= malloc_usable_size(block);
+    free(block);
+  }
+}
+
+void operator delete[](void* block) noexcept {
+  operator delete(block);
+}
+
+void operator delete(void* block, size_t size) noexcept {
+  operator delete(block);
+}
+
+void operator delete[](void* block, size_t size) noexcept {
+  operator delete(block);
+}
+
+#pragma GCC diagnostic pop
+
+void halGetHeapStats(HalHeapStats &stats) {
+  stats.freeBytes = simHeapUsed < SIM_HEAP_BYTES ? SIM_HEAP_BYTES - simHeapUsed : 0;
+  stats.largestFreeBlock = stats.freeBytes; // fragmentation isn't simulated
+  stats.minimumFreeBytes = simHeapPeak < SIM_HEAP_BYTES ? SIM_HEAP_BYTES - simHeapPeak : 0;
+  stats.allocations = simAllocations;
+}
+
+void halRestart() {
+  printf("Simulated controller requested a restart at %lu ms\n", (unsigned long)millis());
+  exit(2);
+}
+
+void halSleep() {
+  exit(0);
+}
@@ -0,0 +1,35 @@
+#include <stdarg.h>
+#include "Arduino.h"
+#include "../sim.h"
+
+SimSerial Serial;
+
+int SimSerial::printf(const char* format, ...) {
+  va_list args;
+  va_start(args, format);
+  int written = vfprintf(stderr, format, args);
+  va_end(args);
+  return written;
+}
+
+uint32_t millis() {
+  return (uint32_t)(simMicros() / 1000);
+}
+
+uint32_t micros() {
+  return (uint32_t)simMicros();
+}
+
+// Blocking delays in the firmware simply let simulated time pass
+void delay(uint32_t ms) {
+  simAdvance(ms * 1000);
+}
+
+void delayMicroseconds(uint32_t us) {
+  simAdvance(us);
+}
+
+// Deterministic sequence so simulator runs are repeatable
+long random(long howbig) {
+  return howbig > 0 ? rand() % howbig : 0;
+}
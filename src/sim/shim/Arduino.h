@@ -0,0 +1,89 @@
+#pragma once
+
+// Minimal Arduino core stand-in for the native simulator build ([env:native]).
+// Only the parts of the Arduino API used by the firmware are provided; time is the
+// simulator's virtual clock (see src/sim/hal_sim.cpp).
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <string>
+#include <algorithm>
+
+using std::min;
+using std::max;
+
+typedef bool boolean;
+
+#define IRAM_ATTR
+#define RTC_NOINIT_ATTR
+#define PROGMEM
+#define F(x) (x)
+
+uint32_t millis();
+uint32_t micros();
+void delay(uint32_t ms);
+void delayMicroseconds(uint32_t us);
+long random(long howbig);
+
+class String {
+  public:
+    String() {}
+    String(const char* s) : str(s ? s : "") {}
+    String(char c) : str(1, c) {}
+    String(const std::string& s) : str(s) {}
+
+    const char* c_str() const { return str.c_str(); }
+    unsigned int length() const { return str.length(); }
+    char charAt(unsigned int index) const { return index < str.length() ? str[index] : 0; }
+    long toInt() const { return atol(str.c_str()); }
+
+    String substring(unsigned int from, unsigned int to) const {
+      if (from >= str.length()) return String();
+      return String(str.substr(from, to - from));
+    }
+
+    void toUpperCase() {
+      for (auto &c : str) {
+        if (c >= 'a' && c <= 'z') c -= 32;
+      }
+    }
+
+    void replace(const String& find, const String& with) {
+      if (find.str.empty()) return;
+      size_t pos = 0;
+      while ((pos = str.find(find.str, pos)) != std::string::npos) {
+        str.replace(pos, find.str.length(), with.str);
+        pos += with.str.length();
+      }
+    }
+
+    String& operator+=(const String& rhs) { str += rhs.str; return *this; }
+    String& operator+=(const char* rhs) { str += rhs; return *this; }
+    String& operator+=(char rhs) { str += rhs; return *this; }
+    bool operator==(const char* rhs) const { return str == rhs; }
+    bool operator==(const String& rhs) const { return str == rhs.str; }
+    friend String operator+(const String& lhs, const String& rhs) { return String(lhs.str + rhs.str); }
+
+  private:
+    std::string str;
+};
+
+// Serial output goes to stderr so the simulator's own report on stdout stays readable
+class SimSerial {
+  public:
+    void begin(unsigned long) {}
+    int available() { return 0; }
+    String readStringUntil(char) { return String(); }
+    void print(const char* s) { fputs(s, stderr); }
+    void print(const String& s) { fputs(s.c_str(), stderr); }
+    void print(long n) { fprintf(stderr, "%ld", n); }
+    void println(const char* s) { fprintf(stderr, "%s\n", s); }
+    void println(const String& s) { fprintf(stderr, "%s\n", s.c_str()); }
+    void println(long n) { fprintf(stderr, "%ld\n", n); }
+    int printf(const char* format, ...) __attribute__((format(printf, 2, 3)));
+};
+
+extern SimSerial Serial;
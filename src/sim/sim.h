@@ -0,0 +1,48 @@
+#pragma once
+
+// Drum and hall-sensor simulator used by the native build ([env:native]).
+//
+// Each unit is modelled as a stepper with trapezoidal acceleration turning a drum of
+// about FlapStep[unit] * SIM_FLAPCOUNT steps per revolution (a few units are deliberately
+// a few steps off, as real drums are). As with FastAccelStepper, a new target closer than the
+// motor can stop in is overshot and then driven back to. Each motor also has its own pull-out speed and
+// acceleration limit, past which it loses one step in SIM_SLIP_STEPS. The hall sensor is
+// active (reads 0) for SIM_HALL_WIDTH steps after the magnet passes, and the blank flap is showing
+// calOffsetUnit[unit] steps after the sensor edge, matching the real cabinet.
+// Time only moves when simAdvance() is called (or the firmware calls delay()). In real time
+// mode it is also held back to the wall clock, which is then the NTP time, so several
+// simulator processes can run as a display group over loopback (see sync.h).
+
+#include <stdint.h>
+#include "drum.h"
+#include "hal.h"
+
+#define SIM_FLAPCOUNT FLAPCOUNT // the simulated cabinet is fitted with the configured drums
+#define SIM_HALL_WIDTH 120 // steps the hall sensor stays active per revolution
+#define SIM_SLIP_STEPS 4 // steps per step lost when a motor is driven past its limits
+#define SIM_TICK_US 50 // resolution of the motion model
+#define SIM_OVERSHOOT_STEPS 2 // a target this much inside the stopping distance is still landed on
+#define SIM_NETWORK_CONNECT_MS 2500 // simulated WiFi association time
+#define SIM_NTP_SYNC_MS 800 // simulated time from startNTP() to the clock being set
+#define SIM_EPOCH 1735689600 // 2025-01-01 00:00:00, simulated time starts here
+#define SIM_HEAP_BYTES 300000 // roughly what an ESP32 has free once WiFi is up
+
+void simAdvance(uint32_t us);
+void simRun(uint32_t us);
+uint64_t simMicros();
+uint8_t simFlapPosition(uint8_t unit);
+char simDisplayedLetter(uint8_t unit);
+uint32_t simReversals(uint8_t unit);
+uint8_t simEnabledSteppers();
+void simHallGlitch(uint8_t unit, uint32_t us);
+void simHallDead(uint8_t unit, bool dead);
+void simSetRealTime(bool realTime);
+void simSetClock(uint64_t us);
+void simSetStepperFactory(HalStepper* (*factory)(uint8_t unit));
+
+// Event trace replay (see sim_replay.cpp): 0 if the Unit code did what the trace recorded
+int simReplayTrace(const char* path);
+
+// Simulated API requests (see sim_system.cpp)
+void simPostDisplay(const char* text);
+bool simRequestPending();
@@ -0,0 +1,678 @@
+/* Native simulator entry point ([env:native])
+ *
+ * Runs the real setup(), firmware tasks and Unit code against the simulated drums, posting a
+ * scripted sequence of display updates through the API path and reporting how long each
+ * takes from request to settled drums in simulated time. Runs deterministically and much faster than real time.
+ *
+ *   pio run -e native && .pio/build/native/program [text ...] 2>/dev/null
+ *
+ * With --group leader|follower <column> <sign width> it runs in real time as one controller of a
+ * display group instead (see sync.h), reporting when each group frame landed by the wall clock.
+ * tools/sim_group.py runs a leader and followers together on loopback and compares them.
+ *
+ * With --udp it runs in real time taking binary commands on loopback (see udp_api.h) until it
+ * is sent SIGTERM, then reports what the drums show. tools/udp_client.py test drives it.
+ *
+ * With --metrics it plays the built-in script, with some hall sensor glitches, then prints what
+ * GET /metrics would return (see metrics.h).
+ *
+ * With --record <file> it homes and shows two messages, with hall sensor glitches, and writes
+ * the event trace to the file as GET /trace would return it. With --replay <file> it replays a
+ * trace (recorded here or downloaded from a controller) against the Unit code, and reports any
+ * difference (see trace.h). tools/trace.py test does both.
+ *
+ * The default run ends with one unit's hall sensor failing, checking that unit is taken out of
+ * service while the rest carry on.
+ *
+ * Debug output from the firmware goes to stderr, the report goes to stdout.
+*/
+
+#include <Arduino.h>
+#include <math.h>
+#include <signal.h>
+#include "system.h"
+#include "unit.h"
+#include "sim.h"
+#include "boot.h"
+#include "frames.h"
+#include "scheduler.h"
+#include "sync.h"
+#include "hal.h"
+#include "metrics.h"
+#include "trace.h"
+
+#define SIM_RUN_US 100 // granularity of checking for the display to settle
+#define SIM_TIMEOUT_MS 120000
+#define SIM_IDLE_GAP_MS 1000 // time the display is left showing each message
+
+void setup();
+extern Unit *splitFlap[UNITCOUNT];
+extern uint8_t word_updates_per_hour;
+
+static const char* defaultScript[] = {"HELLO WORLD", "SPLIT-FLAP", "ABCDEFGHIJKL", "  12:34  ", "ZZZZZZZZZZZZ", "AAAAAAAAAAAA", "$&#0123456789", ""};
+static const char* frameScript[] = {"THREE", "TWO", "ONE", "LIFT OFF"}; // queued as a sequence, the last a barrier
+#define SIM_FRAME_HOLD_MS 500
+#define SIM_BARRIER_MAX_SPREAD_MS 100 // the last frame lands together
+static const uint8_t budgetSweep[] = {UNITCOUNT, 6, 4, 3, 2, 1}; // motor budgets to benchmark
+#define SIM_BUDGET_FROM "AAAAAAAAAAAA"
+#define SIM_BUDGET_TO "Z9Y8X7W6V5U4"
+#define SIM_GLITCH_TEXT "GLITCH PROOF"
+#define SIM_GLITCH_AFTER_MS 400 // into the update
+#define SIM_GLITCH_US 2000 // length of each spurious sensor pulse
+static const uint8_t glitchUnits[] = {0, 3, 6, 9};
+#define SIM_WRAP_FLAPS 3 // the last flaps on the drum, moved from to the first letter
+#define SIM_SUPERSEDE_AFTER_MS 400 // into a long move, at full speed, when another letter is asked for
+#define SIM_SOAK_UPDATES 300 // random updates in a row, checking the drums never drift
+#define SIM_DRIFT_DRUMS 64 // random drum geometries, each checked over SIM_DRIFT_MOVES flap targets
+#define SIM_DRIFT_MOVES 100000
+#define SIM_DRIFT_STOPPING_STEPS 64 // most a moving drum is planned ahead of where it is
+#define SIM_FAULT_UNIT 5 // its hall sensor dies
+#define SIM_FAULT_MAX_UPDATES 40
+#define SIM_FAULT_AFTER_UPDATES 3 // carried on with once the unit is disabled
+static const char* groupScript[] = {"SPLIT-FLAP CABINETS LANDING TOGETHER", "ABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789", "HELLO FROM THE WHOLE SIGN", ""};
+#define SIM_GROUP_JOIN_MS 3000 // leader waits this long after homing, for the followers to home
+
+static uint8_t simIgnoredUnit = UNITCOUNT; // not waited for, while out of service
+
+static boolean simDisplaySettled() {
+  if (!frameQueueEmpty()) {
+    return false;
+  }
+  for (uint8_t unit = 0; unit < UNITCOUNT; unit++) {
+    if (unit != simIgnoredUnit && !splitFlap[unit]->isSettled()) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static uint32_t simLandingSpread = 0; // between the first and last unit to stop, for the last update
+static uint8_t simPeakMotors = 0; // most steppers enabled at once, for the last update
+static uint32_t simLastStopMillis = 0; // when the last unit to move stopped, for the last update
+
+// Run the firmware until any request is taken and every unit has settled, returning elapsed simulated ms
+static uint32_t simRunUntilSettled() {
+  uint32_t startMillis = millis();
+  uint32_t stoppedMillis[UNITCOUNT];
+  boolean moved[UNITCOUNT] = {false};
+
+  simPeakMotors = 0;
+
+  // let the tasks pick up the new work before testing for idle
+  simRun(SIM_RUN_US);
+  while ((simRequestPending() || !commandQueue.empty() || !simDisplaySettled()) && millis() - startMillis < SIM_TIMEOUT_MS) {
+    for (uint8_t unit = 0; unit < UNITCOUNT; unit++) {
+      if (splitFlap[unit]->checkIfRunning()) {
+        moved[unit] = true;
+        stoppedMillis[unit] = millis();
+      }
+    }
+    simPeakMotors = max(simPeakMotors, simEnabledSteppers());
+    simRun(SIM_RUN_US);
+  }
+
+  uint32_t firstStop = UINT32_MAX;
+  uint32_t lastStop = 0;
+  for (uint8_t unit = 0; unit < UNITCOUNT; unit++) {
+    if (moved[unit]) {
+      firstStop = min(firstStop, stoppedMillis[unit]);
+      lastStop = max(lastStop, stoppedMillis[unit]);
+    }
+  }
+  simLandingSpread = (lastStop >= firstStop) ? lastStop - firstStop : 0;
+  simLastStopMillis = lastStop;
+  return millis() - startMillis;
+}
+
+// Leave the display idle for a while, as between real updates
+static void simRunIdle(uint32_t ms) {
+  uint32_t startMillis = millis();
+  while (millis() - startMillis < ms) {
+    simRun(SIM_RUN_US);
+  }
+}
+
+// Compare what the drums physically show against the requested text
+static uint8_t simCountWrongLetters(const char* text) {
+  uint8_t wrong = 0;
+  size_t length = strlen(text);
+  for (uint8_t unit = 0; unit < UNITCOUNT; unit++) {
+    if (unit == simIgnoredUnit) {
+      continue;
+    }
+    char expected = (unit < length) ? text[unit] : ' ';
+    // characters not on the drum are shown as blank
+    if (flapForChar(expected) == FLAP_UNKNOWN) {
+      expected = ' ';
+    }
+    if (simDisplayedLetter(unit) != expected) {
+      wrong++;
+    }
+  }
+  return wrong;
+}
+
+// Wait (in simulated time) for the motion task to be given a display
+static boolean simWaitForDisplay(uint32_t timeoutMs) {
+  uint32_t startMillis = millis();
+
+  while (millis() - startMillis < timeoutMs) {
+    if (!commandQueue.empty()) {
+      return true;
+    }
+    for (uint8_t unit = 0; unit < UNITCOUNT; unit++) {
+      if (splitFlap[unit]->moveScheduled()) {
+        return true;
+      }
+    }
+    simRun(SIM_RUN_US);
+  }
+  return false;
+}
+
+// One controller of a display group, in real time. The leader posts groupScript, followers
+// take it from the group, and each reports the wall clock time its units landed.
+static int simRunGroup(uint8_t role, uint8_t column, uint8_t width) {
+  uint8_t totalWrong = 0;
+
+  syncConfigure(role, column, width);
+  simSetRealTime(true);
+  word_updates_per_hour = 0;
+  setup();
+  simRunUntilSettled();
+  if (role == SYNC_ROLE_LEADER) {
+    simRunIdle(SIM_GROUP_JOIN_MS);
+  }
+
+  for (uint8_t i = 0; groupScript[i][0] != '\0'; i++) {
+    if (role == SYNC_ROLE_LEADER) {
+      simPostDisplay(groupScript[i]);
+    }
+    else if (!simWaitForDisplay(SIM_TIMEOUT_MS)) {
+      printf("group: no frame from the leader\n");
+      return 1;
+    }
+    simRunUntilSettled();
+
+    char display[SIGN_MAX_COLUMNS + 1];
+    padToFullWidth(groupScript[i], display, sizeof(display));
+    upperCaseText(display);
+    const char* columns = syncColumns(display);
+    uint8_t wrong = simCountWrongLetters(columns);
+    uint64_t landedEpochMs = halEpochMillis() - (millis() - simLastStopMillis);
+    printf("group %u: [%-*.*s] landed at %llu ms, landing spread %4lu ms%s\n", i, UNITCOUNT, UNITCOUNT, columns,
+           (unsigned long long)landedEpochMs, (unsigned long)simLandingSpread, wrong ? "  MISMATCH" : "");
+    fflush(stdout);
+    totalWrong += wrong;
+
+    // give the followers time to finish with this frame before the next
+    if (role == SYNC_ROLE_LEADER) {
+      simRunIdle(SIM_IDLE_GAP_MS);
+    }
+  }
+  return totalWrong ? 1 : 0;
+}
+
+static volatile sig_atomic_t simStopRequested = 0;
+
+static void simStop(int signal) {
+  simStopRequested = 1;
+}
+
+// Serve binary commands in real time until stopped
+static int simServeCommands() {
+  char shown[UNITCOUNT + 1];
+
+  signal(SIGTERM, simStop);
+  simSetRealTime(true);
+  word_updates_per_hour = 0;
+  setup();
+  while (!simStopRequested) {
+    simRun(SIM_RUN_US);
+  }
+
+  for (uint8_t unit = 0; unit < UNITCOUNT; unit++) {
+    shown[unit] = simDisplayedLetter(unit);
+  }
+  shown[UNITCOUNT] = '\0';
+  printf("shown: [%s]\n", shown);
+  return 0;
+}
+
+static void simWriteMetrics(const char* text, size_t length) {
+  fwrite(text, 1, length, stdout);
+}
+
+// Play the script, glitching some sensors part way through the last update, and print the metrics
+static int simShowMetrics() {
+  setup();
+  simRunUntilSettled();
+  for (uint8_t i = 0; defaultScript[i][0] != '\0'; i++) {
+    char display[SIGN_MAX_COLUMNS + 1];
+    padToFullWidth(defaultScript[i], display, sizeof(display));
+    simPostDisplay(display);
+    if (defaultScript[i + 1][0] == '\0') {
+      simRunIdle(SIM_GLITCH_AFTER_MS);
+      for (uint8_t j = 0; j < sizeof(glitchUnits); j++) {
+        simHallGlitch(glitchUnits[j], SIM_GLITCH_US);
+      }
+    }
+    simRunUntilSettled();
+    simRunIdle(SIM_IDLE_GAP_MS);
+  }
+  metricsWrite(simWriteMetrics);
+  return 0;
+}
+
+static FILE* simTraceFile;
+
+static void simWriteTrace(const char* data, size_t length) {
+  fwrite(data, 1, length, simTraceFile);
+}
+
+// Home and show a message, then another, with some sensors glitching during each, and save the trace
+static int simRecordTrace(const char* path) {
+  char display[SIGN_MAX_COLUMNS + 1];
+
+  simTraceFile = fopen(path, "wb");
+  if (simTraceFile == nullptr) {
+    printf("record: can't write %s\n", path);
+    return 2;
+  }
+
+  setup();
+  simRunIdle(SIM_GLITCH_AFTER_MS);
+  for (uint8_t i = 0; i < sizeof(glitchUnits); i++) {
+    simHallGlitch(glitchUnits[i], SIM_GLITCH_US);
+  }
+  simRunUntilSettled();
+  padToFullWidth(defaultScript[0], display, sizeof(display));
+  simPostDisplay(display);
+  simRunUntilSettled();
+  simRunIdle(SIM_IDLE_GAP_MS);
+
+  padToFullWidth(SIM_GLITCH_TEXT, display, sizeof(display));
+  simPostDisplay(display);
+  simRunIdle(SIM_GLITCH_AFTER_MS);
+  for (uint8_t i = 0; i < sizeof(glitchUnits); i++) {
+    simHallGlitch(glitchUnits[i], SIM_GLITCH_US);
+  }
+  simRunUntilSettled();
+  simRunIdle(SIM_IDLE_GAP_MS);
+
+  traceWrite(simWriteTrace);
+  fclose(simTraceFile);
+  printf("record: trace written to %s\n", path);
+  return 0;
+}
+
+int main(int argc, char** argv) {
+  uint32_t totalMillis = 0;
+  uint8_t totalWrong = 0;
+  uint16_t updates = 0;
+
+  if (argc == 2 && strcmp(argv[1], "--udp") == 0) {
+    return simServeCommands();
+  }
+  if (argc == 2 && strcmp(argv[1], "--metrics") == 0) {
+    return simShowMetrics();
+  }
+  if (argc == 3 && strcmp(argv[1], "--record") == 0) {
+    return simRecordTrace(argv[2]);
+  }
+  if (argc == 3 && strcmp(argv[1], "--replay") == 0) {
+    return simReplayTrace(argv[2]);
+  }
+  if (argc == 5 && strcmp(argv[1], "--group") == 0) {
+    uint8_t role = (strcmp(argv[2], "leader") == 0) ? SYNC_ROLE_LEADER : SYNC_ROLE_FOLLOWER;
+    return simRunGroup(role, atoi(argv[3]), atoi(argv[4]));
+  }
+
+  setup();
+  uint32_t homeMillis = simRunUntilSettled();
+  printf("boot + homing: %lu ms\n", (unsigned long)millis());
+  printf("homing after setup: %lu ms\n", (unsigned long)homeMillis);
+
+  for (int i = 0; ; i++) {
+    const char* text;
+    if (argc > 1) {
+      if (i + 1 >= argc) break;
+      text = argv[i + 1];
+    }
+    else {
+      text = defaultScript[i];
+      if (text[0] == '\0') break;
+    }
+
+    char display[SIGN_MAX_COLUMNS + 1];
+    padToFullWidth(text, display, sizeof(display));
+    upperCaseText(display);
+    simPostDisplay(display);
+    uint32_t settleMillis = simRunUntilSettled();
+    uint8_t wrong = simCountWrongLetters(display);
+
+    char shown[UNITCOUNT + 1];
+    for (uint8_t unit = 0; unit < UNITCOUNT; unit++) {
+      shown[unit] = simDisplayedLetter(unit);
+    }
+    shown[UNITCOUNT] = '\0';
+
+    printf("[%-*.*s] -> [%s] %6lu ms, landing spread %4lu ms%s\n", UNITCOUNT, UNITCOUNT, display, shown, (unsigned long)settleMillis,
+           (unsigned long)simLandingSpread, wrong ? "  MISMATCH" : "");
+    totalMillis += settleMillis;
+    totalWrong += wrong;
+    updates++;
+
+    simRunIdle(SIM_IDLE_GAP_MS);
+  }
+
+  // A frame sequence, played at the pace of each drum (as if POSTed to /frames)
+  if (argc <= 1) {
+    uint8_t frameCount = sizeof(frameScript) / sizeof(frameScript[0]);
+    for (uint8_t frame = 0; frame < frameCount; frame++) {
+      queueFrame(frameScript[frame], SIM_FRAME_HOLD_MS, frame == frameCount - 1);
+    }
+    // run until the barrier frame has started, so the landing spread is that frame's alone
+    uint32_t startMillis = millis();
+    simRun(SIM_RUN_US);
+    while ((!commandQueue.empty() || !frameQueueEmpty()) && millis() - startMillis < SIM_TIMEOUT_MS) {
+      simRun(SIM_RUN_US);
+    }
+    simRunUntilSettled();
+    uint32_t settleMillis = millis() - startMillis;
+    char lastFrame[SIGN_MAX_COLUMNS + 1];
+    padToFullWidth(frameScript[frameCount - 1], lastFrame, sizeof(lastFrame));
+    uint8_t wrong = simCountWrongLetters(lastFrame);
+    if (simLandingSpread > SIM_BARRIER_MAX_SPREAD_MS) {
+      wrong++;
+    }
+    printf("frames: %u in %lu ms, barrier landing spread %4lu ms%s\n", frameCount, (unsigned long)settleMillis,
+           (unsigned long)simLandingSpread, wrong ? "  MISMATCH" : "");
+    totalWrong += wrong;
+  }
+
+  // Noise on some hall sensors part way through an update
+  if (argc <= 1) {
+    char glitchText[SIGN_MAX_COLUMNS + 1];
+    padToFullWidth(SIM_GLITCH_TEXT, glitchText, sizeof(glitchText));
+    simPostDisplay(glitchText);
+    uint32_t startMillis = millis();
+    simRunIdle(SIM_GLITCH_AFTER_MS);
+    for (uint8_t i = 0; i < sizeof(glitchUnits); i++) {
+      simHallGlitch(glitchUnits[i], SIM_GLITCH_US);
+    }
+    simRunUntilSettled();
+    uint8_t wrong = simCountWrongLetters(glitchText);
+    printf("glitches: %u during update, settled in %lu ms%s\n", (unsigned)sizeof(glitchUnits), (unsigned long)(millis() - startMillis),
+           wrong ? "  MISMATCH" : "");
+    totalWrong += wrong;
+    simRunIdle(SIM_IDLE_GAP_MS);
+  }
+
+  // From the last flaps on the drum, past the magnet to the first letter: never a whole extra revolution
+  if (argc <= 1) {
+    uint32_t longestMove = 0;
+    for (uint8_t unit = 0; unit < UNITCOUNT; unit++) {
+      longestMove = max(longestMove, splitFlap[unit]->longestMoveDuration());
+    }
+    for (uint8_t flap = FLAPCOUNT - SIM_WRAP_FLAPS; flap < FLAPCOUNT; flap++) {
+      char from[UNITCOUNT + 1];
+      char to[UNITCOUNT + 1];
+      memset(from, letters[flap], UNITCOUNT);
+      memset(to, letters[1], UNITCOUNT);
+      from[UNITCOUNT] = '\0';
+      to[UNITCOUNT] = '\0';
+
+      simPostDisplay(from);
+      simRunUntilSettled();
+      uint8_t wrong = simCountWrongLetters(from);
+      simRunIdle(SIM_IDLE_GAP_MS);
+      simPostDisplay(to);
+      uint32_t wrapMillis = simRunUntilSettled();
+      wrong += simCountWrongLetters(to);
+      boolean slow = wrapMillis > longestMove;
+      printf("wrap: '%c' -> '%c' %5lu ms, landing spread %4lu ms%s\n", letters[flap], letters[1], (unsigned long)wrapMillis,
+             (unsigned long)simLandingSpread, (wrong || slow) ? "  MISMATCH" : "");
+      totalWrong += wrong + (slow ? 1 : 0);
+      simRunIdle(SIM_IDLE_GAP_MS);
+    }
+  }
+
+  // A long move (short of the magnet, where a new letter would wait for the origin) superseded
+  // at full speed by the flap going past, which is closer than the drum can stop in: it must go
+  // on round rather than turn back
+  if (argc <= 1) {
+    char from[UNITCOUNT + 1];
+    char to[UNITCOUNT + 1];
+    memset(from, letters[FLAPCOUNT / 2], UNITCOUNT);
+    from[UNITCOUNT] = '\0';
+    simPostDisplay(from);
+    simRunIdle(SIM_SUPERSEDE_AFTER_MS);
+
+    uint32_t reversalsBefore = 0;
+    for (uint8_t unit = 0; unit < UNITCOUNT; unit++) {
+      to[unit] = simDisplayedLetter(unit);
+      reversalsBefore += simReversals(unit);
+    }
+    to[UNITCOUNT] = '\0';
+    simPostDisplay(to);
+    uint32_t supersedeMillis = simRunUntilSettled();
+    uint8_t wrong = simCountWrongLetters(to);
+    uint32_t reversals = 0;
+    for (uint8_t unit = 0; unit < UNITCOUNT; unit++) {
+      reversals += simReversals(unit);
+    }
+    reversals -= reversalsBefore;
+    printf("supersede: %5lu ms, %lu reversals%s\n", (unsigned long)supersedeMillis, (unsigned long)reversals,
+           (wrong || reversals) ? "  MISMATCH" : "");
+    totalWrong += wrong + reversals;
+    simRunIdle(SIM_IDLE_GAP_MS);
+  }
+
+  // Long run of random text, without re-homing in between
+  if (argc <= 1) {
+    uint32_t seed = 12345;
+    uint16_t soakWrong = 0;
+    uint16_t soakOverLongest = 0;
+    HalHeapStats heapBefore, heapAfter;
+    halGetHeapStats(heapBefore);
+    for (uint16_t update = 0; update < SIM_SOAK_UPDATES; update++) {
+      char text[UNITCOUNT + 1];
+      for (uint8_t unit = 0; unit < UNITCOUNT; unit++) {
+        seed = seed * 1103515245 + 12345;
+        text[unit] = letters[(seed >> 16) % SIM_FLAPCOUNT];
+      }
+      text[UNITCOUNT] = '\0';
+      // the plan for a whole update assumes no move takes longer than this
+      for (uint8_t unit = 0; unit < UNITCOUNT; unit++) {
+        if (splitFlap[unit]->moveDurationToLetter(text[unit]) > splitFlap[unit]->longestMoveDuration()) {
+          soakOverLongest++;
+        }
+      }
+      simPostDisplay(text);
+      simRunUntilSettled();
+      soakWrong += simCountWrongLetters(text);
+    }
+    halGetHeapStats(heapAfter);
+    printf("soak: %u updates, %u wrong letters, %u moves over the longest, %lu heap allocations%s\n", SIM_SOAK_UPDATES, soakWrong,
+           soakOverLongest, (unsigned long)(heapAfter.allocations - heapBefore.allocations), soakOverLongest ? "  MISMATCH" : "");
+    totalWrong += soakWrong + soakOverLongest;
+    simRunIdle(SIM_IDLE_GAP_MS);
+  }
+
+  // Far more moves than can be simulated, on the flap arithmetic alone: every target must be a
+  // whole number of revolutions from where the flap is after the blank, itself counted from the
+  // magnet, so no rounding can build up however many times the origin is crossed
+  if (argc <= 1) {
+    uint32_t seed = 54321;
+    uint32_t crossings = 0;
+    uint32_t off = 0;
+    for (uint8_t drum = 0; drum < SIM_DRIFT_DRUMS; drum++) {
+      int32_t flapSteps[FLAPCOUNT + 1];
+      seed = seed * 1103515245 + 12345;
+      float flapStep = (NOMINAL_STEPS_PER_REV - 20 + ((seed >> 16) % 4000) / 100.0) / FLAPCOUNT;
+      seed = seed * 1103515245 + 12345;
+      uint8_t calOffset = 50 + (seed >> 16) % 60;
+      drumFlapSteps(flapStep, flapSteps);
+      int32_t revolution = flapSteps[FLAPCOUNT];
+      int32_t origin = 0;
+      // each flap within half a step (and the fixed point rounding) of where it really is
+      for (uint8_t flap = 0; flap <= FLAPCOUNT; flap++) {
+        if (fabs(flapSteps[flap] - flap * (double)flapStep) > 0.5 + 1.0 / FLAP_STEP_SCALE) {
+          off++;
+        }
+      }
+      int32_t position = calOffset;
+
+      for (uint32_t move = 0; move < SIM_DRIFT_MOVES; move++) {
+        seed = seed * 1103515245 + 12345;
+        uint8_t flap = (seed >> 16) % FLAPCOUNT;
+        // settled, or moving and planned from where it can stop
+        int32_t earliest = (seed & 1) ? position - ORIGIN_TOLERANCE_STEPS : position + (seed >> 8) % SIM_DRIFT_STOPPING_STEPS;
+        int32_t target = drumFlapTarget(flapSteps, origin, calOffset, flap, earliest);
+        // the magnet edges passed on the way
+        while (origin + revolution <= target) {
+          origin += revolution;
+          crossings++;
+        }
+        int32_t again = drumFlapTarget(flapSteps, origin, calOffset, flap, target + 1);
+        if (target < earliest || target - revolution >= earliest || (target - origin - calOffset - flapSteps[flap]) % revolution != 0 ||
+            again - target != revolution) {
+          off++;
+        }
+        position = target;
+      }
+    }
+    printf("drift: %lu moves on %u drums, %lu origin crossings, %lu targets off%s\n", (unsigned long)SIM_DRIFT_DRUMS * SIM_DRIFT_MOVES,
+           SIM_DRIFT_DRUMS, (unsigned long)crossings, (unsigned long)off, off ? "  MISMATCH" : "");
+    totalWrong += (off > 0) ? 1 : 0;
+  }
+
+  // Makespan of homing every unit and of a full display change, for each motor budget
+  if (argc <= 1) {
+    char budgetTo[SIGN_MAX_COLUMNS + 1];
+    padToFullWidth(SIM_BUDGET_TO, budgetTo, sizeof(budgetTo));
+    for (uint8_t i = 0; i < sizeof(budgetSweep); i++) {
+      schedulerSetMotorBudget(UNITCOUNT);
+      simPostDisplay(SIM_BUDGET_FROM);
+      simRunUntilSettled();
+      simRunIdle(SIM_IDLE_GAP_MS);
+
+      schedulerSetMotorBudget(budgetSweep[i]);
+      simPostDisplay(budgetTo);
+      uint32_t updateMillis = simRunUntilSettled();
+      uint8_t updatePeak = simPeakMotors;
+      totalWrong += simCountWrongLetters(budgetTo);
+      simRunIdle(SIM_IDLE_GAP_MS);
+
+      // re-home every unit, then show the same text again
+      for (uint8_t unit = 0; unit < UNITCOUNT; unit++) {
+        splitFlap[unit]->calibrationComplete = false;
+        splitFlap[unit]->calibrationStarted = false;
+        splitFlap[unit]->pendingLetter = splitFlap[unit]->destinationLetter;
+      }
+      uint32_t homeMillis = simRunUntilSettled();
+      totalWrong += simCountWrongLetters(budgetTo);
+      simRunIdle(SIM_IDLE_GAP_MS);
+
+      printf("budget %2u: update %5lu ms (peak %2u motors), re-home %5lu ms (peak %2u motors)\n", budgetSweep[i],
+             (unsigned long)updateMillis, updatePeak, (unsigned long)homeMillis, simPeakMotors);
+    }
+    schedulerSetMotorBudget(MOTOR_BUDGET);
+  }
+
+  // Speed tune every unit, then time the default script again with the tuned profiles
+  if (argc <= 1) {
+    for (uint8_t unit = 0; unit < UNITCOUNT; unit++) {
+      splitFlap[unit]->speedTuneStart();
+    }
+    uint32_t tuneMillis = simRunUntilSettled();
+    simRunIdle(SIM_IDLE_GAP_MS);
+
+    uint32_t tunedMillis = 0;
+    uint16_t tunedUpdates = 0;
+    for (uint8_t i = 0; defaultScript[i][0] != '\0'; i++) {
+      char display[SIGN_MAX_COLUMNS + 1];
+      padToFullWidth(defaultScript[i], display, sizeof(display));
+      simPostDisplay(display);
+      tunedMillis += simRunUntilSettled();
+      totalWrong += simCountWrongLetters(display);
+      tunedUpdates++;
+      simRunIdle(SIM_IDLE_GAP_MS);
+    }
+    printf("speed tune: %lu ms, then mean update: %lu ms\n", (unsigned long)tuneMillis, (unsigned long)(tunedMillis / tunedUpdates));
+  }
+
+  // One unit's hall sensor dies and it is made to home: it should fail, retry and be disabled,
+  // while the others carry on updating without waiting for it
+  if (argc <= 1) {
+    uint32_t faultMillis = millis();
+    uint32_t disabledMillis = 0;
+    uint32_t othersMillis = 0;
+    uint16_t othersUpdates = 0;
+    uint16_t othersWrong = 0;
+    uint8_t afterDisabled = 0;
+    char timeline[96];
+    size_t timelineLength = snprintf(timeline, sizeof(timeline), "%s", unitHealthName(splitFlap[SIM_FAULT_UNIT]->health()));
+    UnitHealth lastHealth = splitFlap[SIM_FAULT_UNIT]->health();
+
+    simHallDead(SIM_FAULT_UNIT, true);
+    simIgnoredUnit = SIM_FAULT_UNIT;
+    splitFlap[SIM_FAULT_UNIT]->calibrationComplete = false;
+    splitFlap[SIM_FAULT_UNIT]->calibrationStarted = false;
+    splitFlap[SIM_FAULT_UNIT]->pendingLetter = splitFlap[SIM_FAULT_UNIT]->destinationLetter;
+
+    for (uint8_t i = 0; othersUpdates < SIM_FAULT_MAX_UPDATES && afterDisabled < SIM_FAULT_AFTER_UPDATES; i++) {
+      char display[SIGN_MAX_COLUMNS + 1];
+      const char* text = defaultScript[i % (sizeof(defaultScript) / sizeof(defaultScript[0]) - 1)];
+      padToFullWidth(text, display, sizeof(display));
+      upperCaseText(display);
+      simPostDisplay(display);
+      othersMillis += simRunUntilSettled();
+      othersWrong += simCountWrongLetters(display);
+      othersUpdates++;
+      simRunIdle(SIM_IDLE_GAP_MS);
+
+      // health as of each update
+      UnitHealth health = splitFlap[SIM_FAULT_UNIT]->health();
+      if (health != lastHealth && timelineLength < sizeof(timeline)) {
+        timelineLength += snprintf(timeline + timelineLength, sizeof(timeline) - timelineLength, " -> %s", unitHealthName(health));
+        lastHealth = health;
+      }
+      if (health == UNIT_DISABLED) {
+        if (disabledMillis == 0) {
+          disabledMillis = millis() - faultMillis;
+        }
+        afterDisabled++;
+      }
+    }
+    simIgnoredUnit = UNITCOUNT;
+
+    printf("fault: unit %02u %s after %lu ms; others: %u updates, mean %lu ms, %u wrong letters\n", SIM_FAULT_UNIT, timeline,
+           (unsigned long)disabledMillis, othersUpdates, (unsigned long)(othersMillis / othersUpdates), othersWrong);
+    totalWrong += othersWrong;
+    if (lastHealth != UNIT_DISABLED) {
+      totalWrong++;
+    }
+  }
+
+  printf("updates: %u, total settle: %lu ms, mean: %lu ms, wrong letters: %u\n", updates, (unsigned long)totalMillis,
+         (unsigned long)(updates ? totalMillis / updates : 0), totalWrong);
+
+  for (uint8_t phase = 0; phase < BOOT_PHASES; phase++) {
+    if (bootReached((BootPhase)phase)) {
+      printf("boot %s: %lu ms\n", bootPhaseName((BootPhase)phase), (unsigned long)bootPhaseMillis((BootPhase)phase));
+    }
+  }
+
+  HalI2cStats i2c;
+  halGetI2cStats(i2c);
+  printf("i2c: %lu transactions, %lu bytes\n", (unsigned long)i2c.transactions, (unsigned long)i2c.bytes);
+
+  HalHeapStats heap;
+  halGetHeapStats(heap);
+  printf("heap: %lu allocations, %lu bytes free (least %lu), largest free block %lu bytes\n", (unsigned long)heap.allocations,
+         (unsigned long)heap.freeBytes, (unsigned long)heap.minimumFreeBytes, (unsigned long)heap.largestFreeBlock);
+
+  return totalWrong ? 1 : 0;
+}
@@ -0,0 +1,364 @@
+// Event trace replay for the native simulator (program --replay <file>, see trace.h)
+//
+// Each unit is started afresh at its first homing in the trace, with the tuning it had then,
+// and given the recorded inputs in order, at their recorded times. Its stepper is a stand-in
+// that is wherever the recorded hall edges, moves and stops say the drum was, and is running
+// from each command until the trace saw it stopped. Every stepper command and calibration outcome the Unit code
+// produces is checked against the next one recorded for that unit; a unit is dropped from the
+// replay at its first difference.
+// Units restored after a restart (see Unit::restoreState) don't home, so aren't replayed
+// until they next do. Moves of the whole display are replayed from the moves of each unit, so
+// the scheduler, frame queue and display group play no part.
+
+#include <Arduino.h>
+#include <vector>
+#include "unit.h"
+#include "trace.h"
+#include "sim.h"
+
+static const char* traceTypeNames[] = {
+  "boot", "command", "tuning", "calibrate", "recalibrate", "move to letter", "hall edge", "hall lost", "stopped", "stuck",
+  "stopping at", "stepper move", "stepper move to", "stepper run forward", "stepper stop", "calibrated", "calibration failed", "glitch",
+  "missed origin",
+};
+
+static_assert(sizeof(traceTypeNames) / sizeof(traceTypeNames[0]) == TRACE_TYPES, "traceTypeNames needs a name for every TraceType");
+
+static std::vector<TraceRecord> replayRecords;
+static std::vector<bool> replayConsumed;
+static size_t replayCursor; // the record being replayed; those before it are done with
+static Unit* replayUnits[UNITCOUNT];
+static class ReplayStepper* replaySteppers[UNITCOUNT];
+static boolean replayStarted[UNITCOUNT];
+static boolean replayUsed[UNITCOUNT]; // started at some point
+static boolean replayDropped[UNITCOUNT];
+static boolean replayHallPending[UNITCOUNT]; // sensor state to take from the first homing
+static uint64_t replayClockUs;
+static uint32_t replayLastUs;
+static uint32_t replayMatched;
+static uint32_t replayInputs;
+static uint16_t replayMismatches;
+
+static boolean replayActive(uint8_t unit) {
+  return unit < UNITCOUNT && replayStarted[unit] && !replayDropped[unit];
+}
+
+// The next record for this unit that hasn't been replayed yet, or -1
+static long replayNextForUnit(uint8_t unit) {
+  for (size_t index = replayCursor; index < replayRecords.size(); index++) {
+    const TraceRecord& record = replayRecords[index];
+    if (record.type == TRACE_BOOT) {
+      return -1;
+    }
+    if (!replayConsumed[index] && record.type != TRACE_COMMAND && record.unit == unit) {
+      return index;
+    }
+  }
+  return -1;
+}
+
+class ReplayStepper : public HalStepper {
+  public:
+    ReplayStepper(uint8_t unit) : position(0), stoppingPosition(0), running(false), unitNum(unit) {}
+    void move(int32_t steps) override { running = true; }
+    void moveTo(int32_t target) override { running = true; }
+    void runForward() override { running = true; }
+    void forceStop() override { running = false; }
+    void forceStopAndNewPosition(int32_t newPosition) override {
+      running = false;
+      position = newPosition;
+    }
+    // Stopped once the trace next has it seen to stop
+    bool isRunning() override {
+      long next = replayNextForUnit(unitNum);
+      if (running && next >= 0 && replayRecords[next].type == TRACE_STOPPED) {
+        replayConsumed[next] = true;
+        running = false;
+        position = replayRecords[next].value;
+      }
+      return running;
+    }
+    void setSpeedInUs(uint32_t speed_us) override {}
+    void setAcceleration(int32_t acceleration) override {}
+    int32_t getCurrentPosition() override { return position; }
+    int32_t getStoppingPosition() override { return stoppingPosition; }
+
+    int32_t position;
+    int32_t stoppingPosition; // as recorded for the next move
+    bool running;
+
+  private:
+    uint8_t unitNum;
+};
+
+static HalStepper* replayStepperFactory(uint8_t unit) {
+  replaySteppers[unit] = new ReplayStepper(unit);
+  return replaySteppers[unit];
+}
+
+static void replayMismatch(uint8_t unit, const TraceRecord* expected, const TraceRecord* produced) {
+  printf("unit %02u at %lu.%03lu ms: ", unit, (unsigned long)(replayClockUs / 1000), (unsigned long)(replayClockUs % 1000));
+  if (expected != nullptr) {
+    printf("trace has %s %ld", traceTypeNames[expected->type], (long)expected->value);
+  }
+  else {
+    printf("trace has nothing more");
+  }
+  if (produced != nullptr) {
+    printf(", replay did %s %ld\n", traceTypeNames[produced->type], (long)produced->value);
+  }
+  else {
+    printf(", replay did nothing\n");
+  }
+  replayMismatches++;
+  replayDropped[unit] = true;
+}
+
+// Each output of the Unit code as it is traced: it should be the next the trace has for the unit
+static void replayCheckOutput(const TraceRecord& produced) {
+  if (produced.type < TRACE_FIRST_OUTPUT || !replayActive(produced.unit)) {
+    return;
+  }
+
+  long next = replayNextForUnit(produced.unit);
+  if (next >= 0 && replayRecords[next].type == produced.type && replayRecords[next].arg == produced.arg &&
+      replayRecords[next].value == produced.value) {
+    replayConsumed[next] = true;
+    replayMatched++;
+  }
+  else {
+    replayMismatch(produced.unit, next >= 0 ? &replayRecords[next] : nullptr, &produced);
+  }
+}
+
+// Trace times are micros(), which wraps; the clock only moves forward, as edges are recorded
+// at their captured time, a little before they are acted on
+static void replaySetClock(uint32_t timeUs) {
+  replayClockUs += (int32_t)(timeUs - replayLastUs);
+  replayLastUs = timeUs;
+  simSetClock(replayClockUs);
+}
+
+// A fresh unit with the tuning it had at the start of the recorded homing
+static void replayStartUnit(uint8_t unit, const TraceRecord& record) {
+  UnitTuning tuning;
+  char key[8];
+
+  tuning.calOffset = record.arg & 0xFF;
+  memcpy(&tuning.flapStep, &record.value, sizeof(tuning.flapStep));
+  tuning.speedUs = rotationSpeeduS;
+  tuning.acceleration = rotationAcceleration;
+  // nothing learned yet: as built, without anything stored
+  tuning.magic = (record.arg >> 8) > 0 ? TUNING_MAGIC : 0;
+  snprintf(key, sizeof(key), "tune%02d", unit);
+  halStorageWrite(key, &tuning, sizeof(tuning));
+
+  replayUnits[unit] = new Unit(unit);
+  replayStarted[unit] = true;
+  replayUsed[unit] = true;
+  replayDropped[unit] = false;
+  replayHallPending[unit] = true;
+}
+
+// Edges taken from the queue together are queued together
+static void replayHallEdges(uint8_t unit, const TraceRecord& first) {
+  ReplayStepper* stepper = replaySteppers[unit];
+
+  stepper->position = first.value;
+  replayUnits[unit]->recordHallEdge(first.arg & 1, first.timeUs);
+  for (size_t index = replayCursor + 1; index < replayRecords.size(); index++) {
+    const TraceRecord& record = replayRecords[index];
+    if (replayConsumed[index] || record.unit != unit || record.type == TRACE_BOOT || record.type == TRACE_COMMAND) {
+      break;
+    }
+    if (record.type == TRACE_HALL_EDGE && (record.arg & TRACE_EDGE_SAME_PASS)) {
+      replayConsumed[index] = true;
+      stepper->position = record.value;
+      replayUnits[unit]->recordHallEdge(record.arg & 1, record.timeUs);
+    }
+    else if (record.type < TRACE_FIRST_OUTPUT && record.type != TRACE_STOPPED) {
+      break;
+    }
+  }
+  replayUnits[unit]->processHallEdges();
+}
+
+// Display commands aren't replayed themselves, they arrive as moves to letters
+static void replayCommand(const TraceRecord& record) {
+  Unit* unit = replayActive(record.unit) ? replayUnits[record.unit] : nullptr;
+
+  if (record.arg == CMD_MOVE_ALL_FLAPS) {
+    for (uint8_t i = 0; i < UNITCOUNT; i++) {
+      if (replayActive(i)) {
+        replayUnits[i]->moveStepperbyFlap(record.value);
+      }
+    }
+  }
+  if (unit == nullptr) {
+    return;
+  }
+  switch (record.arg) {
+    case CMD_MOVE_FLAPS:
+      unit->moveStepperbyFlap(record.value);
+      break;
+    case CMD_MOVE_STEPS:
+      unit->moveStepperbyStep(record.value);
+      break;
+    case CMD_AUTOTUNE:
+      unit->autoTuneStart();
+      break;
+    case CMD_SPEED_TUNE:
+      unit->speedTuneStart();
+      break;
+    case CMD_SET_OFFSET:
+      unit->setCalOffset(record.value);
+      break;
+  }
+}
+
+static void replayInput(const TraceRecord& record) {
+  uint8_t unit = record.unit;
+
+  if (record.type == TRACE_BOOT) {
+    for (uint8_t i = 0; i < UNITCOUNT; i++) {
+      replayStarted[i] = false;
+    }
+    return;
+  }
+  if (record.type == TRACE_COMMAND) {
+    replayCommand(record);
+    return;
+  }
+  if (record.type == TRACE_TUNING && unit < UNITCOUNT && !replayStarted[unit]) {
+    replayStartUnit(unit, record);
+  }
+  if (!replayActive(unit)) {
+    return;
+  }
+
+  replayInputs++;
+  switch (record.type) {
+    case TRACE_CALIBRATE:
+      if (replayHallPending[unit]) {
+        replayUnits[unit]->initHallValue(record.arg, record.value);
+        replayHallPending[unit] = false;
+      }
+      replayUnits[unit]->calibrateStart();
+      break;
+    case TRACE_RECALIBRATE:
+      replayUnits[unit]->recalibrate();
+      break;
+    case TRACE_STOPPING_AT:
+      replaySteppers[unit]->stoppingPosition = record.value;
+      break;
+    case TRACE_MOVE_TO_LETTER:
+      replaySteppers[unit]->position = record.value;
+      replayUnits[unit]->moveSteppertoLetter(record.arg);
+      break;
+    case TRACE_HALL_EDGE:
+      replayHallEdges(unit, record);
+      break;
+    case TRACE_HALL_LOST:
+      printf("unit %02u at %lu.%03lu ms: hall edges were lost, not replayed from here\n", unit, (unsigned long)(replayClockUs / 1000),
+             (unsigned long)(replayClockUs % 1000));
+      replayDropped[unit] = true;
+      break;
+    case TRACE_STOPPED:
+      replaySteppers[unit]->running = false;
+      replaySteppers[unit]->position = record.value;
+      break;
+    case TRACE_STUCK:
+      replayUnits[unit]->stopStuck();
+      break;
+  }
+}
+
+// What the motion task checks on each pass
+static void replayPoll() {
+  for (uint8_t unit = 0; unit < UNITCOUNT; unit++) {
+    if (!replayActive(unit)) {
+      continue;
+    }
+    if (!replayUnits[unit]->calibrationComplete && replayUnits[unit]->calibrationStarted) {
+      replayUnits[unit]->calibrate();
+    }
+    replayUnits[unit]->checkOriginCrossing();
+    replayUnits[unit]->speedTuneUpdate();
+  }
+}
+
+static boolean replayLoad(const char* path) {
+  TraceHeader header;
+  FILE* file = fopen(path, "rb");
+
+  if (file == nullptr) {
+    printf("replay: can't open %s\n", path);
+    return false;
+  }
+  if (fread(&header, sizeof(header), 1, file) != 1 || header.magic != TRACE_MAGIC || header.version != TRACE_VERSION ||
+      header.recordSize != sizeof(TraceRecord)) {
+    printf("replay: %s isn't a version %d trace\n", path, TRACE_VERSION);
+    fclose(file);
+    return false;
+  }
+  if (header.unitCount != UNITCOUNT || header.flapCount != FLAPCOUNT) {
+    printf("replay: trace is from %u units of %u flaps, this build has %u of %u\n", header.unitCount, header.flapCount, UNITCOUNT, FLAPCOUNT);
+    fclose(file);
+    return false;
+  }
+
+  replayRecords.resize(header.count);
+  size_t count = fread(replayRecords.data(), sizeof(TraceRecord), header.count, file);
+  fclose(file);
+  replayRecords.resize(count);
+  replayConsumed.assign(count, false);
+  return true;
+}
+
+int simReplayTrace(const char* path) {
+  if (!replayLoad(path)) {
+    return 2;
+  }
+  if (replayRecords.empty()) {
+    printf("replay: no records\n");
+    return 0;
+  }
+
+  replayClockUs = replayLastUs = replayRecords[0].timeUs;
+  simSetClock(replayClockUs);
+  simSetStepperFactory(replayStepperFactory);
+  traceSetListener(replayCheckOutput);
+
+  for (replayCursor = 0; replayCursor < replayRecords.size(); replayCursor++) {
+    const TraceRecord& record = replayRecords[replayCursor];
+
+    if (replayConsumed[replayCursor]) {
+      continue;
+    }
+    replaySetClock(record.timeUs);
+    if (record.type < TRACE_FIRST_OUTPUT) {
+      replayConsumed[replayCursor] = true;
+      replayInput(record);
+      replayPoll();
+    }
+    // an output the Unit code should have produced by now
+    else {
+      replayPoll();
+      if (!replayConsumed[replayCursor]) {
+        replayConsumed[replayCursor] = true;
+        if (replayActive(record.unit)) {
+          replayMismatch(record.unit, &record, nullptr);
+        }
+      }
+    }
+  }
+
+  traceSetListener(nullptr);
+  uint8_t replayed = 0;
+  for (uint8_t unit = 0; unit < UNITCOUNT; unit++) {
+    replayed += replayUsed[unit] ? 1 : 0;
+  }
+  printf("replay: %lu records, %u units replayed, %lu inputs, %lu outputs matched, %u mismatches\n", (unsigned long)replayRecords.size(),
+         replayed, (unsigned long)replayInputs, (unsigned long)replayMatched, replayMismatches);
+  return replayMismatches ? 1 : 0;
+}
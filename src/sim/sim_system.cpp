@@ -0,0 +1,63 @@
+// Native stand-ins for the network services in system.cpp (web server, NTP, Wordnik)
+
+#include "system.h"
+#include "sim.h"
+#include "hal.h"
+
+static const char* simWords[] = {"ALGORITHM", "ESCARPMENT", "FILIGREE", "HEMISPHERE", "KALEIDOSCOPE", "QUADRANT"};
+static uint8_t simWordIndex = 0;
+static char simRequestText[64];
+static boolean simRequestQueued = false;
+static uint32_t simNtpStartMillis = 0;
+
+// Queue display text as if POSTed to /display, delivered on the next handle_client()
+void simPostDisplay(const char* text) {
+  strncpy(simRequestText, text, sizeof(simRequestText));
+  simRequestText[sizeof(simRequestText) - 1] = '\0';
+  simRequestQueued = true;
+}
+
+boolean simRequestPending() {
+  return simRequestQueued;
+}
+
+void disableCertificates() {
+}
+
+void startNTP(time_t &now) {
+  simNtpStartMillis = millis();
+  now = halEpochMillis() / 1000;
+}
+
+boolean ntpSynchronised() {
+  return simNtpStartMillis > 0 && millis() - simNtpStartMillis >= SIM_NTP_SYNC_MS;
+}
+
+boolean synchroniseWith_NTP_Time(time_t &now, tm &timeinfo) {
+  now = halEpochMillis() / 1000;
+  gmtime_r(&now, &timeinfo);
+  return true;
+}
+
+boolean getNTP(time_t &now, tm &timeinfo) {
+  return synchroniseWith_NTP_Time(now, timeinfo);
+}
+
+boolean fetchWord(char* word, uint8_t size) {
+  strncpy(word, simWords[simWordIndex], size);
+  word[size - 1] = '\0';
+  simWordIndex = (simWordIndex + 1) % (sizeof(simWords) / sizeof(simWords[0]));
+  return true;
+}
+
+void setup_routing() {
+}
+
+void handle_client() {
+  char padded[SIGN_MAX_COLUMNS + 1];
+
+  if (simRequestQueued) {
+    simRequestQueued = false;
+    queueDisplayString(padToFullWidth(simRequestText, padded, sizeof(padded)));
+  }
+}
@@ -0,0 +1,128 @@
+#include <stddef.h>
+#include "sync.h"
+#include "hal.h"
+
+static uint8_t syncRole = SYNC_ROLE;
+static uint8_t syncColumn = SYNC_COLUMN;
+static uint8_t syncWidth = SYNC_SIGN_WIDTH;
+static Unit** syncUnits = nullptr;
+static boolean syncStarted = false;
+static uint32_t syncSequence = 0;
+static boolean syncSequenceValid = false; // followers: a frame has been taken
+
+// Override the build settings (the simulator runs several controllers from one build)
+void syncConfigure(uint8_t role, uint8_t column, uint8_t signWidth) {
+  syncRole = role;
+  syncColumn = column;
+  syncWidth = min(max(signWidth, (uint8_t)(column + UNITCOUNT)), (uint8_t)SYNC_MAX_TEXT);
+}
+
+// Join the group once the network is up
+void syncStart(Unit* units[]) {
+  syncUnits = units;
+  if (syncRole == SYNC_ROLE_NONE) {
+    return;
+  }
+
+  if (!halGroupBegin(SYNC_GROUP_ADDRESS, SYNC_GROUP_PORT)) {
+    debugln(TXT_RED "Couldn't join the display group" TXT_RST);
+    return;
+  }
+  // differs from boot to boot, so followers don't take a restarted leader's frames as repeats
+  syncSequence = micros();
+  syncStarted = true;
+  debugf("Display group " SYNC_GROUP_ADDRESS " joined as %s, columns %d - %d of %d\n", syncRole == SYNC_ROLE_LEADER ? "leader" : "follower",
+         syncColumn, syncColumn + UNITCOUNT - 1, syncWidth);
+}
+
+boolean syncIsLeader() {
+  return syncStarted && syncRole == SYNC_ROLE_LEADER;
+}
+
+boolean syncIsFollower() {
+  return syncRole == SYNC_ROLE_FOLLOWER;
+}
+
+uint8_t syncSignWidth() {
+  return syncWidth;
+}
+
+// This controller's part of the text for the whole sign
+const char* syncColumns(const char* text) {
+  size_t length = strlen(text);
+  return (length > syncColumn) ? text + syncColumn : "";
+}
+
+// Long enough for any unit here to go right round, and for the frame to reach the followers.
+// Followers are assumed to be no slower than the leader.
+static uint32_t syncLandDelayMs() {
+  uint32_t longest = 0;
+
+  for (uint8_t unit = 0; unit < UNITCOUNT; unit++) {
+    longest = max(longest, syncUnits[unit]->longestMoveDuration());
+  }
+  return longest + SYNC_LEAD_MS;
+}
+
+// Send text for the whole sign to the group, and show this controller's part of it
+boolean syncLeadDisplay(const char* text) {
+  SyncFrame frame;
+  uint32_t landInMs = syncLandDelayMs();
+  uint64_t epochMs = halEpochMillis();
+  size_t length = min(strlen(text), (size_t)SYNC_MAX_TEXT);
+
+  frame.magic = SYNC_MAGIC;
+  frame.sequence = ++syncSequence;
+  frame.landEpochMs = (epochMs != 0) ? epochMs + landInMs : 0;
+  frame.landInMs = landInMs;
+  memcpy(frame.text, text, length);
+  frame.text[length] = '\0';
+
+  for (uint8_t copy = 0; copy < SYNC_REPEATS; copy++) {
+    if (!halGroupSend(&frame, offsetof(SyncFrame, text) + length + 1)) {
+      debugln(TXT_RED "Display group send failed" TXT_RST);
+    }
+  }
+  return queueDisplayAt(syncColumns(frame.text), millis() + landInMs);
+}
+
+// Millis at which a frame from the leader should land here
+static uint32_t syncLandMillis(const SyncFrame& frame) {
+  uint64_t epochMs = halEpochMillis();
+
+  if (frame.landEpochMs != 0 && epochMs != 0) {
+    int64_t untilLand = (int64_t)(frame.landEpochMs - epochMs);
+    if (untilLand > SYNC_MAX_LAND_MS) {
+      debugf(TXT_YELLOW "Group frame lands %lld ms ahead, clocks differ?\n" TXT_RST, (long long)untilLand);
+      return millis() + frame.landInMs;
+    }
+    // a late frame lands as soon as it can
+    return millis() + (uint32_t)max(untilLand, (int64_t)0);
+  }
+  return millis() + min(frame.landInMs, (uint32_t)SYNC_MAX_LAND_MS);
+}
+
+// Followers: take any frames from the leader
+void syncUpdate() {
+  SyncFrame frame;
+  size_t size;
+
+  if (!syncStarted || !syncIsFollower()) {
+    return;
+  }
+
+  while ((size = halGroupReceive(&frame, sizeof(frame))) > 0) {
+    if (size <= offsetof(SyncFrame, text) || frame.magic != SYNC_MAGIC || frame.text[size - offsetof(SyncFrame, text) - 1] != '\0') {
+      continue;
+    }
+    if (syncSequenceValid && frame.sequence == syncSequence) {
+      continue; // a repeat
+    }
+    syncSequence = frame.sequence;
+    syncSequenceValid = true;
+
+    uint32_t landMillis = syncLandMillis(frame);
+    debugf("Group frame %lu: [%s], lands in %ld ms\n", (unsigned long)frame.sequence, frame.text, (long)(landMillis - millis()));
+    queueDisplayAt(syncColumns(frame.text), landMillis);
+  }
+}
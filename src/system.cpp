@@ -1,8 +1,25 @@
+#include <ArduinoJson.h>
+#include <WebServer.h>
+#include <WiFiClientSecure.h>
+#include <ESPmDNS.h>
 #include "system.h"
-
-const char* word_server = "api.wordnik.com";  // word server
+#include "words.h"
+#include "json_pool.h"
+#include "hal.h"
+#include "log.h"
+#include "metrics.h"
+#include "trace.h"
+
+const char* word_server = WORDNIK_HOST;  // word server
+#if WORDNIK_TLS
 WiFiClientSecure client;
+#else
+WiFiClient client;
+#endif
 WebServer server(80);
+// JSON is parsed into these rather than the heap: requests in the network task, words in the word task
+static JsonPool<API_JSON_POOL_SIZE> apiJsonPool;
+static JsonPool<WORD_JSON_POOL_SIZE> wordJsonPool;
 
 // HTML web page to handle input of text to display
 const char index_html[] PROGMEM = R"rawliteral(
@@ -21,7 +38,9 @@ const char index_html[] PROGMEM = R"rawliteral(
   </body></html>)rawliteral";
 
 void disableCertificates() {
+#if WORDNIK_TLS
     client.setInsecure();
+#endif
 }
 
 boolean synchroniseWith_NTP_Time(time_t &now, tm &timeinfo){
@@ -43,6 +62,16 @@ boolean synchroniseWith_NTP_Time(time_t &now, tm &timeinfo){
   return true;
 }
 
+void startNTP(time_t &now) {
+  configTzTime(MY_TZ, MY_NTP_SERVER);
+  now = time(nullptr);
+}
+
+// Non-blocking check for whether SNTP has set the clock yet
+boolean ntpSynchronised() {
+  return time(nullptr) >= NTP_MIN_VALID_EPOCH;
+}
+
 boolean getNTP(time_t &now, tm &timeinfo) {
   // If cannot get NTP time, return error
   if (!synchroniseWith_NTP_Time(now, timeinfo)) {
@@ -56,67 +85,100 @@ boolean getNTP(time_t &now, tm &timeinfo) {
   return true;
 }
 
-String wordOfTheDay() {
-    JsonDocument jsonBufferData;
-    String json_word;
+// Fetch one random word from Wordnik. The connection is kept open between calls so the
+// TLS session is reused, and the JSON is parsed straight off the socket.
+boolean fetchWord(char* word, uint8_t size) {
+    wordJsonPool.reset();
+    JsonDocument jsonBufferData(&wordJsonPool);
+    JsonDocument filter(&wordJsonPool);
+    boolean chunked = false;
+    boolean keepAlive = true;
 
-    if (WORDNIKAPIKEY != "") {
+    if (!client.connected()) {
       // debugln("\nStarting connection to word server...");
-      if (!client.connect(word_server, 443)) {
+      client.stop();
+      if (!client.connect(word_server, WORDNIK_PORT)) {
           debugln("Connection failed!");
-          return "";
-      }
-      else {
-          // debugln("Connected to word_server!");
-          // Make a HTTP request:
-          client.println("GET " WORDNIKURL " HTTP/1.0");
-          client.println("Host: api.wordnik.com");
-          client.println("Connection: close");
-          client.println();
-
-          while (client.connected()) {
-          String line = client.readStringUntil('\n');
-          if (line == "\r") {
-              // debugln("headers received");
-              break;
-          }
-          }
-          // if there are incoming bytes available
-          // from the word_server, read them and print them:
-          while (client.available()) {
-          char c = client.read();
-          json_word += c;
-          }
-          
-          client.stop();
+          return false;
       }
+    }
 
-      //Parse JSON to get word
-      DeserializationError jsonError = deserializeJson(jsonBufferData, json_word);
+    // Make a HTTP request:
+    client.print("GET " WORDNIKPATH " HTTP/1.1\r\n"
+                 "Host: " WORDNIK_HOST "\r\n"
+                 "Connection: keep-alive\r\n\r\n");
 
-      // Test if parsing succeeds
-      if (jsonError) {
-          debug(F("deserializeJson() failed: "));
-          debugln(jsonError.f_str());
-          return "";
+    String status = client.readStringUntil('\n');
+    if (status.length() < 12 || strncmp(status.c_str() + 8, " 200", 4) != 0) {
+        debugf("Word server returned: %s\n", status.c_str());
+        client.stop();
+        return false;
+    }
+
+    while (client.connected()) {
+      String line = client.readStringUntil('\n');
+      if (line == "\r" || line.length() == 0) {
+          // debugln("headers received");
+          break;
+      }
+      if (strncasecmp(line.c_str(), "Transfer-Encoding: chunked", 26) == 0) {
+          chunked = true;
       }
+      else if (strncasecmp(line.c_str(), "Connection: close", 17) == 0) {
+          keepAlive = false;
+      }
+    }
+
+    // Wordnik's response is small enough to arrive as a single chunk
+    if (chunked) {
+      client.readStringUntil('\n');
+    }
+
+    //Parse JSON to get word, only keeping the field we need
+    filter["word"] = true;
+    DeserializationError jsonError = deserializeJson(jsonBufferData, client, DeserializationOption::Filter(filter));
 
-      const char* word = jsonBufferData["word"];
-      return padToFullWidth(word);
+    // Skip the end of the chunk and the terminating zero length chunk
+    if (chunked) {
+      client.readStringUntil('\n');
+      client.readStringUntil('\n');
+      client.readStringUntil('\n');
     }
-    else {
-      debugln("WORDNIKAPIKEY not specified in config.h");
-      return("");
+
+    if (!keepAlive) {
+      client.stop();
+    }
+
+    // Test if parsing succeeds
+    if (jsonError) {
+        debug(F("deserializeJson() failed: "));
+        debugln(jsonError.f_str());
+        client.stop();
+        return false;
     }
 
+    const char* fetched = jsonBufferData["word"];
+    if (fetched == nullptr) {
+        return false;
+    }
+    strncpy(word, fetched, size);
+    word[size - 1] = '\0';
+    return true;
 }
 
 void setup_routing() {     
   // Send web page with input fields to client
   server.on("/", HTTP_GET, sendwebpage);  
   server.on("/display", HTTP_POST, receiveAPI);    
+  server.on("/frames", HTTP_POST, receiveFrames);
+  server.on("/status", HTTP_GET, sendStatus);
+  server.on("/metrics", HTTP_GET, sendMetrics);
+  server.on("/trace", HTTP_GET, sendTrace);
   server.on("/receiveInput", HTTP_POST, receiveInput);    
   server.on("/randomWord", HTTP_POST, randomWord);    
+#if LOG_SINK == LOG_SINK_HTTP
+  server.on("/log", HTTP_GET, sendLog);
+#endif
   
   server.onNotFound(handle_NotFound);
 
@@ -131,14 +193,20 @@ void setup_routing() {
   MDNS.addServiceTxt("http", "tcp", NETWORKNAME, "1");
 }
 
+void handle_client() {
+  server.handleClient();
+}
+
 void sendwebpage() {
   server.send(200, "text/html", index_html);
 }
 
 void receiveAPI() {
-  JsonDocument jsonBufferData;
+  apiJsonPool.reset();
+  JsonDocument jsonBufferData(&apiJsonPool);
   const char* displaytext;
-  String body = server.arg("plain");
+  char padded[SIGN_MAX_COLUMNS + 1];
+  const String& body = server.arg("plain");
   
   DeserializationError jsonError = deserializeJson(jsonBufferData, body);
 
@@ -149,55 +217,134 @@ void receiveAPI() {
       return;
   }
 
-  displaytext = jsonBufferData["displaytext"];
+  displaytext = jsonBufferData["displaytext"] | "";
+  padToFullWidth(displaytext, padded, sizeof(padded));
 
-  debugf("Text to display from API: %s\n", padToFullWidth (displaytext));
-  displayString(padToFullWidth (displaytext));
+  debugf("Text to display from API: %s\n", padded);
+  queueDisplayString(padded);
 
   server.send(200, "application/json", "{}");
 }
 
+// Queue a sequence of frames behind any already playing (a POST to /display replaces them):
+// {"frames": [{"displaytext": "HELLO", "hold": 2000, "barrier": true}, ...]}
+void receiveFrames() {
+  apiJsonPool.reset();
+  JsonDocument jsonBufferData(&apiJsonPool);
+  uint8_t queued = 0;
+  char response[24];
+  const String& body = server.arg("plain");
+
+  DeserializationError jsonError = deserializeJson(jsonBufferData, body);
+  if (jsonError) {
+      debug(F("deserializeJson() failed: "));
+      debugln(jsonError.f_str());
+      server.send(400, "application/json", "{}");
+      return;
+  }
+
+  for (JsonObject frame : jsonBufferData["frames"].as<JsonArray>()) {
+    const char* displaytext = frame["displaytext"] | "";
+    uint16_t hold = frame["hold"] | 0;
+    boolean barrier = frame["barrier"] | false;
+
+    if (!queueFrame(displaytext, hold, barrier)) {
+      break;
+    }
+    queued++;
+  }
+  debugf("Frames queued from API: %d\n", queued);
+
+  // Frames that didn't fit can be sent again once the queue has drained
+  snprintf(response, sizeof(response), "{\"queued\":%d}", queued);
+  server.send(queued > 0 ? 200 : 503, "application/json", response);
+}
+
+// Whether the display is idle, and if not, the predicted time until every unit has landed,
+// with the free heap and largest free block (which stay put if updates don't allocate)
+void sendStatus() {
+  char response[128 + UNITCOUNT * 12];
+  HalHeapStats heap;
+  size_t length;
+
+  halGetHeapStats(heap);
+  length = snprintf(response, sizeof(response), "{\"idle\":%s,\"landsInMs\":%lu,\"heapFree\":%lu,\"heapLargestBlock\":%lu,\"heapMinimumFree\":%lu,\"units\":[",
+                    displayIdle ? "true" : "false", (unsigned long)displayLandsInMs(),
+                    (unsigned long)heap.freeBytes, (unsigned long)heap.largestFreeBlock, (unsigned long)heap.minimumFreeBytes);
+  // health of each unit, left to right
+  for (uint8_t unit = 0; unit < UNITCOUNT && length < sizeof(response); unit++) {
+    length += snprintf(response + length, sizeof(response) - length, "%s\"%s\"", unit > 0 ? "," : "", displayUnitHealth(unit));
+  }
+  if (length < sizeof(response)) {
+    snprintf(response + length, sizeof(response) - length, "]}");
+  }
+  server.send(200, "application/json", response);
+}
+
+static void sendMetricsText(const char* text, size_t length) {
+  server.sendContent(text, length);
+}
+
+// Prometheus text format, see metrics.h
+void sendMetrics() {
+  server.setContentLength(CONTENT_LENGTH_UNKNOWN);
+  server.send(200, "text/plain; version=0.0.4", "");
+  metricsWrite(sendMetricsText);
+  server.sendContent("");
+}
+
+static void sendTraceData(const char* data, size_t length) {
+  server.sendContent(data, length);
+}
+
+// The event trace as binary, see trace.h (tools/trace.py decodes it)
+void sendTrace() {
+  server.setContentLength(CONTENT_LENGTH_UNKNOWN);
+  server.send(200, "application/octet-stream", "");
+  traceWrite(sendTraceData);
+  server.sendContent("");
+}
+
 void receiveInput() {
-  JsonDocument jsonBufferData;
-  const char* displaytext;
-  String inputText = server.arg("displaytext");
+  char padded[SIGN_MAX_COLUMNS + 1];
 
-  displaytext = inputText.c_str();
+  padToFullWidth(server.arg("displaytext").c_str(), padded, sizeof(padded));
 
   // server.send(200, "text/plain", "{}");
   server.sendHeader("Location", "/",true);  
   server.send(302, "text/plain", "");  
 
-  delay(500);
-  displayString(padToFullWidth (displaytext));
+  queueDisplayString(padded);
 }
 
 
 void randomWord () {
-  String word = wordOfTheDay();
-  debugf("Word, [%s]\n", word);
+  char word[SIGN_MAX_COLUMNS + 1];
 
   server.sendHeader("Location", "/",true);  
   server.send(302, "text/plain", "");
 
-  delay(500);
-  displayString(word);
-}
-
-void handle_NotFound() {
-  server.send(404, "text/plain", "Not found");
+  if (nextWord(word)) {
+    debugf("Word, [%s]\n", word);
+    queueDisplayString(word);
+  }
 }
 
-String padToFullWidth (const char* word) {
-  String word_fullwidth = word;
-
-  if (word_fullwidth.length() <= UNITCOUNT - 2) {
-      word_fullwidth = " " + word_fullwidth;
-  }
+#if LOG_SINK == LOG_SINK_HTTP
+// Drain the event log (see log.h) into the response, oldest first
+void sendLog() {
+  char line[LOG_LINE_SIZE];
+  size_t length;
 
-  while (word_fullwidth.length() < UNITCOUNT) {
-      word_fullwidth += " ";
+  server.setContentLength(CONTENT_LENGTH_UNKNOWN);
+  server.send(200, "text/plain", "");
+  while ((length = logFormatNext(line, sizeof(line), false)) > 0) {
+    server.sendContent(line, length);
   }
+  server.sendContent("");
+}
+#endif
 
-  return word_fullwidth;
-}
\ No newline at end of file
+void handle_NotFound() {
+  server.send(404, "text/plain", "Not found");
+}
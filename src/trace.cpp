@@ -0,0 +1,157 @@
+#include "trace.h"
+#include "drum.h"
+
+// Written is a plain field, accessed with the atomic builtins: a std::atomic could be given a
+// constructor that clears it at boot, losing the trace that was kept over the restart.
+typedef struct {
+  uint32_t magic;
+  uint32_t written; // records ever written; the next goes in records[written % TRACE_RECORDS]
+  TraceRecord records[TRACE_RECORDS];
+} TraceBuffer;
+
+static_assert(sizeof(TraceRecord) == 12, "TraceRecord is a fixed 12 bytes");
+
+RTC_NOINIT_ATTR static TraceBuffer traceBuffer;
+static void (*traceListener)(const TraceRecord& record) = nullptr;
+
+// At boot: carry on from the trace kept over a soft restart, or start a new one
+void traceStart() {
+  if (traceBuffer.magic != TRACE_MAGIC) {
+    traceClear();
+  }
+  uint32_t written = __atomic_load_n(&traceBuffer.written, __ATOMIC_RELAXED);
+  trace(TRACE_BOOT, 0, 0, (int32_t)min(written, (uint32_t)TRACE_RECORDS));
+}
+
+void traceClear() {
+  __atomic_store_n(&traceBuffer.written, 0, __ATOMIC_RELEASE);
+  traceBuffer.magic = TRACE_MAGIC;
+}
+
+void trace(TraceType type, uint8_t unit, uint16_t arg, int32_t value) {
+  traceAt(micros(), type, unit, arg, value);
+}
+
+// Only one task writes, so the slot can be filled before the count that publishes it moves on
+void traceAt(uint32_t timeUs, TraceType type, uint8_t unit, uint16_t arg, int32_t value) {
+  uint32_t written = __atomic_load_n(&traceBuffer.written, __ATOMIC_RELAXED);
+  TraceRecord& record = traceBuffer.records[written % TRACE_RECORDS];
+
+  record.timeUs = timeUs;
+  record.type = type;
+  record.unit = unit;
+  record.arg = arg;
+  record.value = value;
+  __atomic_store_n(&traceBuffer.written, written + 1, __ATOMIC_RELEASE);
+
+  if (traceListener != nullptr) {
+    traceListener(record);
+  }
+}
+
+void traceCommand(const DisplayCommand& command) {
+  int32_t value = command.count;
+
+  // the start of the text is enough to tell displays apart
+  if (command.type == CMD_DISPLAY || command.type == CMD_QUEUE_FRAME) {
+    memcpy(&value, command.text, min(strlen(command.text), sizeof(value)));
+  }
+  trace(TRACE_COMMAND, command.unit, command.type, value);
+}
+
+void traceSetListener(void (*listener)(const TraceRecord& record)) {
+  traceListener = listener;
+}
+
+// A record that was being overwritten while it was copied is left out. Before the copy, every
+// record from before is complete; after it, the writer may have started on the next, which
+// reuses the slot of the oldest still counted.
+size_t traceSnapshot(TraceRecord* records, size_t size) {
+  uint32_t before = __atomic_load_n(&traceBuffer.written, __ATOMIC_ACQUIRE);
+  uint32_t first = before > TRACE_RECORDS ? before - TRACE_RECORDS : 0;
+  size_t count = 0;
+
+  for (uint32_t index = first; index < before && count < size; index++) {
+    records[count++] = traceBuffer.records[index % TRACE_RECORDS];
+  }
+
+  uint32_t after = __atomic_load_n(&traceBuffer.written, __ATOMIC_ACQUIRE);
+  uint32_t torn = after >= TRACE_RECORDS ? after - TRACE_RECORDS + 1 : 0; // oldest record certainly intact
+  if (torn > first) {
+    size_t skip = min((size_t)(torn - first), count);
+    memmove(records, records + skip, (count - skip) * sizeof(TraceRecord));
+    count -= skip;
+  }
+  return count;
+}
+
+static TraceRecord traceCopy[TRACE_RECORDS];
+
+void traceWrite(void (*write)(const char* data, size_t length)) {
+  TraceHeader header;
+
+  header.count = traceSnapshot(traceCopy, TRACE_RECORDS);
+  header.magic = TRACE_MAGIC;
+  header.version = TRACE_VERSION;
+  header.recordSize = sizeof(TraceRecord);
+  header.unitCount = UNITCOUNT;
+  header.flapCount = FLAPCOUNT;
+  write((const char*)&header, sizeof(header));
+  if (header.count > 0) {
+    write((const char*)traceCopy, header.count * sizeof(TraceRecord));
+  }
+}
+
+// Stepper commands are recorded on their way through, and so is the first time the stepper is
+// seen to have stopped after each one, as that is what the Unit code decides on
+class TracedStepper : public HalStepper {
+  public:
+    TracedStepper(uint8_t unit, HalStepper* stepper) : unitNum(unit), inner(stepper), wasRunning(false) {}
+
+    void move(int32_t steps) override {
+      trace(TRACE_STEPPER_MOVE, unitNum, 0, steps);
+      inner->move(steps);
+      wasRunning = true;
+    }
+    void moveTo(int32_t position) override {
+      trace(TRACE_STEPPER_MOVE_TO, unitNum, 0, position);
+      inner->moveTo(position);
+      wasRunning = true;
+    }
+    void runForward() override {
+      trace(TRACE_STEPPER_RUN_FORWARD, unitNum);
+      inner->runForward();
+      wasRunning = true;
+    }
+    void forceStop() override {
+      trace(TRACE_STEPPER_STOP, unitNum);
+      inner->forceStop();
+      wasRunning = false;
+    }
+    void forceStopAndNewPosition(int32_t position) override {
+      trace(TRACE_STEPPER_STOP, unitNum, 1, position);
+      inner->forceStopAndNewPosition(position);
+      wasRunning = false;
+    }
+    bool isRunning() override {
+      bool running = inner->isRunning();
+      if (wasRunning && !running) {
+        wasRunning = false;
+        trace(TRACE_STOPPED, unitNum, 0, inner->getCurrentPosition());
+      }
+      return running;
+    }
+    void setSpeedInUs(uint32_t speed_us) override { inner->setSpeedInUs(speed_us); }
+    void setAcceleration(int32_t acceleration) override { inner->setAcceleration(acceleration); }
+    int32_t getCurrentPosition() override { return inner->getCurrentPosition(); }
+    int32_t getStoppingPosition() override { return inner->getStoppingPosition(); }
+
+  private:
+    uint8_t unitNum;
+    HalStepper* inner;
+    bool wasRunning;
+};
+
+HalStepper* traceStepper(uint8_t unit, HalStepper* stepper) {
+  return new TracedStepper(unit, stepper);
+}
@@ -0,0 +1,126 @@
+#include <stddef.h>
+#include "udp_api.h"
+#include "hal.h"
+
+// static, so nothing this size goes on the network task's stack
+static union {
+  UdpRequest request;
+  uint8_t bytes[sizeof(UdpRequest) + 1]; // the byte to spare halCommandReceive() needs
+} received;
+static UdpRequest& request = received.request;
+static UdpReply reply;
+static uint32_t recentSequences[UDP_API_HISTORY]; // of requests acted on
+static uint8_t recentCount = 0;
+static uint8_t recentNext = 0;
+static boolean udpApiStarted = false;
+
+void udpApiStart() {
+  udpApiStarted = halCommandBegin(UDP_API_PORT);
+  if (!udpApiStarted) {
+    debugln(TXT_RED "Couldn't open the UDP command port" TXT_RST);
+  }
+}
+
+static boolean seenRecently(uint32_t sequence) {
+  for (uint8_t i = 0; i < recentCount; i++) {
+    if (recentSequences[i] == sequence) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static void rememberSequence(uint32_t sequence) {
+  recentSequences[recentNext] = sequence;
+  recentNext = (recentNext + 1) % UDP_API_HISTORY;
+  if (recentCount < UDP_API_HISTORY) {
+    recentCount++;
+  }
+}
+
+// Text padded with blanks to width, in place (text has room for SYNC_MAX_TEXT + 1)
+static char* padText(char* text, uint8_t length, uint8_t width) {
+  while (length < width) {
+    text[length++] = ' ';
+  }
+  text[length] = '\0';
+  return text;
+}
+
+static uint8_t actOnRequest(size_t size) {
+  char text[SYNC_MAX_TEXT + 1];
+  size_t headerSize = sizeof(UdpHeader);
+  size_t textSize = headerSize + offsetof(UdpText, text);
+
+  switch (request.header.op) {
+    case UDP_OP_STATUS:
+      return UDP_OK;
+
+    case UDP_OP_DISPLAY:
+    case UDP_OP_QUEUE_FRAME:
+      if (size < textSize || size != textSize + request.text.length || request.text.length > SYNC_MAX_TEXT) {
+        return UDP_MALFORMED;
+      }
+      memcpy(text, request.text.text, request.text.length);
+      if (request.header.op == UDP_OP_DISPLAY) {
+        return queueDisplayString(padText(text, request.text.length, syncSignWidth())) ? UDP_OK : UDP_QUEUE_FULL;
+      }
+      padText(text, request.text.length, syncSignWidth());
+      return queueFrameText(syncColumns(text), request.text.holdMs, request.text.flags & UDP_FLAG_BARRIER) ? UDP_OK : UDP_QUEUE_FULL;
+
+    case UDP_OP_UNITS:
+      if (size < headerSize + 1 || request.units.count > UNITCOUNT || size != headerSize + 1 + request.units.count * sizeof(UdpUnitLetter)) {
+        return UDP_MALFORMED;
+      }
+      memset(text, DISPLAY_KEEP_LETTER, UNITCOUNT);
+      text[UNITCOUNT] = '\0';
+      for (uint8_t i = 0; i < request.units.count; i++) {
+        if (request.units.units[i].unit >= UNITCOUNT || request.units.units[i].letter == DISPLAY_KEEP_LETTER) {
+          return UDP_MALFORMED;
+        }
+        text[request.units.units[i].unit] = request.units.units[i].letter;
+      }
+      return queueDisplayAt(text, millis()) ? UDP_OK : UDP_QUEUE_FULL;
+
+    case UDP_OP_CLEAR_FRAMES: {
+      DisplayCommand command = makeCommand(CMD_CLEAR_FRAMES);
+      return queueCommand(command) ? UDP_OK : UDP_QUEUE_FULL;
+    }
+  }
+  return UDP_MALFORMED;
+}
+
+// Act on any datagrams waiting, answering each one
+void udpApiUpdate() {
+  size_t size;
+
+  if (!udpApiStarted) {
+    return;
+  }
+
+  while ((size = halCommandReceive(&received, sizeof(received))) > 0) {
+    if (size < sizeof(UdpHeader) || request.header.magic != UDP_API_MAGIC || request.header.version != UDP_API_VERSION) {
+      continue; // not for us, so no reply
+    }
+
+    uint8_t result;
+    if (seenRecently(request.header.sequence)) {
+      result = UDP_REPEAT;
+    }
+    else {
+      result = actOnRequest(size);
+      // anything not acted on can be tried again with the same sequence number, and status
+      // polls would only push commands out of the history
+      if (result == UDP_OK && request.header.op != UDP_OP_STATUS) {
+        rememberSequence(request.header.sequence);
+      }
+    }
+
+    reply.header = request.header;
+    reply.result = result;
+    reply.idle = displayIdle;
+    reply.landsInMs = displayLandsInMs();
+    displayCurrentText(reply.text, sizeof(reply.text));
+    halCommandReply(&reply, sizeof(reply));
+  }
+}
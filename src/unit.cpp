@@ -1,76 +1,446 @@
+#include <math.h>
+#include <stddef.h>
 #include "unit.h"
+#include "log.h"
+#include "metrics.h"
+#include "trace.h"
 
-Unit::Unit(FastAccelStepperEngine& engine, uint8_t unit) {
-  unitNum = unit;
-  stepper = engine.stepperConnectToPin(unitStepPin[unitNum]);
+static const char* unitHealthNames[UNIT_HEALTH_STATES] = {"healthy", "retrying", "degraded", "disabled"};
 
-  stepper->setEnablePin(UnitEnablePin[unitNum] | PIN_EXTERNAL_FLAG);
-  stepper->setAutoEnable(true);
-  stepper->setDelayToEnable(1000); // microseconds
-  stepper->setDelayToDisable(2); // milliseconds
-  // debugf("Unit %d Step pin set to %d\n", unitNum, unitStepPin[unitNum]);
+const char* unitHealthName(UnitHealth health) {
+  return health < UNIT_HEALTH_STATES ? unitHealthNames[health] : "unknown";
+}
 
-  stepper->setSpeedInUs(rotationSpeeduS);  // the parameter is us/step
-  stepper->setAcceleration(4000);
+Unit::Unit(uint8_t unit) {
+  unitNum = unit;
+  stepper = traceStepper(unitNum, halStepperConnect(unitRegistry[unitNum].stepPin, unitEnablePin(unitNum)));
+  // debugf("Unit %d Step pin set to %d\n", unitNum, unitRegistry[unitNum].stepPin);
 
-  missedSteps = 0; 
   currentLetterPosition = 0;
   destinationLetter = 0;
   pendingLetter = 0;
+  scheduledLetter = 0;
+  scheduledStartMillis = 0;
+  scheduledDurationMs = 0;
+  moveTimed = false;
+  moveStartMillis = 0;
+  moveStartPosition = 0;
   calibrationStarted = false;
   calibrationComplete = false;
   currentHallValue = 1;
-  lastHallUpdateTime = 0;
+  sensedHallValue = 1;
+  lastHallEdgeUs = 0;
+  hallEdgeOverflow = false;
+  originCrossingPending = false;
+  crossingStepsPastOrigin = 0;
+  lastOriginValid = false;
+  autoTuneRevolutions = 0;
+  speedTuning = false;
+  speedTuneLevel = 0;
+  speedTuneRevolutions = 0;
+  implausibleEdges = 0;
+  savedState = nullptr;
+  stateSaved = false;
+  positionRestored = false;
+  healthState = UNIT_HEALTHY;
+  failures = 0;
+  retryPending = false;
+  retryMillis = 0;
+  recoveredMoves = 0;
+  loadTuning();
+  }
+
+// Fletcher-16 over everything before the checksum
+uint16_t Unit::stateChecksum(const UnitState* state) {
+  const uint8_t* bytes = (const uint8_t*)state;
+  uint16_t sum1 = 0;
+  uint16_t sum2 = 0;
+
+  for (size_t i = 0; i < offsetof(UnitState, checksum); i++) {
+    sum1 = (sum1 + bytes[i]) % 255;
+    sum2 = (sum2 + sum1) % 255;
+  }
+  return (sum2 << 8) | sum1;
+}
+
+// Use the state saved before a restart, if it can be trusted. Either way the unit keeps
+// the state up to date from now on (see persistState).
+boolean Unit::restoreState(UnitState* state) {
+  savedState = state;
+  if (state->magic != UNIT_STATE_MAGIC || state->checksum != stateChecksum(state) || state->letterPosition >= FLAPCOUNT) {
+    return false;
+  }
+
+  // Count from the last sensor edge at position 0
+  stepper->forceStopAndNewPosition(state->stepsFromOrigin);
+  lastOriginPosition = 0;
+  lastOriginValid = true;
+  currentLetterPosition = state->letterPosition;
+  destinationLetter = state->destinationLetter;
+  calibrationComplete = true;
+  calibrationStarted = false;
+  positionRestored = true;
+  stateSaved = true;
+  logEvent(LOG_UNIT_RESTORED, unitNum, letters[currentLetterPosition]);
+  return true;
+}
+
+// Saved state is only valid while the unit is homed and settled
+void Unit::persistState() {
+  if (savedState == nullptr) {
+    return;
   }
 
-// calc number of steps to rotate based on cumulative step error
-int16_t Unit::stepsToRotate (float steps) {
-    int16_t roundedStep = (int16_t)steps;
-    missedSteps = missedSteps + ((float)steps - (float)roundedStep);
-    if (missedSteps > 1) {
-        roundedStep = roundedStep + 1;
-        missedSteps--;
+  if (!isSettled() || !lastOriginValid) {
+    if (stateSaved) {
+      savedState->magic = 0;
+      stateSaved = false;
     }
-  return roundedStep;
+    return;
+  }
+
+  if (!stateSaved) {
+    savedState->letterPosition = currentLetterPosition;
+    savedState->destinationLetter = destinationLetter;
+    savedState->stepsFromOrigin = stepper->getCurrentPosition() - lastOriginPosition;
+    savedState->magic = UNIT_STATE_MAGIC;
+    savedState->checksum = stateChecksum(savedState);
+    stateSaved = true;
+  }
 }
 
-// translates char to letter position
-uint8_t Unit::translateLettertoInt(char letterchar) {
-  for (int i = 0; i < 45; i++) {
-    if (letterchar == letters[i]) {
-      return i;
+// Once a move has settled, count how long it took and how far it went
+void Unit::recordSettle() {
+  if (moveTimed && isSettled()) {
+    moveTimed = false;
+    metricsMoveSettled(unitNum, millis() - moveStartMillis, stepper->getCurrentPosition() - moveStartPosition);
+
+    if (healthState == UNIT_DEGRADED && ++recoveredMoves >= UNIT_RECOVERED_MOVES) {
+      failures = 0;
+      setHealth(UNIT_HEALTHY);
+      logEvent(LOG_UNIT_RECOVERED, unitNum);
+    }
+  }
+}
+
+UnitHealth Unit::health() {
+  return healthState;
+}
+
+void Unit::setHealth(UnitHealth health) {
+  healthState = health;
+  metricsUnitHealth(unitNum, health);
+}
+
+// Taking moves: not disabled, and not parked waiting to retry
+boolean Unit::inService() {
+  return healthState != UNIT_DISABLED && !retryPending;
+}
+
+// Failed to home, or stuck: park, and home again after the backoff unless out of retries
+void Unit::failed() {
+  failures++;
+  metricsUnitFault(unitNum);
+  moveTimed = false;
+
+  if (failures >= UNIT_RETRY_LIMIT) {
+    setHealth(UNIT_DISABLED);
+    logEvent(LOG_UNIT_OUT_OF_SERVICE, unitNum, failures);
+  }
+  else {
+    uint32_t backoffMs = (uint32_t)UNIT_RETRY_BACKOFF_MS << (failures - 1);
+    setHealth(UNIT_RETRYING);
+    retryPending = true;
+    retryMillis = millis() + backoffMs;
+    logEvent(LOG_UNIT_RETRY, unitNum, failures, backoffMs);
+  }
+  park();
+}
+
+// Stopped where it is with nothing to do, so the display can settle around it
+void Unit::park() {
+  calibrationComplete = true;
+  calibrationStarted = false;
+  originCrossingPending = false;
+  pendingLetter = 0;
+  scheduledLetter = 0;
+}
+
+// Motion task, each pass: home again once the backoff is up, and keep a unit out of service parked
+void Unit::healthUpdate() {
+  if (retryPending && (int32_t)(millis() - retryMillis) >= 0) {
+    retryPending = false;
+    calibrationComplete = false;
+    calibrationStarted = false;
+    pendingLetter = destinationLetter;
+    return;
+  }
+
+  if (!inService()) {
+    park();
+  }
+}
+
+// The display's moving watchdog ran out with this unit still going
+void Unit::stopStuck() {
+  logEvent(LOG_UNIT_STUCK, unitNum);
+  trace(TRACE_STUCK, unitNum);
+  stepper->forceStop();
+  if (speedTuning) {
+    speedTuning = false;
+    setSpeedProfile(savedSpeedUs, savedAcceleration);
+  }
+  autoTuneRevolutions = 0;
+  lastOriginValid = false;
+  currentLetterPosition = 0;
+  failed();
+}
+
+// First sensor edge after restoring: it should be one revolution on from the saved origin
+boolean Unit::verifyRestoredPosition(int32_t edgePosition) {
+  int32_t error = edgePosition - flapSteps[FLAPCOUNT];
+
+  positionRestored = false;
+  if (abs(error) > RESTORE_TOLERANCE_STEPS) {
+    logEvent(LOG_UNIT_RESTORE_OUT, unitNum, error);
+    lastOriginValid = false;
+    originCrossingPending = false;
+    calibrationComplete = false;
+    calibrationStarted = false;
+    pendingLetter = destinationLetter;
+    return false;
+  }
+
+  logEvent(LOG_UNIT_RESTORE_VERIFIED, unitNum, error);
+  return true;
+}
+
+// Start from the values learned on a previous run, if any
+void Unit::loadTuning() {
+  UnitTuning tuning;
+  char key[8];
+
+  flapStep = FlapStep[unitNum];
+  calOffset = calOffsetUnit[unitNum];
+  speedUs = rotationSpeeduS;
+  acceleration = rotationAcceleration;
+  tuningSamples = 0;
+
+  snprintf(key, sizeof(key), "tune%02d", unitNum);
+  if (halStorageRead(key, &tuning, sizeof(tuning)) && tuning.magic == TUNING_MAGIC) {
+    flapStep = tuning.flapStep;
+    calOffset = tuning.calOffset;
+    speedUs = tuning.speedUs;
+    acceleration = tuning.acceleration;
+    tuningSamples = TUNING_SMOOTHING;
+    debugf("Unit %02d tuning: flap step %.3f, offset %d, speed %lu us, accel %lu\n", unitNum, flapStep, calOffset,
+           (unsigned long)speedUs, (unsigned long)acceleration);
+  }
+
+  savedFlapStep = flapStep;
+  savedCalOffset = calOffset;
+  savedSpeedUs = speedUs;
+  savedAcceleration = acceleration;
+  setSpeedProfile(speedUs, acceleration);
+  buildFlapSteps();
+}
+
+// Targets are always looked up from the last origin, so rounding never accumulates
+void Unit::buildFlapSteps() {
+  drumFlapSteps(flapStep, flapSteps);
+}
+
+// Write the learned values once they have moved far enough from what is stored
+void Unit::saveTuning() {
+  UnitTuning tuning;
+  char key[8];
+
+  if (fabs(flapStep - savedFlapStep) * FLAPCOUNT < TUNING_SAVE_STEPS && calOffset == savedCalOffset &&
+      speedUs == savedSpeedUs && acceleration == savedAcceleration) {
+    return;
+  }
+
+  tuning.magic = TUNING_MAGIC;
+  tuning.calOffset = calOffset;
+  tuning.flapStep = flapStep;
+  tuning.speedUs = speedUs;
+  tuning.acceleration = acceleration;
+  snprintf(key, sizeof(key), "tune%02d", unitNum);
+  if (halStorageWrite(key, &tuning, sizeof(tuning))) {
+    savedFlapStep = flapStep;
+    savedCalOffset = calOffset;
+    savedSpeedUs = speedUs;
+    savedAcceleration = acceleration;
+    debugf("Unit %02d tuning saved: flap step %.3f, offset %d, speed %lu us, accel %lu\n", unitNum, flapStep, calOffset,
+           (unsigned long)speedUs, (unsigned long)acceleration);
+  }
+}
+
+// Steps since the previous sensor edge are one full revolution, if the drum kept moving forward
+void Unit::learnRevolution(int32_t originPosition) {
+  if (lastOriginValid) {
+    int32_t revolutionSteps = originPosition - lastOriginPosition;
+    float expectedSteps = flapStep * FLAPCOUNT;
+
+    if (fabs(revolutionSteps - expectedSteps) <= TUNING_TOLERANCE_STEPS) {
+      // average the first measurements equally, then smooth
+      if (tuningSamples < TUNING_SMOOTHING) {
+        tuningSamples++;
+      }
+      flapStep += ((float)revolutionSteps / FLAPCOUNT - flapStep) / tuningSamples;
+      buildFlapSteps();
+      // debugf("Unit %02d revolution %ld steps, flap step %.3f\n", unitNum, (long)revolutionSteps, flapStep);
+    }
+    else {
+      logEvent(LOG_UNIT_REVOLUTION_IGNORED, unitNum, revolutionSteps);
     }
   }
-  return 0;
+
+  lastOriginPosition = originPosition;
+  lastOriginValid = true;
+}
+
+// On demand: measure a few full revolutions from scratch, then home
+void Unit::autoTuneStart() {
+  logEvent(LOG_UNIT_AUTOTUNE_STARTED, unitNum);
+  tuningSamples = 0;
+  lastOriginValid = false;
+  autoTuneRevolutions = TUNING_AUTO_REVOLUTIONS;
+  calibrationComplete = false;
+  calibrationStarted = false;
+  pendingLetter = destinationLetter;
+}
+
+void Unit::setSpeedProfile(uint32_t newSpeedUs, uint32_t newAcceleration) {
+  speedUs = newSpeedUs;
+  acceleration = newAcceleration;
+  stepper->setSpeedInUs(speedUs);  // the parameter is us/step
+  stepper->setAcceleration(acceleration);
 }
 
-// calc flaps to rotate to get to a specified letter
-uint8_t Unit::flapsToRotateToLetter(char letterchar, boolean *recalibrate) {
-    int8_t newLetterPosition;
-    int8_t deltaFlapPosition;
+// Level 0 is the default profile, each level after it 1/8 faster
+void Unit::setSpeedTuneLevel(uint8_t level) {
+  uint32_t scale = 8 + level;
 
-    newLetterPosition = translateLettertoInt(letterchar);
-    deltaFlapPosition = newLetterPosition - currentLetterPosition;
+  speedTuneLevel = level;
+  speedTuneRevolutions = 0;
+  setSpeedProfile(rotationSpeeduS * 8 / scale, rotationAcceleration * scale * scale / 64);
+  logEvent(LOG_UNIT_SPEED_LEVEL, unitNum, level, speedUs, acceleration);
+}
+
+// On demand: run whole revolutions, faster and faster, until the drum misses steps.
+// Only from settled, as the drum has to be homed afterwards anyway.
+void Unit::speedTuneStart() {
+  if (!isSettled() || !inService()) {
+    logEvent(LOG_UNIT_SPEED_TUNE_BUSY, unitNum);
+    return;
+  }
+
+  logEvent(LOG_UNIT_SPEED_TUNE_STARTED, unitNum);
+  lastOriginValid = false; // measure from the first edge seen
+  speedTuning = true;
+  setSpeedTuneLevel(0);
+}
+
+// Motion task: start the next revolution once the last one has stopped. Returns true if one started.
+boolean Unit::speedTuneUpdate() {
+  if (!speedTuning) {
+    return false;
+  }
 
-    if (deltaFlapPosition < 0) {
-      deltaFlapPosition = 45 + deltaFlapPosition;
-      *recalibrate = true;
+  // lost position (sensor glitch): abandon, keeping the profile from before
+  if (!calibrationComplete) {
+    logEvent(LOG_UNIT_SPEED_TUNE_ABANDONED, unitNum);
+    speedTuning = false;
+    setSpeedProfile(savedSpeedUs, savedAcceleration);
+    return false;
+  }
+
+  if (stepper->isRunning()) {
+    return false;
+  }
+  stepper->move(flapSteps[FLAPCOUNT]);
+  return true;
+}
+
+boolean Unit::isSpeedTuning() {
+  return speedTuning;
+}
+
+// Each sensor edge ends a revolution: more steps than expected means the drum fell behind
+void Unit::checkSpeedTuneRevolution(int32_t originPosition) {
+  boolean measured = lastOriginValid;
+  int32_t error = originPosition - lastOriginPosition - flapSteps[FLAPCOUNT];
+
+  lastOriginPosition = originPosition;
+  lastOriginValid = true;
+  if (!measured) {
+    return;
+  }
+
+  if (abs(error) > SPEED_TUNE_TOLERANCE_STEPS) {
+    logEvent(LOG_UNIT_SPEED_MISSED, unitNum, error, speedTuneLevel);
+    speedTuneFinish(speedTuneLevel > SPEED_TUNE_MARGIN_LEVELS ? speedTuneLevel - 1 - SPEED_TUNE_MARGIN_LEVELS : 0);
+  }
+  else if (++speedTuneRevolutions >= SPEED_TUNE_REVOLUTIONS) {
+    if (speedTuneLevel >= SPEED_TUNE_MAX_LEVEL) {
+      speedTuneFinish(SPEED_TUNE_MAX_LEVEL);
     }
     else {
-      currentLetterPosition = newLetterPosition;
+      setSpeedTuneLevel(speedTuneLevel + 1);
     }
+  }
+}
 
-    return deltaFlapPosition;
+// Keep the profile for the level, and home again as steps may have been missed
+void Unit::speedTuneFinish(uint8_t level) {
+  setSpeedTuneLevel(level);
+  speedTuning = false;
+  lastOriginValid = false;
+  calibrationComplete = false;
+  calibrationStarted = false;
+  pendingLetter = destinationLetter;
+  logEvent(LOG_UNIT_SPEED_TUNED, unitNum, speedUs, acceleration);
+}
+
+// Steps from the sensor edge to the blank flap. Re-homes so the change can be seen.
+void Unit::setCalOffset(uint8_t offset) {
+  calOffset = offset;
+  calibrationComplete = false;
+  calibrationStarted = false;
+  pendingLetter = destinationLetter;
+  logEvent(LOG_UNIT_OFFSET_SET, unitNum, calOffset);
+}
+
+// translates char to letter position (blank if it isn't on the drum)
+uint8_t Unit::translateLettertoInt(char letterchar) {
+  uint8_t flap = flapForChar(letterchar);
+  return (flap == FLAP_UNKNOWN) ? 0 : flap;
 }
 
-// calc steps to rotate forward a specified number of flaps
-uint16_t Unit::stepsToRotateFlaps(uint16_t flaps) {
-  float preciseStep = (float)flaps * FlapStep[unitNum];
-  return stepsToRotate (preciseStep);
+
+// calc steps to rotate forward a specified number of flaps from the blank flap
+int32_t Unit::stepsToRotateFlaps(uint16_t flaps) {
+  return (int32_t)(flaps / FLAPCOUNT) * flapSteps[FLAPCOUNT] + flapSteps[flaps % FLAPCOUNT];
+}
+
+// Where the drum next shows this flap, at or after earliest
+int32_t Unit::letterTarget(uint8_t flap, int32_t earliest) {
+  return drumFlapTarget(flapSteps, lastOriginPosition, calOffset, flap, earliest);
+}
+
+// Where the magnet will next be passed, going forward from position
+int32_t Unit::nextOriginPosition(int32_t position) {
+  int32_t origin = lastOriginPosition + flapSteps[FLAPCOUNT];
+
+  while (origin <= position) {
+    origin += flapSteps[FLAPCOUNT];
+  }
+  return origin;
 }
 
 // only for testing: Move stepper by a raw number of steps
-void Unit::moveStepperbyStep(int16_t steps) {
+void Unit::moveStepperbyStep(int32_t steps) {
     stepper->move(steps);
 }
 
@@ -79,49 +449,176 @@ void Unit::moveStepperbyFlap(uint16_t flaps) {
 }
 
 void Unit::moveSteppertoLetter(char toLetter) {
-  boolean recalibrate = false;
+  // parked: shown once it is back in service
+  if (!inService()) {
+    destinationLetter = toLetter;
+    return;
+  }
+
+  // A settled drum may be up to half a flap past where it shows its flap. A moving one is
+  // planned from where it can stop, as a target short of that is overshot and driven back to.
+  int32_t position = stepper->getCurrentPosition();
+  int32_t earliest = position - ORIGIN_TOLERANCE_STEPS;
+  if (stepper->isRunning()) {
+    earliest = stepper->getStoppingPosition();
+    trace(TRACE_STOPPING_AT, unitNum, 0, earliest);
+  }
+  trace(TRACE_MOVE_TO_LETTER, unitNum, (uint8_t)toLetter, position);
+  scheduledLetter = 0; // superseded
+
+  // Wait for any move through the origin to be corrected before planning from it
+  if (originCrossingPending) {
+    pendingLetter = toLetter;
+    return;
+  }
 
   destinationLetter = toLetter;
 
-  uint8_t flapsToMove = flapsToRotateToLetter(toLetter, &recalibrate);
-  debugf("Unit %02d flapsToMove %d\n", unitNum, flapsToMove);
+  // a move that supersedes one still going is timed from the first
+  metricsMoveStarted(unitNum);
+  if (!moveTimed) {
+    moveTimed = true;
+    moveStartMillis = millis();
+    moveStartPosition = position;
+  }
 
-  if (recalibrate) {
-    calibrationComplete = false;
-    pendingLetter = toLetter;
-    debugf("Unit %02d pendingLetter '%c'\n", unitNum, pendingLetter);
-    debugf("Pending,%02d,'%c'\n", unitNum, pendingLetter);
+  if (flapForChar(toLetter) == FLAP_UNKNOWN) {
+    logEvent(LOG_UNIT_NO_FLAP, unitNum, toLetter);
+  }
+  uint8_t flap = translateLettertoInt(toLetter);
+  int32_t target = letterTarget(flap, earliest);
+  int32_t origin = nextOriginPosition(position);
+
+  logEvent(LOG_UNIT_FLAPS_TO_MOVE, unitNum, (flap + FLAPCOUNT - currentLetterPosition) % FLAPCOUNT);
+  currentLetterPosition = flap;
+
+  // Moves past the magnet are planned in full, then corrected when the hall sensor is passed
+  if (target >= origin) {
+    originCrossingPending = true;
+    crossingStepsPastOrigin = target - origin;
+    logEvent(LOG_UNIT_WRAP, unitNum, toLetter);
   }
   else {
-    debugf("Unit %02d move to '%c'\n", unitNum, toLetter);
-    moveStepperbyFlap(flapsToMove);
-    pendingLetter = 0;
+    logEvent(LOG_UNIT_MOVE, unitNum, toLetter);
+  }
+  stepper->moveTo(target);
+  pendingLetter = 0;
+}
+
+// Time for a trapezoidal move of this many steps (a triangle if top speed isn't reached)
+uint32_t Unit::moveDurationMs(uint32_t steps) {
+  float maxSpeed = 1000000.0 / speedUs; // steps/s
+  float rampSteps = maxSpeed * maxSpeed / acceleration; // accelerating plus decelerating
+
+  if (steps == 0) {
+    return 0;
+  }
+  if (steps < rampSteps) {
+    return (uint32_t)(2000.0 * sqrtf(steps / (float)acceleration));
   }
+  return (uint32_t)(1000.0 * (steps / maxSpeed + maxSpeed / acceleration));
+}
+
+// How long a move to this letter would take from where the drum is now, including going
+// round through the origin. 0 if the unit is busy, as it can't be predicted, or out of service.
+uint32_t Unit::moveDurationToLetter(char toLetter) {
+  if (!isSettled() || !inService()) {
+    return 0;
+  }
+
+  int32_t position = stepper->getCurrentPosition();
+  int32_t steps = letterTarget(translateLettertoInt(toLetter), position - ORIGIN_TOLERANCE_STEPS) - position;
+  return moveDurationMs(max(steps, (int32_t)0));
+}
+
+// Worst case for any move: nearly a revolution, round to the flap before the one showing,
+// from a drum that may have settled up to ORIGIN_TOLERANCE_STEPS off its flap
+uint32_t Unit::longestMoveDuration() {
+  return moveDurationMs(flapSteps[FLAPCOUNT] + ORIGIN_TOLERANCE_STEPS);
+}
+
+// Move to the letter once startMillis has passed (and the scheduler has a motor free for it)
+void Unit::scheduleMoveToLetter(char toLetter, uint32_t startMillis) {
+  scheduledLetter = 0;
+  if (!inService()) {
+    destinationLetter = toLetter;
+    return;
+  }
+  scheduledDurationMs = moveDurationToLetter(toLetter);
+  scheduledLetter = toLetter;
+  scheduledStartMillis = startMillis;
+}
+
+boolean Unit::moveDue() {
+  return scheduledLetter != 0 && (int32_t)(millis() - scheduledStartMillis) >= 0;
+}
+
+uint32_t Unit::scheduledDuration() {
+  return scheduledLetter != 0 ? scheduledDurationMs : 0;
+}
+
+void Unit::startScheduledMove() {
+  if (moveDue()) {
+    char toLetter = scheduledLetter;
+    scheduledLetter = 0;
+    // recalibrating since it was scheduled: move once that's done
+    if (!calibrationComplete || speedTuning) {
+      pendingLetter = toLetter;
+      return;
+    }
+    moveSteppertoLetter(toLetter);
+  }
+}
+
+boolean Unit::moveScheduled() {
+  return scheduledLetter != 0;
 }
 
 // start calibration of the unit using the hall sensor
 void Unit::calibrateStart() {
+  uint32_t sinceEdgeUs = micros() - lastHallEdgeUs;
+  int32_t flapStepBits;
+
+  memcpy(&flapStepBits, &flapStep, sizeof(flapStepBits));
+  trace(TRACE_TUNING, unitNum, calOffset | (tuningSamples << 8), flapStepBits);
+  trace(TRACE_CALIBRATE, unitNum, currentHallValue, (int32_t)min(sinceEdgeUs, (uint32_t)INT32_MAX));
+
+  positionRestored = false;
   calibrationComplete = false;
   calibrationStarted = true;
   calibrationStartTime = millis();
+  originCrossingPending = false;
+  metricsCalibrationStarted(unitNum);
 
   stepper->runForward();
 
   // if starting within range of the sensor, need to move outside range before doing calibration
   if (currentHallValue == 0) {
-      debugf("preInitialise started for Unit %d\n", unitNum);
+      logEvent(LOG_UNIT_PREINITIALISE_STARTED, unitNum);
       preInitialise = true;
   }
   else {
       preInitialise = false;
   }
 
-  debugf("Calibration started for Unit %d\n", unitNum);
+  logEvent(LOG_UNIT_CALIBRATION_STARTED, unitNum);
   
   stepper->runForward();
 }
 
-// continue calibration of the unit using the hall sensor
+// The sensor glitched: step off the magnet, then home again and carry on to the destination
+void Unit::recalibrate() {
+  if (!inService()) {
+    return;
+  }
+  trace(TRACE_RECALIBRATE, unitNum);
+  moveStepperbyFlap(1);
+  calibrationComplete = false;
+  calibrationStarted = false;
+  pendingLetter = destinationLetter;
+}
+
+// continue calibration of the unit (the marker itself is handled as a hall edge)
 int8_t Unit::calibrate() {
   if (!calibrationComplete) {
 
@@ -130,37 +627,16 @@ int8_t Unit::calibrate() {
       currentLetterPosition = 0;
       calibrationComplete = true;
       calibrationStarted= false;
-      debugf("calibration for Unit %d failed\n", unitNum);
+      lastOriginValid = false;
+      autoTuneRevolutions = 0;
+      logEvent(LOG_UNIT_CALIBRATION_FAILED, unitNum);
+      trace(TRACE_CALIBRATION_FAILED, unitNum);
+      metricsCalibrationFailed(unitNum);
       stepper->forceStop();
+      failed();
       return -1;
     }
 
-    // if reached end of preinitialisation phase
-    if (preInitialise == true && currentHallValue == 1) {
-      preInitialise = false;
-      debugf("preInitialise completed for Unit %d\n", unitNum);
-    }
-    //if still in preinitialising phase, keep moving
-    else if (preInitialise == true) {
-      return 0;
-    }
-    // if sensor reached, do calibration
-    else if (currentHallValue == 0) {
-      // reached marker, go to calibrated offset position
-      debugf("Calb,%02d\n", unitNum);
-      stepper->forceStopAndNewPosition(0);
-      delay(1); // attempt to fix rare hangup
-      stepper->move(calOffsetUnit[unitNum]);
-      currentLetterPosition = 0;
-      missedSteps = 0;
-      calibrationComplete = true;
-      calibrationStarted = false;
-      // Reset speed
-      // stepper->setSpeedInUs(rotationSpeeduS);  // the parameter is us/step
-      debugf("Unit %d calibrated\n", unitNum);
-      return 1;
-      }
-
     return 0;
   }
 
@@ -168,26 +644,212 @@ int8_t Unit::calibrate() {
   return 1;
 }
 
+// Reached the marker: carry on to the calibrated offset from where the edge was seen, without stopping
+void Unit::completeCalibration(int32_t originPosition) {
+  logEvent(LOG_UNIT_CALIBRATION_ORIGIN, unitNum);
+  stepper->moveTo(originPosition + calOffset);
+  currentLetterPosition = 0;
+  calibrationComplete = true;
+  calibrationStarted = false;
+  logEvent(LOG_UNIT_CALIBRATED, unitNum);
+  trace(TRACE_CALIBRATED, unitNum);
+  metricsCalibrationCompleted(unitNum, millis() - calibrationStartTime);
+
+  // homed again after a failure, but not trusted until it has settled a few moves
+  if (healthState == UNIT_RETRYING) {
+    recoveredMoves = 0;
+    setHealth(UNIT_DEGRADED);
+    logEvent(LOG_UNIT_DEGRADED, unitNum, failures);
+  }
+}
+
 boolean Unit::checkIfRunning() {
   return stepper->isRunning();
 }
 
-boolean Unit::updateHallValue(uint8_t updatedHallValue) {
+// Running, or still powered just before or after a move
+boolean Unit::isMotorEnabled() {
+  return stepper->isRunning() || halEnablePinSet(unitEnablePin(unitNum));
+}
+
+// Homed, stopped and with no move waiting
+boolean Unit::isSettled() {
+  return calibrationComplete && !calibrationStarted && !speedTuning && !originCrossingPending && pendingLetter == 0 && scheduledLetter == 0 && !stepper->isRunning();
+}
+
+// If a move through the origin finished without passing the hall sensor, position is lost
+void Unit::checkOriginCrossing() {
+  if (originCrossingPending && !stepper->isRunning()) {
+    logEvent(LOG_UNIT_MISSED_ORIGIN, unitNum);
+    trace(TRACE_MISSED_ORIGIN, unitNum);
+    originCrossingPending = false;
+    lastOriginValid = false;
+    calibrationComplete = false;
+    calibrationStarted = false;
+    pendingLetter = destinationLetter;
+  }
+}
+
+// Hall sensor passed during a move through the origin: re-plan the remaining steps from it
+void Unit::correctAtOrigin(int32_t originPosition) {
+  stepper->moveTo(originPosition + crossingStepsPastOrigin);
+  originCrossingPending = false;
+  logEvent(LOG_UNIT_ORIGIN, unitNum, originPosition);
+}
+
+// Starting value of the sensor, before any edges are captured. By default it last changed
+// long enough ago that an edge straight after boot isn't a glitch.
+void Unit::initHallValue(uint8_t hallValue, uint32_t sinceEdgeUs) {
+  currentHallValue = hallValue;
+  sensedHallValue = hallValue;
+  lastHallEdgeUs = micros() - sinceEdgeUs;
+}
+
+// Sensor task: note when and where the drum was when the sensor changed
+void Unit::recordHallEdge(uint8_t hallValue, uint32_t timeUs) {
+  if (hallValue == sensedHallValue) {
+    return;
+  }
+  sensedHallValue = hallValue;
+
+  HallEdge edge = {timeUs, stepper->getCurrentPosition(), hallValue};
+  if (!hallEdges.push(edge)) {
+    hallEdgeOverflow = true;
+  }
+}
+
+// Motion task: act on the captured edges in order. Returns false if the sensor glitched.
+boolean Unit::processHallEdges() {
+  HallEdge edge;
+  boolean hallValid = true;
+  uint16_t samePass = 0;
+
+  while (hallEdges.pop(edge)) {
+    traceAt(edge.timeUs, TRACE_HALL_EDGE, unitNum, edge.value | samePass, edge.position);
+    samePass = TRACE_EDGE_SAME_PASS;
+    if (hallValid) {
+      hallValid = updateHallValue(edge);
+      if (!hallValid) {
+        lastOriginValid = false;
+      }
+    }
+    // already recalibrating, just keep track of the sensor
+    else {
+      currentHallValue = edge.value;
+      lastHallEdgeUs = edge.timeUs;
+    }
+  }
+
+  // Edges were dropped, so position can't be trusted
+  if (hallEdgeOverflow) {
+    hallEdgeOverflow = false;
+    currentHallValue = sensedHallValue;
+    lastOriginValid = false;
+    logEvent(LOG_UNIT_HALL_LOST, unitNum);
+    trace(TRACE_HALL_LOST, unitNum);
+    hallValid = false;
+  }
+
+  return hallValid;
+}
+
+// Homed and running normally: a magnet edge should come a whole number of revolutions after
+// the last one. Returns false once position can't be recovered.
+boolean Unit::checkHomedEdge(const HallEdge& edge) {
+  int32_t revolutionSteps = flapSteps[FLAPCOUNT];
+  int32_t sinceOrigin = edge.position - lastOriginPosition;
+
+  // only the magnet arriving marks a position
+  if (edge.value != 0) {
+    return true;
+  }
+
+  // sensor bounce or noise, well before the magnet can come round again
+  if (sinceOrigin < revolutionSteps / 2) {
+    logEvent(LOG_UNIT_HALL_AFTER_ORIGIN, unitNum, sinceOrigin);
+    metricsNoiseEdge(unitNum);
+    return true;
+  }
+
+  // steps from the nearest expected crossing
+  int32_t error = (sinceOrigin + revolutionSteps / 2) % revolutionSteps - revolutionSteps / 2;
+  if (abs(error) > ORIGIN_TOLERANCE_STEPS) {
+    if (++implausibleEdges >= ORIGIN_IMPLAUSIBLE_LIMIT) {
+      metricsNoiseEdge(unitNum);
+      logEvent(LOG_UNIT_HALL_KEEP_MISSING, unitNum);
+      implausibleEdges = 0;
+      return false;
+    }
+    logEvent(LOG_UNIT_HALL_FROM_ORIGIN, unitNum, error);
+    metricsNoiseEdge(unitNum);
+    return true;
+  }
+  implausibleEdges = 0;
+
+  learnRevolution(edge.position);
+  if (originCrossingPending) {
+    correctAtOrigin(edge.position);
+  }
+  // passing the origin outside a planned crossing: make up the difference without stopping
+  else if (error != 0 && stepper->isRunning()) {
+    stepper->move(error);
+    logEvent(LOG_UNIT_CORRECTED, unitNum, error);
+  }
+  return true;
+}
+
+boolean Unit::updateHallValue(const HallEdge& edge) {
   uint32_t timedelta;
-  if (updatedHallValue != currentHallValue) {
-    timedelta = millis() - lastHallUpdateTime;
+  if (edge.value != currentHallValue) {
+    timedelta = edge.timeUs - lastHallEdgeUs;
 
-    currentHallValue = updatedHallValue;
-    lastHallUpdateTime = millis();
-    // debugf("Unit: %d, Hall: %d, Delta: %d\n", unitNum, currentHallValue, timedelta);
-    // debugf("Hall,%02d,%d,%lu,%d,%d,%d,'%c'\n", unitNum, currentHallValue, timedelta, preInitialise, calibrationStarted, calibrationComplete, pendingLetter);
+    currentHallValue = edge.value;
+    lastHallEdgeUs = edge.timeUs;
+
+    if (lastOriginValid && calibrationComplete && !calibrationStarted && !positionRestored && !speedTuning) {
+      return checkHomedEdge(edge);
+    }
+    // debugf("Hall,%02d,%d,%lu,%ld,%d,%d,%d,'%c'\n", unitNum, currentHallValue, timedelta, (long)edge.position, preInitialise, calibrationStarted, calibrationComplete, pendingLetter);
 
     // If occasional glitch occurrs, start calibration again
-    if (timedelta <= 100) {
-      debugf(TXT_RED "GLITCH,%02d,%d,%d,'%c'\n" TXT_RST, unitNum, updatedHallValue, timedelta, destinationLetter);
+    if (timedelta <= HALL_GLITCH_US) {
+      logEvent(LOG_UNIT_GLITCH, unitNum, edge.value, timedelta, destinationLetter);
+      trace(TRACE_GLITCH, unitNum, 0, timedelta);
+      metricsGlitch(unitNum);
       return false;
     }
+
+    if (currentHallValue == 0) {
+      if (positionRestored && !verifyRestoredPosition(edge.position)) {
+        return true;
+      }
+      // speed tuning expects missed steps, so they mustn't be learned from
+      if (speedTuning) {
+        checkSpeedTuneRevolution(edge.position);
+      }
+      // an edge seen before homing starts (as at power on) doesn't mark where the drum is
+      else if (calibrationComplete || (calibrationStarted && !preInitialise)) {
+        learnRevolution(edge.position);
+      }
+
+      if (originCrossingPending) {
+        correctAtOrigin(edge.position);
+      }
+      // when auto-tuning, keep running past the marker until enough revolutions are measured
+      else if (calibrationStarted && !preInitialise && autoTuneRevolutions > 0) {
+        autoTuneRevolutions--;
+        calibrationStartTime = millis();
+      }
+      else if (calibrationStarted && !preInitialise) {
+        completeCalibration(edge.position);
+      }
+    }
+    // if starting calibration within range of the sensor, it has now been left
+    else if (calibrationStarted && preInitialise) {
+      preInitialise = false;
+      logEvent(LOG_UNIT_PREINITIALISE_COMPLETED, unitNum);
+    }
   }
 
   return true;
-}
\ No newline at end of file
+}
@@ -0,0 +1,62 @@
+#include "words.h"
+#include "dictionary.h"
+#include "hal.h"
+#include "spsc_queue.h"
+
+// Producer: word task, consumer: network task
+static SpscQueue<PaddedWord, WORD_PREFETCH_COUNT + 1> wordQueue;
+static uint8_t wordTaskId;
+static uint32_t wordRetryMs = WORD_RETRY_MIN_MS;
+static boolean wordProviderFetching = false;
+
+// Fetch words until the ring is full, backing off while the network is unavailable
+static uint32_t wordTaskStep() {
+  PaddedWord word;
+  char fetched[UNITCOUNT + 1];
+
+  // Only fetch when there's room for the word, as each fetch is rate limited
+  if (wordQueue.full()) {
+    return WORD_RETRY_MAX_MS; // woken again by nextWord()
+  }
+
+  if (!fetchWord(fetched, sizeof(fetched))) {
+    debugf("Word fetch failed, retry in %lu ms\n", (unsigned long)wordRetryMs);
+    uint32_t waitMs = wordRetryMs;
+    wordRetryMs = min(wordRetryMs * 2, (uint32_t)WORD_RETRY_MAX_MS);
+    return waitMs;
+  }
+  wordRetryMs = WORD_RETRY_MIN_MS;
+
+  padToFullWidth(fetched, word.text, sizeof(word.text));
+  wordQueue.push(word); // this task is the only producer, so there's still room
+  return 0;
+}
+
+void wordProviderStart() {
+  // Only fetch from Wordnik if a key has been configured
+  if (sizeof(WORDNIKAPIKEY) > 1) {
+    wordProviderFetching = true;
+    wordTaskId = halStartTask("words", wordTaskStep, WORD_TASK_CORE, WORD_TASK_PRIORITY);
+  }
+}
+
+// Get the next word without blocking
+boolean nextWord(char* word) {
+  PaddedWord popped;
+  char fromDictionary[UNITCOUNT + 1];
+
+  if (wordQueue.pop(popped)) {
+    halNotifyTask(wordTaskId); // refill
+    memcpy(word, popped.text, sizeof(popped.text));
+    return true;
+  }
+
+  if (wordProviderFetching) {
+    debugln("Word queue empty, using dictionary");
+  }
+  if (!dictionaryRandomWord(fromDictionary, sizeof(fromDictionary))) {
+    return false;
+  }
+  padToFullWidth(fromDictionary, word, sizeof(popped.text));
+  return true;
+}
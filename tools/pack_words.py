@@ -0,0 +1,203 @@
+#!/usr/bin/env python3
+"""Pack a word list into a flash (PROGMEM) dictionary for the firmware.
+
+Reads tools/words.txt, keeps only words that can be shown on the flaps (every character
+in the DRUM_CHARSET for DRUM_FLAPS from include/drum.h) with a length between MINWORDLEN
+and UNITCOUNT, and writes src/dictionary_data.h:
+
+    dictionaryWords[]   all words concatenated, upper case, no separators
+    dictionaryOffsets[] start of each word, plus one entry for the end of the last word
+
+so word i is dictionaryWords[offsets[i] .. offsets[i+1]) and a random word can be read
+in constant time straight from flash.
+
+Usage:
+    pack_words.py              regenerate src/dictionary_data.h
+    pack_words.py --verify     decode the generated file and check it round-trips
+    pack_words.py --flaps 60   for another drum (default: the DRUM_FLAPS default in drum.h)
+
+Also runs as a PlatformIO pre-build script (extra_scripts), taking DRUM_FLAPS, MINWORDLEN
+and UNITCOUNT from the build flags where they are set there, and regenerating the dictionary
+only when the word list or configuration is newer than the generated file, or it was packed
+for another drum or word length. A build flag that a header would override (an unguarded
+#define) must agree with the header, or the build stops.
+"""
+
+import argparse
+import os
+import re
+import sys
+
+try:
+    ROOT = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+    PIO_FLAGS = None
+except NameError:
+    # PlatformIO runs extra_scripts without __file__
+    Import("env")  # noqa: F821
+    ROOT = env.subst("$PROJECT_DIR")  # noqa: F821
+    PIO_FLAGS = "%s %s" % (env.get("BUILD_FLAGS", []), env.get("CPPDEFINES", []))  # noqa: F821
+WORDLIST = os.path.join(ROOT, "tools", "words.txt")
+OUTPUT = os.path.join(ROOT, "src", "dictionary_data.h")
+DRUM = os.path.join(ROOT, "include", "drum.h")
+INPUTS = [WORDLIST, DRUM, os.path.join(ROOT, "include", "system.h"),
+          os.path.join(ROOT, "include", "config.h"), os.path.join(ROOT, "include", "config-private.h")]
+
+
+def read(path):
+    with open(path, encoding="utf-8") as f:
+        return f.read()
+
+
+def build_flag(name):
+    """A numeric -D from the PlatformIO build flags (-DNAME=n or a CPPDEFINES entry), or None."""
+    if PIO_FLAGS:
+        match = re.search(r"(?:-D\s*|\W)%s['\",\s]*=?\s*(\d+)" % name, PIO_FLAGS)
+        if match:
+            return int(match.group(1))
+    return None
+
+
+def config_value(name):
+    """A numeric #define as the firmware sees it, preferring config-private.h like the firmware
+    does. A build flag wins over an #ifndef default; an unguarded #define must agree with it."""
+    flag = build_flag(name)
+    for header in ("config-private.h", "config.h", "system.h"):
+        path = os.path.join(ROOT, "include", header)
+        if os.path.exists(path):
+            match = re.search(r"(#ifndef\s+%s\s+)?#define\s+%s\s+(\d+)" % (name, name), read(path))
+            if match:
+                value = int(match.group(2))
+                if flag is None:
+                    return value
+                if match.group(1) is None and value != flag:
+                    sys.exit("pack_words: %s is %d in the build flags but %d in include/%s" % (name, flag, value, header))
+                return flag
+    if flag is not None:
+        return flag
+    sys.exit("pack_words: %s not found in include/" % name)
+
+
+def drum_flaps(flaps=None):
+    """DRUM_FLAPS as given, else from the PlatformIO build flags, else drum.h's default."""
+    if flaps is None:
+        flaps = build_flag("DRUM_FLAPS")
+    if flaps is None:
+        match = re.search(r"#ifndef DRUM_FLAPS\s+#define DRUM_FLAPS\s+(\d+)", read(DRUM))
+        if not match:
+            sys.exit("pack_words: default DRUM_FLAPS not found in include/drum.h")
+        flaps = int(match.group(1))
+    return flaps
+
+
+def charset(flaps):
+    """The characters on a drum of this many flaps, from its DRUM_CHARSET in drum.h."""
+    match = re.search(r"#(?:el)?if DRUM_FLAPS == %d\s+#define DRUM_CHARSET\s+(\"(?:[^\"\\]|\\.)*\")" % flaps, read(DRUM))
+    if not match:
+        sys.exit("pack_words: no DRUM_CHARSET for DRUM_FLAPS %d in include/drum.h" % flaps)
+    letters = re.sub(r"\\(.)", r"\1", match.group(1)[1:-1])
+    if len(letters) != flaps:
+        sys.exit("pack_words: DRUM_CHARSET for DRUM_FLAPS %d has %d flaps" % (flaps, len(letters)))
+    return set(letters)
+
+
+def settings(flaps):
+    """The #defines recording what the dictionary was packed for, so a change repacks it."""
+    return ["#define DICTIONARY_DRUM_FLAPS %d" % flaps,
+            "#define DICTIONARY_MIN_LENGTH %d" % config_value("MINWORDLEN"),
+            "#define DICTIONARY_MAX_LENGTH %d" % config_value("UNITCOUNT")]
+
+
+def load_words(flaps):
+    allowed = charset(flaps)
+    min_len = config_value("MINWORDLEN")
+    max_len = config_value("UNITCOUNT")
+    words = []
+    seen = set()
+    for line in read(WORDLIST).splitlines():
+        word = line.strip().upper()
+        if not word or word.startswith("#") or word in seen:
+            continue
+        if min_len <= len(word) <= max_len and all(c in allowed for c in word):
+            words.append(word)
+            seen.add(word)
+    if not words:
+        sys.exit("pack_words: no usable words in %s" % WORDLIST)
+    return words
+
+
+def generate(words, flaps):
+    blob = "".join(words)
+    offsets = [0]
+    for word in words:
+        offsets.append(offsets[-1] + len(word))
+    offset_type = "uint16_t" if len(blob) <= 0xFFFF else "uint32_t"
+
+    lines = ["// Generated by tools/pack_words.py from tools/words.txt - do not edit",
+             "#pragma once",
+             ""] + settings(flaps) + [
+             "#define DICTIONARY_WORD_COUNT %d" % len(words),
+             "",
+             "static const %s dictionaryOffsets[] PROGMEM = {" % offset_type]
+    for i in range(0, len(offsets), 12):
+        lines.append("  " + ", ".join(str(o) for o in offsets[i:i + 12]) + ",")
+    lines.append("};")
+    lines.append("")
+    lines.append("static const char dictionaryWords[] PROGMEM =")
+    for i in range(0, len(words), 8):
+        lines.append('  "' + "".join(words[i:i + 8]) + '"')
+    lines.append("  ;")
+    return "\n".join(lines) + "\n"
+
+
+def decode(source):
+    """Read the words back out of a generated dictionary_data.h."""
+    count = int(re.search(r"#define DICTIONARY_WORD_COUNT (\d+)", source).group(1))
+    offsets_src = re.search(r"dictionaryOffsets\[\] PROGMEM = \{(.*?)\};", source, re.S).group(1)
+    offsets = [int(o) for o in re.findall(r"\d+", offsets_src)]
+    blob = "".join(re.findall(r'"([^"]*)"', source.split("dictionaryWords[]", 1)[1]))
+    if len(offsets) != count + 1 or offsets[-1] != len(blob):
+        sys.exit("pack_words: offset index does not match word data")
+    return [blob[offsets[i]:offsets[i + 1]] for i in range(count)]
+
+
+def pack(flaps):
+    words = load_words(flaps)
+    with open(OUTPUT, "w", encoding="utf-8") as f:
+        f.write(generate(words, flaps))
+    print("pack_words: %d words, %d bytes of text -> %s" % (len(words), sum(map(len, words)), os.path.relpath(OUTPUT, ROOT)))
+
+
+def verify(flaps):
+    expected = load_words(flaps)
+    decoded = decode(read(OUTPUT))
+    if decoded != expected:
+        missing = set(expected) ^ set(decoded)
+        sys.exit("pack_words: round trip FAILED (%d words differ, e.g. %s)" % (len(missing), sorted(missing)[:5]))
+    print("pack_words: round trip OK, %d words" % len(decoded))
+
+
+def out_of_date(flaps):
+    if not os.path.exists(OUTPUT):
+        return True
+    source = read(OUTPUT)
+    if any(line + "\n" not in source for line in settings(flaps)):
+        return True
+    built = os.path.getmtime(OUTPUT)
+    return any(os.path.exists(path) and os.path.getmtime(path) > built for path in INPUTS)
+
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--verify", action="store_true", help="check the generated file decodes to the filtered word list")
+    parser.add_argument("--flaps", type=int, help="DRUM_FLAPS of the drum to pack for")
+    args = parser.parse_args()
+    flaps = drum_flaps(args.flaps)
+    if args.verify:
+        verify(flaps)
+    else:
+        pack(flaps)
+else:
+    # PlatformIO extra_scripts
+    flaps = drum_flaps()
+    if out_of_date(flaps):
+        pack(flaps)
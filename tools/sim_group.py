@@ -0,0 +1,67 @@
+#!/usr/bin/env python3
+"""Run several simulated controllers as one display group on loopback and check they land together.
+
+Starts a leader and followers from the native build (see src/sim/sim_main.cpp), each showing
+the next UNITCOUNT columns of the sign, then compares the wall clock time each one reported
+landing every group frame. Fails if any frame landed further apart than the tolerance, or
+showed the wrong letters.
+
+    pio run -e native && tools/sim_group.py
+
+Usage: sim_group.py [--program .pio/build/native/program] [--controllers 3] [--units 12] [--tolerance 50]
+"""
+
+import argparse
+import re
+import subprocess
+import sys
+
+LANDED = re.compile(r"group (\d+): \[(.*)\] landed at (\d+) ms.*?(MISMATCH)?$")
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("--program", default=".pio/build/native/program")
+    parser.add_argument("--controllers", type=int, default=3)
+    parser.add_argument("--units", type=int, default=12, help="UNITCOUNT of the build")
+    parser.add_argument("--tolerance", type=int, default=50, help="ms between the first and last controller to land")
+    args = parser.parse_args()
+
+    width = args.controllers * args.units
+    processes = []
+    for controller in range(args.controllers):
+        role = "leader" if controller == 0 else "follower"
+        command = [args.program, "--group", role, str(controller * args.units), str(width)]
+        processes.append(subprocess.Popen(command, stdout=subprocess.PIPE, stderr=subprocess.DEVNULL, text=True))
+
+    landed = {}  # frame -> [(controller, epoch ms, columns)]
+    failed = False
+    for controller, process in enumerate(processes):
+        output, _ = process.communicate()
+        if process.returncode != 0:
+            print("controller %d exited with %d" % (controller, process.returncode))
+            failed = True
+        for line in output.splitlines():
+            match = LANDED.match(line)
+            if match:
+                frame = int(match.group(1))
+                landed.setdefault(frame, []).append((controller, int(match.group(3)), match.group(2)))
+                failed = failed or match.group(4) is not None
+
+    if not landed:
+        print("no frames landed")
+        return 1
+
+    for frame in sorted(landed):
+        times = [epoch_ms for _, epoch_ms, _ in landed[frame]]
+        spread = max(times) - min(times)
+        sign = "".join(columns for _, _, columns in sorted(landed[frame]))
+        print("frame %d: [%s] %d controllers landed within %d ms" % (frame, sign, len(times), spread))
+        if len(times) != args.controllers or spread > args.tolerance:
+            failed = True
+
+    return 1 if failed else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,143 @@
+#!/usr/bin/env python3
+"""Fetch, decode and replay the display's event trace (see include/trace.h).
+
+The controller keeps the last few hundred unit events in RTC memory, so the run up to a restart
+can still be fetched afterwards. A trace replays deterministically against the Unit code in the
+native simulator, which reports the first command each unit gives that differs from the trace.
+
+    trace.py --host splitflap.local fetch trace.bin
+    trace.py show trace.bin                    # one line per record
+    trace.py show trace.bin --unit 3
+    trace.py replay trace.bin                  # against .pio/build/native/program
+
+`trace.py test` records a trace in the simulator (program --record), replays it and checks
+every unit did the same again.
+"""
+
+import argparse
+import os
+import struct
+import subprocess
+import sys
+import tempfile
+import urllib.request
+
+MAGIC = 0x52544653
+VERSION = 3
+HEADER = struct.Struct("<IBBBBI")
+RECORD = struct.Struct("<IBBHi")
+TYPES = ["boot", "command", "tuning", "calibrate", "recalibrate", "move to letter", "hall edge", "hall lost", "stopped", "stuck",
+         "stopping at", "stepper move", "stepper move to", "stepper run forward", "stepper stop", "calibrated", "calibration failed", "glitch",
+         "missed origin"]
+FIRST_OUTPUT = TYPES.index("stepper move")
+COMMANDS = ["display", "move flaps", "move all flaps", "move steps", "autotune", "set offset", "queue frame", "speed tune", "clear frames"]
+EDGE_SAME_PASS = 0x100
+
+
+def load(data):
+    """Header fields and the records, oldest first."""
+    magic, version, record_size, units, flaps, count = HEADER.unpack_from(data)
+    if magic != MAGIC or version != VERSION or record_size != RECORD.size:
+        raise ValueError("not a version %d trace" % VERSION)
+    records = [RECORD.unpack_from(data, HEADER.size + i * RECORD.size) for i in range(min(count, (len(data) - HEADER.size) // RECORD.size))]
+    return units, flaps, records
+
+
+def describe(kind, arg, value):
+    if kind >= len(TYPES):
+        return "type %d, %d, %d" % (kind, arg, value)
+    name = TYPES[kind]
+    if name == "boot":
+        return "boot, %d records from before" % value
+    if name == "command":
+        command = COMMANDS[arg] if arg < len(COMMANDS) else str(arg)
+        if command in ("display", "queue frame"):
+            return "command %s [%s...]" % (command, struct.pack("<i", value).rstrip(b"\0").decode("latin-1"))
+        return "command %s %d" % (command, value)
+    if name == "tuning":
+        return "tuning offset %d, flap step %.3f (%d revolutions)" % (arg & 0xFF, struct.unpack("<f", struct.pack("<i", value))[0], arg >> 8)
+    if name == "calibrate":
+        return "calibrate, hall %d, last changed %d us before" % (arg, value)
+    if name == "move to letter":
+        return "move to '%c' from %d" % (arg, value)
+    if name == "hall edge":
+        return "hall edge %d at %d%s" % (arg & 1, value, ", same pass" if arg & EDGE_SAME_PASS else "")
+    if name == "stepper stop" and arg:
+        return "stepper stop, new position %d" % value
+    if name in ("stopped", "stopping at", "stepper move", "stepper move to"):
+        return "%s %d" % (name, value)
+    if name == "glitch":
+        return "glitch, %d us after the last edge" % value
+    return name
+
+
+def show(args):
+    with open(args.file, "rb") as file:
+        units, flaps, records = load(file.read())
+    print("%d records, %d units of %d flaps" % (len(records), units, flaps))
+    for time_us, kind, unit, arg, value in records:
+        if args.unit is not None and (kind == TYPES.index("boot") or unit != args.unit):
+            continue
+        who = "" if kind in (TYPES.index("boot"), TYPES.index("command")) else "unit %02d " % unit
+        print("%10d.%03d ms %s%s%s" % (time_us // 1000, time_us % 1000, "  -> " if kind >= FIRST_OUTPUT else "", who, describe(kind, arg, value)))
+    return 0
+
+
+def fetch(args):
+    with urllib.request.urlopen("http://%s/trace" % args.host, timeout=10) as response:
+        data = response.read()
+    units, flaps, records = load(data)
+    with open(args.file, "wb") as file:
+        file.write(data)
+    print("%d records from %d units saved to %s" % (len(records), units, args.file))
+    return 0
+
+
+def replay(args):
+    return subprocess.run([args.program, "--replay", args.file], stderr=subprocess.DEVNULL).returncode
+
+
+def self_test(args):
+    """Record a trace in the simulator, then replay it."""
+    handle, path = tempfile.mkstemp(suffix=".bin")
+    os.close(handle)
+    try:
+        subprocess.run([args.program, "--record", path], stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL, check=True)
+        with open(path, "rb") as file:
+            _, _, records = load(file.read())
+        result = subprocess.run([args.program, "--replay", path], stdout=subprocess.PIPE, stderr=subprocess.DEVNULL, text=True)
+    finally:
+        os.unlink(path)
+
+    print(result.stdout, end="")
+    outputs = sum(1 for record in records if record[1] >= FIRST_OUTPUT)
+    passed = result.returncode == 0 and outputs > 0 and " 0 mismatches" in result.stdout
+    print("%-40s %s" % ("replay matches the recording", "ok" if passed else "FAILED"))
+    return 0 if passed else 1
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("--host", default="splitflap.local")
+    commands = parser.add_subparsers(dest="command", required=True)
+    commands.add_parser("fetch").add_argument("file")
+    show_parser = commands.add_parser("show")
+    show_parser.add_argument("file")
+    show_parser.add_argument("--unit", type=int)
+    replay_parser = commands.add_parser("replay")
+    replay_parser.add_argument("file")
+    replay_parser.add_argument("--program", default=".pio/build/native/program")
+    commands.add_parser("test").add_argument("--program", default=".pio/build/native/program")
+    args = parser.parse_args()
+
+    if args.command == "fetch":
+        return fetch(args)
+    if args.command == "show":
+        return show(args)
+    if args.command == "replay":
+        return replay(args)
+    return self_test(args)
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,185 @@
+#!/usr/bin/env python3
+"""Client for the display's binary UDP commands (see include/udp_api.h).
+
+Each command is sent as one datagram with a new sequence number and repeated, with the same
+sequence number, until it is answered, so a lost reply never makes the display act twice.
+
+    udp_client.py --host splitflap.local display "HELLO WORLD"
+    udp_client.py units 0=J 4=Y                # only these units change, queued frames are dropped
+    udp_client.py queue "THREE" --hold 500     # play frames in turn
+    udp_client.py queue "LIFT OFF" --barrier
+    udp_client.py clear                        # drop queued frames
+    udp_client.py status
+
+`udp_client.py test` starts the native simulator serving commands on loopback
+(.pio/build/native/program --udp), checks each command against it and reports round trip times.
+"""
+
+import argparse
+import random
+import signal
+import socket
+import struct
+import subprocess
+import sys
+import time
+
+MAGIC = 0x4653
+VERSION = 1
+OP_STATUS, OP_DISPLAY, OP_UNITS, OP_QUEUE_FRAME, OP_CLEAR_FRAMES = range(5)
+RESULTS = ["ok", "repeat", "queue full", "malformed"]
+FLAG_BARRIER = 0x01
+HISTORY = 8  # sequence numbers the display remembers
+
+HEADER = struct.Struct("<HBBI")
+TEXT = struct.Struct("<HBB")
+REPLY = struct.Struct("<HBBIBBI")
+
+
+class Display:
+    def __init__(self, host, port, timeout=0.2, attempts=10):
+        self.address = (socket.gethostbyname(host), port)
+        self.socket = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+        self.socket.settimeout(timeout)
+        self.attempts = attempts
+        self.sequence = random.getrandbits(32)
+
+    def send(self, op, body=b"", sequence=None):
+        """Send until answered, returning (result, idle, lands in ms, text, round trip ms)."""
+        if sequence is None:
+            self.sequence = (self.sequence + 1) & 0xFFFFFFFF
+            sequence = self.sequence
+        datagram = HEADER.pack(MAGIC, VERSION, op, sequence) + body
+        for _ in range(self.attempts):
+            sent = time.monotonic()
+            self.socket.sendto(datagram, self.address)
+            try:
+                while True:
+                    reply = self.socket.recv(256)
+                    magic, _, reply_op, reply_sequence, result, idle, lands_in_ms = REPLY.unpack_from(reply)
+                    if magic == MAGIC and reply_op == op and reply_sequence == sequence:
+                        text = reply[REPLY.size:].decode("latin-1")
+                        return RESULTS[result], bool(idle), lands_in_ms, text, (time.monotonic() - sent) * 1000
+            except socket.timeout:
+                continue
+        raise TimeoutError("no reply from %s:%d" % self.address)
+
+    def status(self):
+        return self.send(OP_STATUS)
+
+    def display(self, text):
+        data = text.upper().encode("latin-1")
+        return self.send(OP_DISPLAY, TEXT.pack(0, 0, len(data)) + data)
+
+    def units(self, letters):
+        body = bytes([len(letters)]) + b"".join(struct.pack("<Bc", unit, letter.upper().encode("latin-1")) for unit, letter in letters)
+        return self.send(OP_UNITS, body)
+
+    def queue(self, text, hold=0, barrier=False):
+        data = text.upper().encode("latin-1")
+        return self.send(OP_QUEUE_FRAME, TEXT.pack(hold, FLAG_BARRIER if barrier else 0, len(data)) + data)
+
+    def clear(self):
+        return self.send(OP_CLEAR_FRAMES)
+
+    def wait_idle(self, timeout=60):
+        deadline = time.monotonic() + timeout
+        time.sleep(0.1)
+        while time.monotonic() < deadline:
+            reply = self.status()
+            if reply[1]:
+                return reply
+            time.sleep(0.1)
+        raise TimeoutError("display still moving")
+
+
+def show(reply):
+    result, idle, lands_in_ms, text, round_trip = reply
+    print("%s: [%s] %s, %.1f ms round trip" % (result, text, "idle" if idle else "lands in %d ms" % lands_in_ms, round_trip))
+
+
+def check(name, condition):
+    print("%-40s %s" % (name, "ok" if condition else "FAILED"))
+    return condition
+
+
+def self_test(args):
+    """Drive the simulator through every command on loopback."""
+    process = subprocess.Popen([args.program, "--udp"], stdout=subprocess.PIPE, stderr=subprocess.DEVNULL, text=True)
+    passed = True
+    try:
+        display = Display("127.0.0.1", args.port, attempts=50)
+        width = len(display.wait_idle()[3])
+
+        reply = display.display("HELLO")
+        passed &= check("display", reply[0] == "ok")
+        passed &= check("same sequence not acted on again", display.send(OP_DISPLAY, TEXT.pack(0, 0, 5) + b"WORLD", display.sequence)[0] == "repeat")
+        sequence = display.sequence
+        for _ in range(HISTORY):
+            display.status()
+        passed &= check("status polls don't push it out", display.send(OP_DISPLAY, TEXT.pack(0, 0, 5) + b"WORLD", sequence)[0] == "repeat")
+        passed &= check("display landed", display.wait_idle()[3] == "HELLO".ljust(width))
+
+        passed &= check("units", display.units([(0, "J"), (4, "Y")])[0] == "ok")
+        passed &= check("units landed, others kept", display.wait_idle()[3] == "JELLY".ljust(width))
+
+        display.queue("THREE", hold=300)
+        display.queue("LIFT OFF", barrier=True)
+        display.units([(0, "Q")])
+        passed &= check("units replace queued frames", display.wait_idle(timeout=120)[3][0] == "Q")
+
+        passed &= check("queue frame", display.queue("THREE", hold=300)[0] == "ok")
+        passed &= check("queue barrier frame", display.queue("LIFT OFF", barrier=True)[0] == "ok")
+        time.sleep(0.2)
+        passed &= check("frames played", display.wait_idle(timeout=120)[3] == "LIFT OFF".ljust(width))
+        passed &= check("clear frames", display.clear()[0] == "ok")
+
+        passed &= check("length mismatch rejected", display.send(OP_DISPLAY, TEXT.pack(0, 0, 9) + b"SHORT")[0] == "malformed")
+        passed &= check("unit out of range rejected", display.send(OP_UNITS, bytes([1, width]) + b"A")[0] == "malformed")
+        passed &= check("unknown op rejected", display.send(42)[0] == "malformed")
+
+        round_trips = [display.status()[4] for _ in range(50)]
+        print("status round trip: mean %.1f ms, worst %.1f ms" % (sum(round_trips) / len(round_trips), max(round_trips)))
+    finally:
+        process.send_signal(signal.SIGTERM)
+        output, _ = process.communicate(timeout=10)
+
+    passed &= check("drums show the last frame", "shown: [%s]" % "LIFT OFF".ljust(width) in output)
+    return 0 if passed else 1
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("--host", default="splitflap.local")
+    parser.add_argument("--port", type=int, default=4211)
+    commands = parser.add_subparsers(dest="command", required=True)
+    commands.add_parser("status")
+    commands.add_parser("display").add_argument("text")
+    commands.add_parser("units").add_argument("letters", nargs="+", help="unit=letter")
+    queue = commands.add_parser("queue")
+    queue.add_argument("text")
+    queue.add_argument("--hold", type=int, default=0, help="ms")
+    queue.add_argument("--barrier", action="store_true")
+    commands.add_parser("clear")
+    commands.add_parser("test").add_argument("--program", default=".pio/build/native/program")
+    args = parser.parse_args()
+
+    if args.command == "test":
+        return self_test(args)
+
+    display = Display(args.host, args.port)
+    if args.command == "status":
+        show(display.status())
+    elif args.command == "display":
+        show(display.display(args.text))
+    elif args.command == "units":
+        show(display.units([(int(unit), letter) for unit, letter in (pair.split("=", 1) for pair in args.letters)]))
+    elif args.command == "queue":
+        show(display.queue(args.text, args.hold, args.barrier))
+    elif args.command == "clear":
+        show(display.clear())
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
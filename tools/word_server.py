@@ -0,0 +1,61 @@
+#!/usr/bin/env python3
+"""Local stand-in for the Wordnik random word API, for testing the word provider.
+
+Serves {"word": ...} over plain HTTP/1.1 with keep-alive (optionally chunked), and can
+drop requests to simulate an outage. Point the firmware at it from config-private.h:
+
+    #define WORDNIK_HOST "192.168.1.10"
+    #define WORDNIK_PORT 8080
+    #define WORDNIK_TLS 0
+
+Usage: word_server.py [--port 8080] [--chunked] [--fail-every N]
+"""
+
+import argparse
+import json
+import random
+from http.server import BaseHTTPRequestHandler, ThreadingHTTPServer
+
+WORDS = ["ALGORITHM", "ESCARPMENT", "FILIGREE", "HEMISPHERE", "KALEIDOSCOPE", "QUADRANT",
+         "MARZIPAN", "OBSIDIAN", "PARAGLIDER", "SYCOPHANT", "TAMBOURINE", "WANDERLUST"]
+
+
+class WordHandler(BaseHTTPRequestHandler):
+    protocol_version = "HTTP/1.1"
+    requests = 0
+
+    def do_GET(self):
+        WordHandler.requests += 1
+        if self.server.fail_every and WordHandler.requests % self.server.fail_every == 0:
+            self.send_error(503)
+            return
+
+        body = json.dumps({"id": WordHandler.requests, "word": random.choice(WORDS).lower()}).encode()
+        self.send_response(200)
+        self.send_header("Content-Type", "application/json")
+        if self.server.chunked:
+            self.send_header("Transfer-Encoding", "chunked")
+            self.end_headers()
+            self.wfile.write(b"%x\r\n%s\r\n0\r\n\r\n" % (len(body), body))
+        else:
+            self.send_header("Content-Length", str(len(body)))
+            self.end_headers()
+            self.wfile.write(body)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--port", type=int, default=8080)
+    parser.add_argument("--chunked", action="store_true", help="use chunked transfer encoding")
+    parser.add_argument("--fail-every", type=int, default=0, help="answer every Nth request with 503")
+    args = parser.parse_args()
+
+    server = ThreadingHTTPServer(("", args.port), WordHandler)
+    server.chunked = args.chunked
+    server.fail_every = args.fail_every
+    print(f"Serving random words on port {args.port}")
+    server.serve_forever()
+
+
+if __name__ == "__main__":
+    main()